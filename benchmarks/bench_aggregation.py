@@ -0,0 +1,78 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+
+
+    The same syscall-count tool two ways: streaming every event over a ringbuf
+    and counting in Python, versus aggregating in the kernel with
+    BPF_AGGREGATION() and reading the counts once per interval. Reports the
+    CPU time of this process, which includes the BPF programs running in its
+    syscalls, for one million events.
+"""
+
+import os
+import resource
+import ctypes as ct
+from collections import Counter
+
+from common import load_skeleton, report
+from pybpf.aggregation import Aggregation
+
+EVENTS = 1000000
+# Syscalls per interval, after which userspace collects the counts
+INTERVAL = 10000
+
+def cpu_time() -> float:
+    usage = resource.getrusage(resource.RUSAGE_SELF)
+    return usage.ru_utime + usage.ru_stime
+
+def run(collect) -> float:
+    start = cpu_time()
+    for _ in range(EVENTS // INTERVAL):
+        for _ in range(INTERVAL):
+            os.getppid()
+        collect()
+    return cpu_time() - start
+
+def main():
+    stream = load_skeleton('syscount_stream.bpf.c')
+    agg = load_skeleton('syscount_agg.bpf.c')
+
+    counts = Counter()
+
+    @stream.maps.events.callback(ct.c_uint)
+    def _count(ctx, data, size):
+        counts[data.value] += 1
+
+    aggregation = Aggregation(agg.maps.syscalls)
+
+    # Both programs stay attached throughout and only count syscalls from the
+    # target process, so the baseline includes the cost of filtering
+    report('baseline: syscalls only', run(lambda: None), EVENTS)
+
+    stream.maps.target[0] = os.getpid()
+    report('streaming: ringbuf + Counter', run(stream.ringbuf_consume), EVENTS)
+    stream.maps.target[0] = 0
+    stream.ringbuf_consume()
+
+    agg.maps.target[0] = os.getpid()
+    report('aggregated: BPF_AGGREGATION + reset()', run(aggregation.reset), EVENTS)
+    agg.maps.target[0] = 0
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,49 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+
+    Full rebuild time of every test BPF object with Bootstrap.build_all(), as
+    the number of parallel jobs grows.
+"""
+
+import os
+import glob
+
+from common import Timer, report, OUTDIR, load_skeleton
+from pybpf.bootstrap import Bootstrap
+from pybpf.utils import project_path
+
+def main():
+    bpf_srcs = sorted(glob.glob(os.path.join(project_path('tests/bpf_src'), '*.bpf.c')))
+    # Make sure the output directory exists
+    load_skeleton('tc.bpf.c', autoload=False)
+
+    jobs = 1
+    while True:
+        with Timer() as t:
+            result = Bootstrap.build_all(bpf_srcs, outdir=OUTDIR, jobs=jobs, cache=False)
+        failed = [o['source'] for o in result['objects'] if 'error' in o]
+        if failed:
+            raise Exception(f'Failed to build {failed}')
+        report(f'build_all, {len(bpf_srcs)} objects, {jobs} jobs', t.elapsed, len(bpf_srcs))
+        if jobs >= os.cpu_count():
+            break
+        jobs = min(jobs * 2, os.cpu_count())
+
+if __name__ == '__main__':
+    main()
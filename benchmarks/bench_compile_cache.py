@@ -0,0 +1,64 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+
+    Bootstrap startup cost with a cold build cache (clang and llvm-strip on
+    every start) versus a warm one (cached object and skeleton).
+"""
+
+import os
+import shutil
+import tempfile
+
+from common import load_skeleton, Timer, report, BPF_DIR, OUTDIR
+from pybpf.bootstrap import Bootstrap
+
+RUNS = 5
+BPF_SRC = os.path.join(BPF_DIR, 'tc.bpf.c')
+
+def main():
+    # Make sure vmlinux.h and pybpf.bpf.h exist, so only compilation is measured
+    load_skeleton('tc.bpf.c', autoload=False)
+
+    # Bootstrap drops privileges, so the cache must be writable by the sudo user
+    cache_dir = tempfile.mkdtemp(prefix='pybpf-cache-bench-')
+    os.chmod(cache_dir, 0o777)
+    Bootstrap.CACHE_DIR = cache_dir
+    try:
+        with Timer() as t:
+            for _ in range(RUNS):
+                shutil.rmtree(cache_dir)
+                os.makedirs(cache_dir)
+                os.chmod(cache_dir, 0o777)
+                Bootstrap.bootstrap(BPF_SRC, outdir=OUTDIR)
+        report(f'bootstrap, cold cache ({RUNS} runs)', t.elapsed, RUNS)
+
+        with Timer() as t:
+            for _ in range(RUNS):
+                Bootstrap.bootstrap(BPF_SRC, outdir=OUTDIR)
+        report(f'bootstrap, warm cache ({RUNS} runs)', t.elapsed, RUNS)
+
+        with Timer() as t:
+            for _ in range(RUNS):
+                Bootstrap.bootstrap(BPF_SRC, outdir=OUTDIR, cache=False)
+        report(f'bootstrap, cache disabled ({RUNS} runs)', t.elapsed, RUNS)
+    finally:
+        shutil.rmtree(cache_dir, ignore_errors=True)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,58 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+
+
+    In-kernel counter increments on the hit path, timed by the kernel with
+    bpf_prog_test_run_opts(): the old two-lookup bpf_map_lookup_or_try_init
+    versus the hit-first one, and atomic versus plain adds on per-cpu maps.
+"""
+
+import ctypes as ct
+
+from common import load_skeleton
+
+RUNS = 1000000
+
+PROGS = [
+    'hash_legacy_init',
+    'hash_hit_first',
+    'percpu_hash_atomic',
+    'percpu_hash_plain',
+    'array_atomic',
+    'percpu_array_atomic',
+    'percpu_array_plain',
+]
+
+def main():
+    skel = load_skeleton('counters.bpf.c', autoload=False)
+    skel.open_bpf()
+    skel.load_bpf()
+
+    # XDP test runs need at least an ethernet header of data
+    packet = (ct.c_ubyte * 64)()
+
+    for name in PROGS:
+        prog = getattr(skel.progs, name)
+        # Insert the key first so that every timed run takes the hit path
+        prog.invoke(packet)
+        ns = prog.benchmark(RUNS, packet)
+        print(f'{name:<48} {ns:10.1f} ns/op')
+
+if __name__ == '__main__':
+    main()
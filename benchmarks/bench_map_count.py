@@ -0,0 +1,44 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+
+
+    Counting hash map entries: one bpf_map_get_next_key() per key versus
+    batched lookups versus reading a BPF_MAP_OCCUPANCY() counter.
+"""
+
+from common import load_skeleton, Timer, report
+
+RUNS = 1000
+
+def main():
+    skel = load_skeleton('maps.bpf.c')
+    _map = skel.maps.hash_counters
+    for i in range(_map.capacity()):
+        _map[i] = i
+
+    for name, count in (('get_next_key', _map._count_keys),
+                        ('lookup_batch', _map.count),
+                        ('occupancy counter', lambda: _map.count(exact=False))):
+        with Timer() as t:
+            for _ in range(RUNS):
+                count()
+        report(f'count {_map.capacity()} entries: {name}', t.elapsed, RUNS)
+
+if __name__ == '__main__':
+    main()
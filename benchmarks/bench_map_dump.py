@@ -0,0 +1,48 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+
+
+    Reading every entry of a 2M-entry hash map: iteritems() versus batched
+    lookups versus a BPF_MAP_ITER() iterator.
+"""
+
+from common import load_skeleton, Timer, report
+
+def main():
+    skel = load_skeleton('dump.bpf.c')
+    big = skel.maps.big
+    entries = big.capacity()
+
+    for i in range(entries):
+        big[i] = i
+
+    with Timer() as t:
+        n = sum(1 for _ in big.iteritems())
+    report(f'iteritems() ({n} entries)', t.elapsed, n)
+
+    with Timer() as t:
+        keys, values = big.lookup_batch()
+    report(f'lookup_batch() ({len(keys)} entries)', t.elapsed, len(keys))
+
+    with Timer() as t:
+        records = big.dump()
+    report(f'dump() ({len(records)} entries)', t.elapsed, len(records))
+
+if __name__ == '__main__':
+    main()
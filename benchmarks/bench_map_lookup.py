@@ -0,0 +1,57 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+
+
+    Scalar map lookups from userspace: map[key] versus the allocation-free
+    get_int() and get_into() paths.
+"""
+
+import ctypes as ct
+
+from common import load_skeleton, Timer, report
+
+LOOKUPS = 1000000
+
+def bench(name: str, _map):
+    for i in range(16):
+        _map[i] = i
+
+    with Timer() as t:
+        for i in range(LOOKUPS):
+            _map[i & 15].value
+    report(f'{name}: map[key]', t.elapsed, LOOKUPS)
+
+    with Timer() as t:
+        for i in range(LOOKUPS):
+            _map.get_int(i & 15)
+    report(f'{name}: get_int(key)', t.elapsed, LOOKUPS)
+
+    out = _map.ValueType()
+    with Timer() as t:
+        for i in range(LOOKUPS):
+            _map.get_into(i & 15, out).value
+    report(f'{name}: get_into(key, out)', t.elapsed, LOOKUPS)
+
+def main():
+    skel = load_skeleton('maps.bpf.c')
+    bench('array', skel.maps.counters)
+    bench('hash', skel.maps.hash_counters)
+
+if __name__ == '__main__':
+    main()
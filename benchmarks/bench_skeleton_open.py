@@ -0,0 +1,58 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+
+    Skeleton import and open_bpf() cost with the BPF object read from disk
+    versus embedded in the skeleton, raw and compressed.
+"""
+
+import os
+import importlib.util
+
+from common import load_skeleton, Timer, report, BPF_DIR, OUTDIR
+from pybpf.skeleton import generate_skeleton, close_bpf_object
+from pybpf.utils import drop_privileges
+
+RUNS = 100
+BPF_OBJ = os.path.join(BPF_DIR, 'tc.bpf.o')
+
+@drop_privileges
+def make_outdir(outdir):
+    os.makedirs(outdir, exist_ok=True)
+
+def main():
+    # Make sure tc.bpf.o is built
+    load_skeleton('tc.bpf.c', autoload=False)
+
+    for embed in (None, 'raw', 'zlib'):
+        outdir = os.path.join(OUTDIR, f'embed-{embed or "none"}')
+        make_outdir(outdir)
+        skel_file, skel_cls = generate_skeleton(BPF_OBJ, outdir, embed)
+        size = os.path.getsize(skel_file)
+        with Timer() as t:
+            for _ in range(RUNS):
+                spec = importlib.util.spec_from_file_location(skel_cls, skel_file)
+                skel_mod = importlib.util.module_from_spec(spec)
+                spec.loader.exec_module(skel_mod)
+                skel = getattr(skel_mod, skel_cls)(autoload=False)
+                skel.open_bpf()
+                close_bpf_object(skel.bpf_object)
+        report(f'import and open_bpf, embed={embed} ({size >> 10} KiB, {RUNS} runs)', t.elapsed, RUNS)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,79 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+
+    Bulk TC attach: ProgSchedCls.attach_tc() over netlink versus shelling out
+    to tc(8) once per interface.
+"""
+
+import subprocess
+
+from common import load_skeleton, Timer, report, BPF_DIR
+from pybpf.utils import which
+
+IFACE_COUNT = 200
+IFACES = [f'pybpfbench{i}' for i in range(IFACE_COUNT)]
+
+def setup():
+    for iface in IFACES:
+        subprocess.run(['ip', 'link', 'add', 'name', iface, 'type', 'dummy'], check=True)
+
+def teardown():
+    for iface in IFACES:
+        subprocess.run(['ip', 'link', 'del', iface], stderr=subprocess.DEVNULL)
+
+def bench_attach_tc(skel):
+    prog = skel.progs.tc_pass
+    with Timer() as t:
+        prog.attach_tc(*IFACES, direction='ingress')
+    report(f'attach_tc ({IFACE_COUNT} interfaces)', t.elapsed, IFACE_COUNT)
+    with Timer() as t:
+        prog.detach_tc(*IFACES, direction='ingress')
+    report(f'detach_tc ({IFACE_COUNT} interfaces)', t.elapsed, IFACE_COUNT)
+
+def bench_tc_shell():
+    try:
+        tc = which('tc')
+    except FileNotFoundError:
+        print('tc not found, skipping shell comparison')
+        return
+    obj = f'{BPF_DIR}/tc.bpf.o'
+    with Timer() as t:
+        for iface in IFACES:
+            subprocess.run([tc, 'qdisc', 'add', 'dev', iface, 'clsact'], stderr=subprocess.DEVNULL)
+            subprocess.run([tc, 'filter', 'add', 'dev', iface, 'ingress', 'bpf', 'direct-action',
+                'object-file', obj, 'section', 'classifier'], check=True)
+    report(f'tc filter add ({IFACE_COUNT} interfaces)', t.elapsed, IFACE_COUNT)
+    with Timer() as t:
+        for iface in IFACES:
+            subprocess.run([tc, 'filter', 'del', 'dev', iface, 'ingress'], check=True)
+    report(f'tc filter del ({IFACE_COUNT} interfaces)', t.elapsed, IFACE_COUNT)
+
+def main():
+    skel = load_skeleton('tc.bpf.c', autoload=False)
+    skel.open_bpf()
+    skel.load_bpf()
+    setup()
+    try:
+        bench_attach_tc(skel)
+        bench_tc_shell()
+    finally:
+        teardown()
+
+if __name__ == '__main__':
+    main()
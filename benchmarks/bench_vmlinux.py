@@ -0,0 +1,52 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+
+    Per-object compile time against the full vmlinux.h, a pruned one, and
+    their precompiled versions.
+"""
+
+import os
+
+from common import load_skeleton, Timer, report, BPF_DIR, OUTDIR
+from pybpf.bootstrap import Bootstrap
+
+RUNS = 5
+BPF_SRC = os.path.join(BPF_DIR, 'tc.bpf.c')
+
+def main():
+    # Make sure vmlinux.h and pybpf.bpf.h exist
+    load_skeleton('tc.bpf.c', autoload=False)
+
+    try:
+        for prune in (False, True):
+            with Timer() as t:
+                vmlinux_h = Bootstrap.generate_vmlinux(BPF_DIR, prune=prune, pch=True)
+            header = 'pruned' if prune else 'full'
+            size = os.path.getsize(os.path.realpath(vmlinux_h))
+            report(f'generate {header} vmlinux.h and pch ({size >> 10} KiB)', t.elapsed)
+            for pch in (False, True):
+                with Timer() as t:
+                    for _ in range(RUNS):
+                        Bootstrap.compile_bpf(BPF_SRC, outdir=OUTDIR, pch=pch)
+                report(f'compile_bpf, {header} vmlinux.h{", pch" if pch else ""} ({RUNS} runs)', t.elapsed, RUNS)
+    finally:
+        Bootstrap.generate_vmlinux(BPF_DIR)
+
+if __name__ == '__main__':
+    main()
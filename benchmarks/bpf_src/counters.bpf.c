@@ -0,0 +1,81 @@
+#include "pybpf.bpf.h"
+
+/* Variants of a keyed counter increment, each run with
+ * bpf_prog_test_run_opts() */
+
+BPF_HASH(hash_counts, u32, u64, 1024, 0);
+BPF_PERCPU_HASH(percpu_hash_counts, u32, u64, 1024, 0);
+BPF_ARRAY(array_counts, u64, 1024, 0);
+BPF_PERCPU_ARRAY(percpu_array_counts, u64, 1024, 0);
+
+/* The previous bpf_map_lookup_or_try_init, which always looked up twice */
+static __always_inline void *legacy_lookup_or_try_init(void *map, const void *key, const void *val) {
+    void *res = bpf_map_lookup_elem(map, key);
+    if (!res) {
+        bpf_map_update_elem(map, key, val, BPF_NOEXIST);
+    }
+    return bpf_map_lookup_elem(map, key);
+}
+
+SEC("xdp")
+int hash_legacy_init(struct xdp_md *ctx) {
+    u32 key = 1;
+    u64 zero = 0;
+    u64 *count = legacy_lookup_or_try_init(&hash_counts, &key, &zero);
+    if (count)
+        lock_xadd(count, 1);
+    return XDP_PASS;
+}
+
+SEC("xdp")
+int hash_hit_first(struct xdp_md *ctx) {
+    u32 key = 1;
+    bpf_counter_increment(hash_counts, &key, 1);
+    return XDP_PASS;
+}
+
+SEC("xdp")
+int percpu_hash_atomic(struct xdp_md *ctx) {
+    u32 key = 1;
+    u64 zero = 0;
+    u64 *count = bpf_map_lookup_or_try_init(&percpu_hash_counts, &key, &zero);
+    if (count)
+        lock_xadd(count, 1);
+    return XDP_PASS;
+}
+
+SEC("xdp")
+int percpu_hash_plain(struct xdp_md *ctx) {
+    u32 key = 1;
+    bpf_counter_increment(percpu_hash_counts, &key, 1);
+    return XDP_PASS;
+}
+
+SEC("xdp")
+int array_atomic(struct xdp_md *ctx) {
+    u32 key = 1;
+    u64 *count = bpf_map_lookup_elem(&array_counts, &key);
+    if (count)
+        bpf_counter_add(array_counts, count, 1);
+    return XDP_PASS;
+}
+
+SEC("xdp")
+int percpu_array_atomic(struct xdp_md *ctx) {
+    u32 key = 1;
+    u64 *count = bpf_map_lookup_elem(&percpu_array_counts, &key);
+    if (count)
+        lock_xadd(count, 1);
+    return XDP_PASS;
+}
+
+SEC("xdp")
+int percpu_array_plain(struct xdp_md *ctx) {
+    u32 key = 1;
+    u64 *count = bpf_map_lookup_elem(&percpu_array_counts, &key);
+    if (count)
+        bpf_counter_add(percpu_array_counts, count, 1);
+    return XDP_PASS;
+}
+
+char _license[] SEC("license") = "GPL";
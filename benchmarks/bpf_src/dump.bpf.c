@@ -0,0 +1,6 @@
+#include "pybpf.bpf.h"
+
+BPF_HASH(big, u32, u64, 2097152, 0);
+BPF_MAP_ITER(big, u32, u64);
+
+char _license[] SEC("license") = "GPL";
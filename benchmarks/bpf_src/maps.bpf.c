@@ -0,0 +1,7 @@
+#include "pybpf.bpf.h"
+
+BPF_ARRAY(counters, u64, 1024, 0);
+BPF_HASH(hash_counters, u32, u64, 1024, 0);
+BPF_MAP_OCCUPANCY(hash_counters);
+
+char _license[] SEC("license") = "GPL";
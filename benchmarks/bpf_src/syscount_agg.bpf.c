@@ -0,0 +1,23 @@
+#include "pybpf.bpf.h"
+
+/* Count the syscalls made by the target process by id, in the kernel */
+
+BPF_AGGREGATION(syscalls, u32, 1024);
+BPF_ARRAY(target, u32, 1, 0);
+
+SEC("tracepoint/raw_syscalls/sys_enter")
+int aggregate_sys_enter(struct trace_event_raw_sys_enter *ctx)
+{
+    u32 zero = 0;
+    u32 *tgid = bpf_map_lookup_elem(&target, &zero);
+    u32 id = ctx->id;
+
+    if (!tgid || *tgid != bpf_get_current_pid_tgid() >> 32)
+        return 0;
+
+    bpf_aggregate(syscalls, &id, 1);
+
+    return 0;
+}
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,9 @@
+#include "pybpf.bpf.h"
+
+SEC("classifier")
+int tc_pass(struct __sk_buff *skb)
+{
+    return 0; /* TC_ACT_OK */
+}
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,70 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+
+    Shared helpers for the pybpf benchmarks. Benchmarks must be run as root,
+    for example with "make bench".
+"""
+
+import os
+import sys
+import time
+import shutil
+import importlib.util
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+
+from pybpf.bootstrap import Bootstrap
+from pybpf.utils import project_path, module_path, drop_privileges
+
+BPF_DIR = project_path('benchmarks/bpf_src')
+OUTDIR = '/tmp/pybpf-bench'
+
+@drop_privileges
+def _prepare_dirs():
+    os.makedirs(OUTDIR, exist_ok=True)
+    shutil.copy(module_path('templates/bpf/pybpf.bpf.h'), BPF_DIR)
+
+def load_skeleton(bpf_name: str, *args, **kwargs):
+    """
+    Bootstrap benchmarks/bpf_src/@bpf_name and return an instance of its
+    skeleton class, constructed with @args and @kwargs.
+    """
+    _prepare_dirs()
+    skel_file, skel_cls = Bootstrap.bootstrap(os.path.join(BPF_DIR, bpf_name), outdir=OUTDIR)
+    spec = importlib.util.spec_from_file_location(skel_cls, skel_file)
+    skel_mod = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(skel_mod)
+    return getattr(skel_mod, skel_cls)(*args, **kwargs)
+
+class Timer:
+    """
+    Context manager that measures elapsed wall clock time in seconds.
+    """
+    def __enter__(self):
+        self.start = time.perf_counter()
+        return self
+
+    def __exit__(self, *args):
+        self.elapsed = time.perf_counter() - self.start
+
+def report(name: str, seconds: float, ops: int = 1):
+    """
+    Print a single benchmark result.
+    """
+    print(f'{name:<48} {seconds * 1e3:10.2f} ms {seconds / ops * 1e6:12.2f} us/op')
@@ -24,11 +24,12 @@ from .maps import create_map
 from .programs import create_prog
 from .lib import Lib
 from .bootstrap import Bootstrap
+from .timing import LoadReport
 from . import skeleton
 from . import programs
 from . import maps
 
-__all__ = ['Bootstrap']
+__all__ = ['Bootstrap', 'LoadReport']
 
 try:
     from .syscall import syscall_name, syscall_num
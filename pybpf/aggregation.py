@@ -0,0 +1,107 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+"""
+
+import ctypes as ct
+from typing import Any, Dict, NamedTuple, Optional
+
+from pybpf.maps import PerCpuHash
+
+class Aggregate(ct.Structure):
+    """
+    struct pybpf_aggregate from pybpf.bpf.h
+    """
+    _fields_ = [
+            ('count', ct.c_uint64),
+            ('sum', ct.c_uint64),
+            ('min', ct.c_uint64),
+            ('max', ct.c_uint64),
+            ('last', ct.c_uint64),
+            ('last_ns', ct.c_uint64),
+            ]
+
+class AggregateValue(NamedTuple):
+    """
+    The aggregate of the values recorded for one key, over all cpus.
+    """
+    count: int
+    sum: int
+    min: int
+    max: int
+    last: int
+
+    @property
+    def mean(self) -> float:
+        return self.sum / self.count if self.count else 0.0
+
+def merge_aggregates(per_cpu) -> Optional[AggregateValue]:
+    """
+    Merge the per-cpu aggregates @per_cpu of one key, skipping cpus that did not
+    record a value. Returns None if no cpu did.
+    """
+    recorded = [agg for agg in per_cpu if agg.count]
+    if not recorded:
+        return None
+    latest = max(recorded, key=lambda agg: agg.last_ns)
+    return AggregateValue(
+            count=sum(agg.count for agg in recorded),
+            sum=sum(agg.sum for agg in recorded),
+            min=min(agg.min for agg in recorded),
+            max=max(agg.max for agg in recorded),
+            last=latest.last,
+            )
+
+class Aggregation:
+    """
+    A reader for an aggregation declared with BPF_AGGREGATION() in
+    pybpf.bpf.h.
+    """
+    def __init__(self, _map: PerCpuHash):
+        if not isinstance(_map, PerCpuHash):
+            raise TypeError(f'Aggregations must be per-cpu hashes, not {_map.__class__.__name__}')
+        _map.register_value_type(Aggregate)
+        self._map = _map
+
+    def read(self, reset: bool = False) -> Dict[Any, AggregateValue]:
+        """
+        Return the aggregate of every key, merged over all cpus, reading
+        BATCH_SIZE keys per syscall. Keys are returned as plain values for
+        scalar key types. If @reset is set, every key is deleted as it is
+        read with pop_batch(), starting a new interval. As with pop_batch(),
+        few events recorded during the read are lost, but some can be: an
+        update made in place through a value looked up before its key was
+        deleted is lost with it, and more are lost on kernels without batch
+        support.
+        """
+        if reset:
+            keys, values = self._map.pop_batch()
+        else:
+            keys, values = self._map.lookup_batch()
+        aggregates = {}
+        for key, per_cpu in zip(keys, values):
+            merged = merge_aggregates(per_cpu)
+            if merged is not None:
+                aggregates[key] = merged
+        return aggregates
+
+    def reset(self) -> Dict[Any, AggregateValue]:
+        """
+        Start a new interval, returning the aggregates of the one just ended.
+        """
+        return self.read(reset=True)
@@ -21,20 +21,81 @@
 """
 
 import os
+import json
+import time
+import glob
 import inspect
+import hashlib
 import subprocess
 import logging
 import datetime as dt
 from dataclasses import dataclass
-from typing import Optional, List, Tuple
-
-from pybpf.skeleton import generate_skeleton
+from concurrent.futures import ThreadPoolExecutor
+from typing import Optional, List, Tuple, Dict, Any
+
+from pybpf.skeleton import generate_skeleton, skeleton_path
+from pybpf.timing import LoadReport, record_span
+from pybpf.cache import BuildCache, source_deps, include_dirs, tool_version, hash_file, copy_atomic, tmp_suffix
+from pybpf import skeleton as skeleton_module, btf as btf_module
+from pybpf.vmlinux import prune_vmlinux, build_pch
 from pybpf.utils import kversion, which, assert_exists, drop_privileges, strip_full_extension, arch, module_path
 
 logger = logging.getLogger(__name__)
 
 TEMPLATES_DIR = module_path('templates')
 
+def compile_key(bpf_src: str, clang: str, llvm_strip: str, clang_args: List[str]) -> str:
+    """
+    Hash everything that determines the BPF object compiled from @bpf_src:
+    the source and its transitive includes (vmlinux.h and pybpf.bpf.h
+    among them), the compiler flags, the clang and llvm-strip versions and
+    the target architecture.
+    """
+    h = hashlib.sha256()
+    for name, path in source_deps(bpf_src, include_dirs(clang_args)):
+        h.update(name.encode() + b'\0')
+        if path is not None:
+            hash_file(path, h)
+    return BuildCache.key(h.digest(), ' '.join(clang_args).encode(), arch().encode(),
+            tool_version(clang), tool_version(llvm_strip))
+
+def skeleton_key(bpf_obj_path: str, embed: Optional[str] = None) -> str:
+    """
+    Hash everything that determines the skeleton generated for @bpf_obj_path:
+    the object itself, its path, which is baked into the skeleton, how it is
+    embedded, and the skeleton generator, including the BTF type generator.
+    """
+    h = hashlib.sha256()
+    hash_file(bpf_obj_path, h)
+    for module in (skeleton_module, btf_module):
+        hash_file(module.__file__, h)
+    return BuildCache.key(h.digest(), os.path.abspath(bpf_obj_path).encode(), (embed or '').encode())
+
+def open_cache() -> Optional[BuildCache]:
+    """
+    Open the build cache at Bootstrap.CACHE_DIR, or None if it is unusable.
+    """
+    cache = BuildCache(Bootstrap.CACHE_DIR)
+    try:
+        os.makedirs(cache.cache_dir, exist_ok=True)
+    except OSError as e:
+        logger.warning(f'Build cache disabled: {e}')
+        return None
+    return cache
+
+def bpf_clang_args() -> List[str]:
+    """
+    The clang flags every BPF object, and the vmlinux.h precompiled header, is built with.
+    """
+    return f'-g -O2 -target bpf -D__TARGET_ARCH_{arch()}'.split()
+
+def find_clang() -> List[str]:
+    try:
+        return [which('clang')]
+    except FileNotFoundError:
+        raise FileNotFoundError('clang not found on system. '
+                'Please install clang and try again.') from None
+
 def get_caller_dir():
     try:
         cf = inspect.stack()[-1]
@@ -44,13 +105,18 @@ def get_caller_dir():
 
 class Bootstrap:
     VMLINUX_BTF = '/sys/kernel/btf/vmlinux'
+    # None means pybpf.cache.default_cache_dir()
+    CACHE_DIR = None # type: Optional[str]
 
     @classmethod
     @drop_privileges
-    def bootstrap(cls, bpf_src: str, outdir: Optional[str] = None) -> Tuple[str, str]:
+    def bootstrap(cls, bpf_src: str, outdir: Optional[str] = None, report: Optional[LoadReport] = None, cache: bool = True, prune: bool = False, pch: bool = False, embed: Optional[str] = None) -> Tuple[str, str]:
         """
         Combines Bootstrap.generate_vmlinux(), Bootstrap.compile_bpf(), and Bootstrap.generate_skeleton() into one step.
         Returns the skeleton class filename and the name of the skeleton class.
+        If @report is given, each step is timed and recorded in it.
+        Unless @cache is false, the BPF object and skeleton are reused from the build cache when nothing they depend on has changed.
+        @prune and @pch are passed on to Bootstrap.generate_vmlinux(), @pch to Bootstrap.compile_bpf(), and @embed to Bootstrap.generate_skeleton().
         """
         assert os.path.isfile(bpf_src)
 
@@ -58,17 +124,88 @@ class Bootstrap:
 
         assert os.path.isdir(bpf_dir)
 
-        vmlinux = cls.generate_vmlinux(bpf_dir)
-        obj = cls.compile_bpf(bpf_src, outdir=outdir)
-        skel_file, skel_cls = cls.generate_skeleton(obj, outdir=outdir)
+        with record_span(report, 'generate_vmlinux', 'bootstrap'):
+            vmlinux = cls.generate_vmlinux(bpf_dir, prune=prune, pch=pch)
+        with record_span(report, 'compile_bpf', 'bootstrap'):
+            obj = cls.compile_bpf(bpf_src, outdir=outdir, report=report, cache=cache, pch=pch)
+        with record_span(report, 'generate_skeleton', 'bootstrap'):
+            skel_file, skel_cls = cls.generate_skeleton(obj, outdir=outdir, cache=cache, embed=embed)
 
         return skel_file, skel_cls
 
+    @classmethod
+    @drop_privileges
+    def build_all(cls, bpf_srcs: List[str], outdir: Optional[str] = None, jobs: Optional[int] = None, cache: bool = True, manifest: Optional[str] = None, prune: bool = False, pch: bool = False, embed: Optional[str] = None) -> Dict[str, Any]:
+        """
+        Build the BPF objects and skeletons for every source in @bpf_srcs, running up to @jobs builds at once (by default, one per CPU). vmlinux.h is generated once and shared by every source directory. Skeletons are placed in @outdir, or the caller's directory if not specified.
+
+        Returns a build manifest with the outputs and per-step timings of each object, which is also written to @manifest as JSON if given. A failed object is recorded in the manifest under "error" and does not stop the others.
+        @prune, @pch and @embed are as for Bootstrap.bootstrap(). A pruned vmlinux.h covers every source in its directory.
+        """
+        if not outdir:
+            outdir = get_caller_dir()
+        outdir = os.path.abspath(outdir)
+        bpf_srcs = list(dict.fromkeys(os.path.abspath(src) for src in bpf_srcs))
+        start = time.perf_counter()
+
+        # Generate vmlinux.h once, then link it into every other source directory
+        bpf_dirs = list(dict.fromkeys(os.path.dirname(src) for src in bpf_srcs))
+        vmlinux_start = time.perf_counter()
+        if prune:
+            # Pruned headers depend on the sources, so each directory gets its own
+            for bpf_dir in bpf_dirs:
+                cls.generate_vmlinux(bpf_dir, prune=True, pch=pch)
+        elif bpf_dirs:
+            vmlinux = os.path.realpath(cls.generate_vmlinux(bpf_dirs[0], pch=pch))
+            for bpf_dir in bpf_dirs[1:]:
+                vmlinux_h = os.path.join(bpf_dir, 'vmlinux.h')
+                if os.path.realpath(vmlinux_h) != vmlinux:
+                    if os.path.lexists(vmlinux_h):
+                        os.unlink(vmlinux_h)
+                    os.symlink(vmlinux, vmlinux_h)
+        vmlinux_time = time.perf_counter() - vmlinux_start
+
+        def build_one(bpf_src: str) -> Dict[str, Any]:
+            report = LoadReport()
+            entry = {'source': bpf_src} # type: Dict[str, Any]
+            obj_start = time.perf_counter()
+            try:
+                with record_span(report, 'compile_bpf', 'bootstrap'):
+                    obj = cls.compile_bpf(bpf_src, outdir=outdir, report=report, cache=cache, pch=pch)
+                with record_span(report, 'generate_skeleton', 'bootstrap'):
+                    skel_file, skel_cls = cls.generate_skeleton(obj, outdir=outdir, cache=cache, embed=embed)
+                entry.update(object=obj, skeleton=skel_file, skeleton_class=skel_cls)
+            except Exception as e:
+                entry['error'] = str(e)
+            entry['seconds'] = time.perf_counter() - obj_start
+            entry['steps'] = report.durations('bootstrap')
+            entry['cached'] = 'cached_object' in entry['steps']
+            return entry
+
+        with ThreadPoolExecutor(max_workers=jobs or os.cpu_count()) as pool:
+            objects = list(pool.map(build_one, bpf_srcs))
+
+        result = {
+            'jobs': jobs or os.cpu_count(),
+            'vmlinux_seconds': vmlinux_time,
+            'total_seconds': time.perf_counter() - start,
+            'objects': objects,
+        }
+        if manifest:
+            with open(manifest, 'w') as f:
+                json.dump(result, f, indent=4)
+        failed = [o['source'] for o in objects if 'error' in o]
+        if failed:
+            logger.error(f'Failed to build {len(failed)} of {len(objects)} BPF objects: {failed}')
+        return result
+
     @staticmethod
     @drop_privileges
-    def generate_vmlinux(bpfdir: Optional[str] = None, overwrite: bool = False) -> str:
+    def generate_vmlinux(bpfdir: Optional[str] = None, overwrite: bool = False, prune: bool = False, bpf_srcs: Optional[List[str]] = None, pch: bool = False) -> str:
         """
         Use bpftool to generate the @bpfdir/vmlinux.h header file symlink for that corresponds with the BTF info for the current kernel. Unless @overwrite is true, existing vmlinux files will not be updated. Only the symbolic link will be updated.
+        If @prune is true, vmlinux.h instead links to a copy containing only the types used by @bpf_srcs (by default, every *.bpf.c file in @bpfdir), which is much faster for clang to parse. The pruned copy is regenerated whenever the sources change.
+        If @pch is true, vmlinux.h is also precompiled, for use with Bootstrap.compile_bpf(pch=True).
         """
         if not bpfdir:
             bpfdir = os.path.join(get_caller_dir(), 'bpf')
@@ -104,21 +241,40 @@ class Bootstrap:
             with open(vmlinux_kversion_h, 'w+') as f:
                 subprocess.check_call(bpftool + bpftool_args, stdout=f)
 
-        try:
-            os.unlink(vmlinux_h)
-        except FileNotFoundError:
-            pass
-        os.symlink(vmlinux_kversion_h, vmlinux_h)
+        target_h = vmlinux_kversion_h
+        if prune:
+            if bpf_srcs is None:
+                bpf_srcs = sorted(glob.glob(os.path.join(bpfdir, '*.bpf.c')))
+            bpf_srcs = [os.path.abspath(src) for src in bpf_srcs]
+            target_h = os.path.join(bpfdir, f'vmlinux_{kversion()}.min.h')
+            # The sources include vmlinux.h, so it has to exist while pruning
+            if not os.path.exists(vmlinux_h):
+                os.symlink(vmlinux_kversion_h, vmlinux_h)
+            prune_vmlinux(vmlinux_kversion_h, target_h, bpf_srcs, find_clang(), bpf_clang_args())
+
+        if os.path.realpath(vmlinux_h) != target_h:
+            try:
+                os.unlink(vmlinux_h)
+            except FileNotFoundError:
+                pass
+            os.symlink(target_h, vmlinux_h)
 
         logger.info(f'Generated {vmlinux_h}')
 
+        if pch:
+            pch_file = build_pch(vmlinux_h, find_clang(), bpf_clang_args())
+            logger.info(f'Precompiled {vmlinux_h} -> {pch_file}')
+
         return vmlinux_h
 
     @staticmethod
     @drop_privileges
-    def compile_bpf(bpf_src: str, outdir: Optional[str] = None, cflags: List[str] = []) -> str:
+    def compile_bpf(bpf_src: str, outdir: Optional[str] = None, cflags: List[str] = [], report: Optional[LoadReport] = None, cache: bool = False, pch: bool = False) -> str:
         """
         Generate the BPF object file for @bpf_src and place it in @outdir.
+        If @pch is true, vmlinux.h is taken from the precompiled header made by Bootstrap.generate_vmlinux(pch=True) instead of being parsed again.
+        If @report is given, clang and llvm-strip are timed and recorded in it.
+        If @cache is true, a previously built object is reused when the source, its includes, @cflags and the toolchain are all unchanged.
         """
         if not outdir:
             outdir = get_caller_dir()
@@ -143,46 +299,94 @@ class Bootstrap:
         obj_file = os.path.join(bpf_dir, strip_full_extension(os.path.basename(bpf_src)) + '.bpf.o')
 
         # Check for clang
-        try:
-            clang = [which('clang')]
-        except FileNotFoundError:
-            raise FileNotFoundError('clang not found on system. '
-                    'Please install clang and try again.') from None
+        clang = find_clang()
 
-        clang_args = cflags + f'-g -O2 -target bpf -D__TARGET_ARCH_{arch()}'.split() + f'-c {bpf_src} -o {obj_file}'.split()
+        clang_args = cflags + bpf_clang_args()
+
+        # Check for the precompiled vmlinux.h
+        if pch:
+            pch_file = os.path.realpath(os.path.join(bpf_dir, 'vmlinux.h')) + '.pch'
+            try:
+                assert_exists(pch_file)
+            except FileNotFoundError:
+                raise FileNotFoundError('Please precompile vmlinux.h first with generate_vmlinux(pch=True).') from None
+            clang_args += ['-include-pch', pch_file]
 
         # Check for llvm-strip
         try:
-            llvm_strip = [which('llvm-strip'), '-g', obj_file]
+            llvm_strip = [which('llvm-strip')]
         except FileNotFoundError:
             raise FileNotFoundError('llvm-strip not found on system. '
                     'Please install llvm-strip and try again.') from None
 
-        # Compile BPF program
-        logger.info(f'Compiling BPF program {bpf_src} -> {obj_file}')
-        try:
-            subprocess.check_call(clang + clang_args, stdout=subprocess.DEVNULL)
-        except subprocess.CalledProcessError:
-            raise Exception("Failed to compile BPF program") from None
+        build_cache = open_cache() if cache else None
+        if build_cache is None:
+            Bootstrap._compile_bpf(bpf_src, obj_file, clang + clang_args, llvm_strip, report)
+            return obj_file
+
+        key = compile_key(bpf_src, clang[0], llvm_strip[0], clang_args)
+        with build_cache.lock(key):
+            cached = build_cache.get(key, 'object.bpf.o')
+            if cached:
+                logger.info(f'Using cached BPF object for {bpf_src} -> {obj_file}')
+                with record_span(report, 'cached_object', 'bootstrap'):
+                    copy_atomic(cached, obj_file)
+                return obj_file
+            Bootstrap._compile_bpf(bpf_src, obj_file, clang + clang_args, llvm_strip, report)
+            build_cache.put(key, 'object.bpf.o', obj_file)
+        return obj_file
+
+    @staticmethod
+    def _compile_bpf(bpf_src: str, obj_file: str, clang: List[str], llvm_strip: List[str], report: Optional[LoadReport]):
+        # Build into a temporary file, so that concurrent builds never expose a partial object
+        tmp_file = f'{obj_file}.{tmp_suffix()}'
 
-        # Strip symbols from BPF program
-        logger.info(f'Stripping symbols from BPF program {obj_file}')
         try:
-            subprocess.check_call(llvm_strip, stdout=subprocess.DEVNULL)
-        except subprocess.CalledProcessError:
-            raise Exception("Failed to strip symbols from BPF program") from None
+            # Compile BPF program
+            logger.info(f'Compiling BPF program {bpf_src} -> {obj_file}')
+            try:
+                with record_span(report, 'clang', 'bootstrap'):
+                    subprocess.check_call(clang + ['-c', bpf_src, '-o', tmp_file], stdout=subprocess.DEVNULL)
+            except subprocess.CalledProcessError:
+                raise Exception("Failed to compile BPF program") from None
 
-        return obj_file
+            # Strip symbols from BPF program
+            logger.info(f'Stripping symbols from BPF program {obj_file}')
+            try:
+                with record_span(report, 'llvm-strip', 'bootstrap'):
+                    subprocess.check_call(llvm_strip + ['-g', tmp_file], stdout=subprocess.DEVNULL)
+            except subprocess.CalledProcessError:
+                raise Exception("Failed to strip symbols from BPF program") from None
+
+            os.replace(tmp_file, obj_file)
+        finally:
+            if os.path.exists(tmp_file):
+                os.unlink(tmp_file)
 
     @staticmethod
     @drop_privileges
-    def generate_skeleton(bpf_obj_path: str, outdir: Optional[str] = None) -> Tuple[str, str]:
+    def generate_skeleton(bpf_obj_path: str, outdir: Optional[str] = None, cache: bool = False, embed: Optional[str] = None) -> Tuple[str, str]:
         """
         Regenerate the python skeleton file for the @bpf_obj_path.  The file will be generated in the same directory as the caller or @outdir if specified. Returns the skeleton class filename and the name of the skeleton class.
+        If @cache is true, a previously generated skeleton for the same object is reused.
+        If @embed is 'raw' or 'zlib', the object is embedded in the skeleton, compressed with zlib for the latter, and opened from memory, so the skeleton no longer needs the object file at runtime.
         """
         if not outdir:
             outdir = get_caller_dir()
-        return generate_skeleton(bpf_obj_path, outdir)
+        build_cache = open_cache() if cache else None
+        if build_cache is None:
+            return generate_skeleton(bpf_obj_path, outdir, embed)
+
+        key = skeleton_key(bpf_obj_path, embed)
+        skel_file, skel_cls = skeleton_path(bpf_obj_path, outdir)
+        with build_cache.lock(key):
+            cached = build_cache.get(key, 'skeleton.py')
+            if cached:
+                copy_atomic(cached, skel_file)
+                return skel_file, skel_cls
+            skel_file, skel_cls = generate_skeleton(bpf_obj_path, outdir, embed)
+            build_cache.put(key, 'skeleton.py', skel_file)
+        return skel_file, skel_cls
 
     @dataclass
     class ProjectBuilder:
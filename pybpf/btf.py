@@ -0,0 +1,473 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+"""
+
+import ctypes as ct
+from enum import IntEnum
+from struct import unpack_from
+from typing import Dict, List, NamedTuple, Optional, Tuple
+
+class BTFKind(IntEnum):
+    """
+    Integer enum representing BTF type kinds.
+    """
+    UNKN       = 0
+    INT        = 1
+    PTR        = 2
+    ARRAY      = 3
+    STRUCT     = 4
+    UNION      = 5
+    ENUM       = 6
+    FWD        = 7
+    TYPEDEF    = 8
+    VOLATILE   = 9
+    CONST      = 10
+    RESTRICT   = 11
+    FUNC       = 12
+    FUNC_PROTO = 13
+    VAR        = 14
+    DATASEC    = 15
+    FLOAT      = 16
+    DECL_TAG   = 17
+    TYPE_TAG   = 18
+    ENUM64     = 19
+
+BTF_MAGIC = 0xeb9f
+BTF_INT_SIGNED = 1 << 0
+BTF_INT_BOOL = 1 << 2
+
+# Kinds that only qualify or rename another type
+_MODIFIERS = (BTFKind.TYPEDEF, BTFKind.VOLATILE, BTFKind.CONST, BTFKind.RESTRICT, BTFKind.TYPE_TAG)
+
+class BTFMember(NamedTuple):
+    name: str
+    type_id: int
+    # In bits, for struct and union members and enum values; in bytes for datasec variables
+    offset: int
+    bitfield_size: int = 0
+
+class BTFType(NamedTuple):
+    kind: BTFKind
+    name: str
+    # Size in bytes for sized kinds, otherwise the referenced type
+    size: int
+    type_id: int
+    members: List[BTFMember]
+    # Extra data: (encoding, bit offset, bits) for INT, (elem type, nelems) for ARRAY
+    extra: Tuple[int, ...] = ()
+
+class BTF:
+    """
+    A minimal parser for raw BTF data, such as the .BTF section of a BPF object.
+    """
+    def __init__(self, data: bytes):
+        magic, _version, _flags, hdr_len, type_off, type_len, str_off, str_len = unpack_from('<HBBIIIII', data, 0)
+        if magic != BTF_MAGIC:
+            raise ValueError('Not little endian BTF data')
+        types = data[hdr_len + type_off:hdr_len + type_off + type_len]
+        self._strings = data[hdr_len + str_off:hdr_len + str_off + str_len]
+        # Type ID 0 is void
+        self.types = [BTFType(BTFKind.UNKN, 'void', 0, 0, [])] # type: List[BTFType]
+        off = 0
+        while off < len(types):
+            name_off, info, size_or_type = unpack_from('<III', types, off)
+            off += 12
+            kind = BTFKind((info >> 24) & 0x1f)
+            vlen = info & 0xffff
+            kind_flag = info >> 31
+            name = self._str(name_off)
+            members = [] # type: List[BTFMember]
+            extra = () # type: Tuple[int, ...]
+            if kind == BTFKind.INT:
+                (enc,) = unpack_from('<I', types, off)
+                extra = ((enc >> 24) & 0xf, (enc >> 16) & 0xff, enc & 0xff)
+                off += 4
+            elif kind == BTFKind.ARRAY:
+                elem, _index, nelems = unpack_from('<III', types, off)
+                extra = (elem, nelems)
+                off += 12
+            elif kind in (BTFKind.STRUCT, BTFKind.UNION):
+                for _ in range(vlen):
+                    m_name, m_type, m_off = unpack_from('<III', types, off)
+                    if kind_flag:
+                        members.append(BTFMember(self._str(m_name), m_type, m_off & 0xffffff, m_off >> 24))
+                    else:
+                        members.append(BTFMember(self._str(m_name), m_type, m_off))
+                    off += 12
+            elif kind == BTFKind.ENUM:
+                for _ in range(vlen):
+                    m_name, val = unpack_from('<Ii', types, off)
+                    members.append(BTFMember(self._str(m_name), 0, val))
+                    off += 8
+                extra = (kind_flag,)
+            elif kind == BTFKind.ENUM64:
+                for _ in range(vlen):
+                    m_name, lo, hi = unpack_from('<III', types, off)
+                    members.append(BTFMember(self._str(m_name), 0, lo | (hi << 32)))
+                    off += 12
+                extra = (kind_flag,)
+            elif kind == BTFKind.FUNC_PROTO:
+                for _ in range(vlen):
+                    m_name, m_type = unpack_from('<II', types, off)
+                    members.append(BTFMember(self._str(m_name), m_type, 0))
+                    off += 8
+            elif kind == BTFKind.VAR:
+                off += 4
+            elif kind == BTFKind.DATASEC:
+                for _ in range(vlen):
+                    v_type, v_off, v_size = unpack_from('<III', types, off)
+                    members.append(BTFMember('', v_type, v_off, v_size))
+                    off += 12
+            elif kind == BTFKind.DECL_TAG:
+                off += 4
+            sized = kind in (BTFKind.INT, BTFKind.STRUCT, BTFKind.UNION, BTFKind.ENUM, BTFKind.ENUM64, BTFKind.DATASEC, BTFKind.FLOAT)
+            self.types.append(BTFType(kind, name, size_or_type if sized else 0, 0 if sized else size_or_type, members, extra))
+
+    def _str(self, off: int) -> str:
+        end = self._strings.index(b'\0', off)
+        return self._strings[off:end].decode('utf-8', 'replace')
+
+    def resolve(self, type_id: int) -> int:
+        """
+        Skip typedefs and qualifiers starting from @type_id.
+        """
+        while self.types[type_id].kind in _MODIFIERS:
+            type_id = self.types[type_id].type_id
+        return type_id
+
+    def size(self, type_id: int) -> Optional[int]:
+        """
+        Get the size in bytes of @type_id, or None if it has no size.
+        """
+        t = self.types[self.resolve(type_id)]
+        if t.kind == BTFKind.PTR:
+            return 8
+        if t.kind == BTFKind.ARRAY:
+            elem_size = self.size(t.extra[0])
+            return None if elem_size is None else elem_size * t.extra[1]
+        if t.kind in (BTFKind.INT, BTFKind.STRUCT, BTFKind.UNION, BTFKind.ENUM, BTFKind.ENUM64, BTFKind.FLOAT):
+            return t.size
+        return None
+
+    def find(self, kind: BTFKind, name: str) -> Optional[int]:
+        for type_id, t in enumerate(self.types):
+            if t.kind == kind and t.name == name:
+                return type_id
+        return None
+
+class ElfSection(NamedTuple):
+    name: str
+    index: int
+    type: int
+    offset: int
+    size: int
+    link: int
+
+def elf_sections(data: bytes) -> Dict[str, ElfSection]:
+    """
+    Get the sections of the little endian ELF64 file @data by name.
+    """
+    if data[:4] != b'\x7fELF' or data[4] != 2 or data[5] != 1:
+        raise ValueError('Not a little endian ELF64 file')
+    shoff, = unpack_from('<Q', data, 0x28)
+    shentsize, shnum, shstrndx = unpack_from('<HHH', data, 0x3a)
+    headers = [unpack_from('<IIQQQQIIQQ', data, shoff + i * shentsize) for i in range(shnum)]
+    strtab_off, strtab_size = headers[shstrndx][4], headers[shstrndx][5]
+    strtab = data[strtab_off:strtab_off + strtab_size]
+    sections = {}
+    for i, (name, sh_type, _flags, _addr, offset, size, link, _info, _align, _entsize) in enumerate(headers):
+        name = strtab[name:strtab.index(b'\0', name)].decode('utf-8', 'replace')
+        sections[name] = ElfSection(name, i, sh_type, offset, size, link)
+    return sections
+
+SHT_SYMTAB = 2
+
+def elf_symbols(data: bytes, sections: Dict[str, ElfSection]) -> Dict[Tuple[int, str], int]:
+    """
+    Map (section index, symbol name) to symbol value for every symbol in @data.
+    """
+    symbols = {}
+    by_index = {s.index: s for s in sections.values()}
+    for symtab in sections.values():
+        if symtab.type != SHT_SYMTAB:
+            continue
+        strtab = by_index[symtab.link]
+        strings = data[strtab.offset:strtab.offset + strtab.size]
+        for off in range(symtab.offset, symtab.offset + symtab.size, 24):
+            st_name, _info, _other, st_shndx, st_value, _size = unpack_from('<IBBHQQ', data, off)
+            name = strings[st_name:strings.index(b'\0', st_name)].decode('utf-8', 'replace')
+            symbols[(st_shndx, name)] = st_value
+    return symbols
+
+def bitfield(storage: str, bit_offset: int, bits: int, signed: bool = False) -> property:
+    """
+    A property for a bitfield of @bits bits, @bit_offset bits into the
+    ct.c_uint8 array field @storage of a little endian ctypes structure.
+    """
+    mask = (1 << bits) - 1
+    def fget(self):
+        value = (int.from_bytes(bytes(getattr(self, storage)), 'little') >> bit_offset) & mask
+        if signed and value >> (bits - 1):
+            value -= 1 << bits
+        return value
+    def fset(self, value):
+        buf = getattr(self, storage)
+        raw = int.from_bytes(bytes(buf), 'little') & ~(mask << bit_offset)
+        raw |= (int(value) & mask) << bit_offset
+        ct.memmove(buf, raw.to_bytes(len(buf), 'little'), len(buf))
+    return property(fget, fset)
+
+_INT_TYPES = {
+        (1, False): 'ct.c_uint8',
+        (1, True): 'ct.c_int8',
+        (2, False): 'ct.c_uint16',
+        (2, True): 'ct.c_int16',
+        (4, False): 'ct.c_uint32',
+        (4, True): 'ct.c_int32',
+        (8, False): 'ct.c_uint64',
+        (8, True): 'ct.c_int64',
+        }
+
+_FLOAT_TYPES = {4: 'ct.c_float', 8: 'ct.c_double', 16: 'ct.c_longdouble'}
+
+class _Field(NamedTuple):
+    name: str
+    offset: int
+    size: int
+    ctype: Optional[str]
+
+class _Bitfield(NamedTuple):
+    name: str
+    # In bits
+    offset: int
+    bits: int
+    signed: bool
+
+class CtypesGenerator:
+    """
+    Generate Python source for ctypes types equivalent to BTF types. Structs,
+    unions and data sections become ct.Structure and ct.Union classes whose
+    members sit at exactly the offsets BTF gives, with explicit padding,
+    since BPF objects are always laid out for the BPF target.
+    """
+    def __init__(self, btf: BTF, indent: str = ''):
+        self.btf = btf
+        self.indent = indent
+        self.lines = [] # type: List[str]
+        # Maps BTF type IDs and datasec names to generated class names
+        self.classes = {} # type: Dict[object, str]
+        self._exprs = {} # type: Dict[int, Optional[str]]
+
+    def _emit(self, line: str = ''):
+        self.lines.append(self.indent + line if line else '')
+
+    def _class_name(self, prefix: str, name: str, type_id: int) -> str:
+        name = ''.join(c if c.isalnum() else '_' for c in name)
+        class_name = f'{prefix}_{name}' if name else f'{prefix}_anon_{type_id}'
+        if class_name in self.classes.values():
+            class_name = f'{class_name}_{type_id}'
+        return class_name
+
+    def ctype(self, type_id: int) -> Optional[str]:
+        """
+        Get a Python expression for the ctypes equivalent of @type_id,
+        generating classes it depends on first. Returns None for types with no
+        ctypes equivalent, such as forward declarations.
+        """
+        type_id = self.btf.resolve(type_id)
+        if type_id in self._exprs:
+            return self._exprs[type_id]
+        # Structs cannot contain themselves, so this only guards against malformed BTF
+        self._exprs[type_id] = None
+        t = self.btf.types[type_id]
+        expr = None
+        if t.kind == BTFKind.INT:
+            encoding, _bit_offset, _bits = t.extra
+            if encoding & BTF_INT_BOOL:
+                expr = 'ct.c_bool'
+            elif t.name == 'char':
+                # Arrays of char become bytes
+                expr = 'ct.c_char'
+            elif t.size in (1, 2, 4, 8):
+                expr = _INT_TYPES[(t.size, bool(encoding & BTF_INT_SIGNED))]
+            else:
+                expr = f'ct.c_uint8 * {t.size}'
+        elif t.kind in (BTFKind.ENUM, BTFKind.ENUM64):
+            expr = _INT_TYPES.get((t.size, bool(t.extra[0])))
+        elif t.kind == BTFKind.FLOAT:
+            expr = _FLOAT_TYPES.get(t.size)
+        elif t.kind == BTFKind.PTR:
+            # Pointers are meaningless to userspace, but keep their size
+            expr = 'ct.c_uint64'
+        elif t.kind == BTFKind.ARRAY:
+            elem = self.ctype(t.extra[0])
+            if elem is not None:
+                expr = f'({elem}) * {t.extra[1]}' if ' ' in elem else f'{elem} * {t.extra[1]}'
+        elif t.kind in (BTFKind.STRUCT, BTFKind.UNION):
+            expr = self._record(type_id, t)
+        self._exprs[type_id] = expr
+        return expr
+
+    def _record(self, type_id: int, t: BTFType) -> Optional[str]:
+        members = [] # type: List[object]
+        anonymous = []
+        for i, member in enumerate(t.members):
+            name = member.name or f'_anon{i}'
+            resolved = self.btf.types[self.btf.resolve(member.type_id)]
+            bits = member.bitfield_size
+            if not bits and resolved.kind == BTFKind.INT and (resolved.extra[2] != resolved.size * 8 or resolved.extra[1]):
+                # Bitfields in BTF without kind_flag are encoded in the int type
+                bits = resolved.extra[2]
+            if bits or member.offset % 8:
+                if resolved.kind == BTFKind.INT:
+                    signed = bool(resolved.extra[0] & BTF_INT_SIGNED)
+                elif resolved.kind in (BTFKind.ENUM, BTFKind.ENUM64):
+                    signed = bool(resolved.extra[0])
+                else:
+                    return None
+                members.append(_Bitfield(name, member.offset, bits or resolved.size * 8, signed))
+                continue
+            member_type = self.ctype(member.type_id)
+            member_size = self.btf.size(member.type_id)
+            if member_type is None or member_size is None:
+                return None
+            if not member.name:
+                if resolved.kind not in (BTFKind.STRUCT, BTFKind.UNION):
+                    continue
+                anonymous.append(name)
+            members.append(_Field(name, member.offset // 8, member_size, member_type))
+        prefix = 'struct' if t.kind == BTFKind.STRUCT else 'union'
+        return self._emit_record(self._class_name(prefix, t.name, type_id), type_id, t.size, members, t.kind == BTFKind.UNION, anonymous)
+
+    def datasec(self, type_id: int, section_size: int, offsets: Dict[str, int]) -> Optional[str]:
+        """
+        Generate a ct.Structure class for the data section @type_id, with each
+        variable at the offset given for it in @offsets.
+        """
+        t = self.btf.types[type_id]
+        members = []
+        for var in t.members:
+            v = self.btf.types[var.type_id]
+            if v.kind != BTFKind.VAR or v.name not in offsets:
+                continue
+            var_type = self.ctype(v.type_id)
+            var_size = self.btf.size(v.type_id)
+            if var_type is None or var_size is None:
+                continue
+            members.append(_Field(v.name, offsets[v.name], var_size, var_type))
+        members.sort(key=lambda m: m.offset)
+        return self._emit_record(self._class_name('datasec', t.name.strip('.'), type_id), t.name, section_size, members, False, [])
+
+    def _emit_record(self, class_name: str, key: object, size: int, members, union: bool, anonymous: List[str]) -> str:
+        self.classes[key] = class_name
+        slots = [] # type: List[_Field]
+        storages = set()
+        props = []
+        for m in members:
+            if isinstance(m, _Field):
+                slots.append(m)
+                continue
+            # Runs of bitfields share a byte array and are accessed through properties
+            start, end = m.offset // 8, (m.offset + m.bits + 7) // 8
+            last = slots[-1] if slots else None
+            if last is not None and last.name in storages and start < last.offset + last.size:
+                last = slots[-1] = last._replace(size=max(last.size, end - last.offset), ctype=None)
+            else:
+                last = _Field(f'_bitfield{len(slots)}', start, end - start, None)
+                storages.add(last.name)
+                slots.append(last)
+            props.append((m.name, last.name, m.offset - last.offset * 8, m.bits, m.signed))
+
+        self._emit(f'class {class_name}(ct.{"Union" if union else "Structure"}):')
+        self._emit('    _pack_ = 1')
+        if anonymous:
+            self._emit(f'    _anonymous_ = {tuple(anonymous)!r}')
+        self._emit('    _fields_ = [')
+        pos = 0
+        for slot in slots:
+            if not union and slot.offset > pos:
+                self._emit(f"        ('_pad{pos}', ct.c_uint8 * {slot.offset - pos}),")
+            self._emit(f"        ({slot.name!r}, {slot.ctype or f'ct.c_uint8 * {slot.size}'}),")
+            pos = max(pos, slot.offset + slot.size)
+        # A union only grows to its full size with a member that spans it
+        if union and size > pos:
+            self._emit(f"        ('_pad', ct.c_uint8 * {size}),")
+        elif size > pos:
+            self._emit(f"        ('_pad{pos}', ct.c_uint8 * {size - pos}),")
+        self._emit('        ]')
+        for name, storage, bit_offset, bits, signed in props:
+            self._emit(f'{class_name}.{name} = bitfield({storage!r}, {bit_offset}, {bits}, {signed})')
+        self._emit()
+        return class_name
+
+    def source(self) -> str:
+        return '\n'.join(self.lines)
+
+class SkeletonTypes(NamedTuple):
+    # Python source defining the generated classes
+    source: str
+    # Maps map names to key and value type expressions, either of which may be None
+    map_types: Dict[str, Tuple[Optional[str], Optional[str]]]
+    # Maps data section names, such as .bss, to their value type classes
+    datasec_types: Dict[str, str]
+    # Every generated class
+    classes: List[str]
+
+def skeleton_types(bpf_obj_path: str, indent: str = '') -> SkeletonTypes:
+    """
+    Generate ctypes types for the keys and values of every map defined in the
+    .maps section of the BPF object at @bpf_obj_path, and for its global data
+    sections, from the object's BTF.
+    """
+    with open(bpf_obj_path, 'rb') as f:
+        data = f.read()
+    sections = elf_sections(data)
+    if '.BTF' not in sections:
+        return SkeletonTypes('', {}, {}, [])
+    gen = CtypesGenerator(BTF(data[sections['.BTF'].offset:sections['.BTF'].offset + sections['.BTF'].size]), indent)
+    btf = gen.btf
+
+    map_types = {}
+    maps_sec = btf.find(BTFKind.DATASEC, '.maps')
+    for var in btf.types[maps_sec].members if maps_sec is not None else []:
+        v = btf.types[var.type_id]
+        definition = btf.types[btf.resolve(v.type_id)]
+        if v.kind != BTFKind.VAR or definition.kind != BTFKind.STRUCT:
+            continue
+        types = {'key': None, 'value': None} # type: Dict[str, Optional[str]]
+        for member in definition.members:
+            ptr = btf.types[btf.resolve(member.type_id)]
+            if member.name in types and ptr.kind == BTFKind.PTR:
+                types[member.name] = gen.ctype(ptr.type_id)
+        map_types[v.name] = (types['key'], types['value'])
+
+    # Clang leaves data section sizes and variable offsets for libbpf to fill
+    # in from the ELF section headers and symbols, so do the same here
+    symbols = elf_symbols(data, sections)
+    datasec_types = {}
+    for type_id, t in enumerate(btf.types):
+        if t.kind != BTFKind.DATASEC or t.name not in sections or t.name == '.maps':
+            continue
+        if not (t.name.startswith('.data') or t.name.startswith('.rodata') or t.name.startswith('.bss')):
+            continue
+        sec = sections[t.name]
+        offsets = {name: value for (shndx, name), value in symbols.items() if shndx == sec.index}
+        datasec_types[t.name] = gen.datasec(type_id, sec.size, offsets)
+
+    return SkeletonTypes(gen.source(), map_types, datasec_types, list(gen.classes.values()))
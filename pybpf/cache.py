@@ -0,0 +1,190 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+"""
+
+import os
+import re
+import pwd
+import fcntl
+import shutil
+import hashlib
+import logging
+import threading
+import subprocess
+from contextlib import contextmanager
+from typing import Dict, Iterable, List, Optional, Tuple
+
+logger = logging.getLogger(__name__)
+
+_include_re = re.compile(rb'^[ \t]*#[ \t]*include[ \t]*([<"])([^>"]+)[>"]', re.MULTILINE)
+
+# Searched for <...> includes after any -I directories
+SYSTEM_INCLUDE_DIRS = ['/usr/local/include', '/usr/include']
+
+def include_dirs(cflags: Iterable[str]) -> List[str]:
+    """
+    Extract the -I include directories from @cflags.
+    """
+    dirs = []
+    cflags = list(cflags)
+    for i, flag in enumerate(cflags):
+        if flag == '-I' and i + 1 < len(cflags):
+            dirs.append(cflags[i + 1])
+        elif flag.startswith('-I'):
+            dirs.append(flag[2:])
+    return dirs
+
+def source_deps(src: str, inc_dirs: List[str]) -> List[Tuple[str, Optional[str]]]:
+    """
+    Find @src and every header it includes, transitively, resolving quoted
+    includes relative to the including file first and all includes against
+    @inc_dirs and the system include directories. Returns (name, path) pairs,
+    where path is None for includes that could not be found, in a stable
+    order. This is a textual scan and deliberately errs on the side of
+    including too much, for instance headers behind a false #if.
+    """
+    deps = [] # type: List[Tuple[str, Optional[str]]]
+    seen = set()
+    stack = [(src, os.path.realpath(src))]
+    while stack:
+        name, path = stack.pop()
+        if path in seen:
+            continue
+        seen.add(path)
+        deps.append((name, path))
+        with open(path, 'rb') as f:
+            text = f.read()
+        for kind, inc in _include_re.findall(text):
+            inc = inc.decode('utf-8', 'replace')
+            search = ([os.path.dirname(path)] if kind == b'"' else []) + inc_dirs + SYSTEM_INCLUDE_DIRS
+            for d in search:
+                candidate = os.path.join(d, inc)
+                if os.path.isfile(candidate):
+                    stack.append((inc, os.path.realpath(candidate)))
+                    break
+            else:
+                if (inc, None) not in deps:
+                    deps.append((inc, None))
+    return deps
+
+_tool_versions = {} # type: Dict[Tuple[str, int], bytes]
+
+def tool_version(tool: str) -> bytes:
+    """
+    Get the output of `@tool --version`, cached per binary and mtime.
+    """
+    path = os.path.realpath(tool)
+    key = (path, os.stat(path).st_mtime_ns)
+    try:
+        return _tool_versions[key]
+    except KeyError:
+        pass
+    version = subprocess.check_output([tool, '--version'], stderr=subprocess.STDOUT)
+    _tool_versions[key] = version
+    return version
+
+def hash_file(path: str, h) -> None:
+    with open(path, 'rb') as f:
+        for chunk in iter(lambda: f.read(1 << 20), b''):
+            h.update(chunk)
+
+def default_cache_dir() -> str:
+    """
+    $PYBPF_CACHE_DIR if set, otherwise pybpf/ under the XDG cache directory of
+    the effective user. The home directory is looked up by uid rather than
+    $HOME, which sudo may leave pointing at root's.
+    """
+    try:
+        return os.environ['PYBPF_CACHE_DIR']
+    except KeyError:
+        pass
+    home = pwd.getpwuid(os.geteuid()).pw_dir
+    return os.path.join(os.environ.get('XDG_CACHE_HOME', os.path.join(home, '.cache')), 'pybpf')
+
+class BuildCache:
+    """
+    A content-addressed cache of build artifacts. Each key names a directory
+    of files. Entries are published with an atomic rename and guarded by a
+    per-key file lock, so concurrent processes never see partial entries and
+    do not repeat each other's work.
+    """
+    def __init__(self, cache_dir: Optional[str] = None):
+        self.cache_dir = cache_dir or default_cache_dir()
+
+    @staticmethod
+    def key(*parts: bytes) -> str:
+        h = hashlib.sha256()
+        for part in parts:
+            h.update(len(part).to_bytes(8, 'little'))
+            h.update(part)
+        return h.hexdigest()
+
+    def _entry(self, key: str) -> str:
+        return os.path.join(self.cache_dir, key[:2], key)
+
+    @contextmanager
+    def lock(self, key: str):
+        """
+        Hold an exclusive lock on @key for the body of a with statement.
+        """
+        entry = self._entry(key)
+        os.makedirs(os.path.dirname(entry), exist_ok=True)
+        with open(entry + '.lock', 'w') as f:
+            fcntl.flock(f, fcntl.LOCK_EX)
+            try:
+                yield
+            finally:
+                fcntl.flock(f, fcntl.LOCK_UN)
+
+    def get(self, key: str, name: str) -> Optional[str]:
+        """
+        Get the path of file @name in entry @key, or None on a miss.
+        """
+        path = os.path.join(self._entry(key), name)
+        return path if os.path.exists(path) else None
+
+    def put(self, key: str, name: str, src: str):
+        """
+        Copy @src into entry @key as file @name.
+        """
+        entry = self._entry(key)
+        os.makedirs(entry, exist_ok=True)
+        tmp = os.path.join(entry, f'.{name}.{tmp_suffix()}')
+        shutil.copyfile(src, tmp)
+        os.replace(tmp, os.path.join(entry, name))
+
+    def clear(self):
+        """
+        Remove every entry from the cache.
+        """
+        shutil.rmtree(self.cache_dir, ignore_errors=True)
+
+def tmp_suffix() -> str:
+    """
+    A temporary file suffix unique to this process and thread.
+    """
+    return f'{os.getpid()}.{threading.get_ident()}.tmp'
+
+def copy_atomic(src: str, dest: str):
+    """
+    Copy @src to @dest such that readers of @dest never see a partial file.
+    """
+    tmp = f'{dest}.{tmp_suffix()}'
+    shutil.copyfile(src, tmp)
+    os.replace(tmp, dest)
@@ -30,17 +30,33 @@ from pybpf.cli.aliased_group import AliasedGroup
 
 logger = logging.getLogger(__name__)
 
-@click.command(help='Build the BPF skeleton object.')
-@click.argument('bpf_src', type=click.Path(exists=True, file_okay=True, dir_okay=False), default='./bpf/prog.bpf.c')
+@click.command(help='Build BPF objects and their skeletons.')
+@click.argument('bpf_srcs', nargs=-1, type=click.Path(exists=True, file_okay=True, dir_okay=False))
+@click.option('-j', '--jobs', type=int, default=None, help='Number of objects to build at once. Defaults to the number of CPUs.')
+@click.option('-o', '--outdir', type=click.Path(exists=True, file_okay=False, dir_okay=True), default='.', help='Output directory for skeleton files.')
+@click.option('--manifest', type=click.Path(dir_okay=False), default=None, help='Write a JSON build manifest with per-object timings to this file.')
+@click.option('--no-cache', is_flag=True, default=False, help='Always recompile, ignoring the build cache.')
+@click.option('--prune', is_flag=True, default=False, help='Compile against a vmlinux.h pruned to the types the sources use.')
+@click.option('--pch', is_flag=True, default=False, help='Compile against a precompiled vmlinux.h.')
+@click.option('--embed', type=click.Choice(['raw', 'zlib']), default=None, help='Embed each BPF object in its skeleton, optionally compressed.')
 @click.help_option('-h', '--help')
-def build(bpf_src):
+def build(bpf_srcs, jobs, outdir, manifest, no_cache, prune, pch, embed):
     """
-    Compile the BPF object for BPF_SRC.
-    If not specified, BPF_SRC defaults to ./bpf/prog.bpf.c
+    Compile the BPF objects for BPF_SRCS and generate their skeletons, building
+    several objects at once.
+    If not specified, BPF_SRCS defaults to ./bpf/prog.bpf.c
     """
-    bpf_src = os.path.abspath(bpf_src)
+    if not bpf_srcs:
+        bpf_srcs = ['./bpf/prog.bpf.c']
     try:
-        Bootstrap.compile_bpf(bpf_src)
+        result = Bootstrap.build_all(list(bpf_srcs), outdir=outdir, jobs=jobs, cache=not no_cache, manifest=manifest, prune=prune, pch=pch, embed=embed)
     except Exception as e:
-        logger.error(f'Unable to compile BPF program: {repr(e)}')
-
+        logger.error(f'Unable to compile BPF programs: {repr(e)}')
+        raise SystemExit(1)
+    for obj in result['objects']:
+        if 'error' in obj:
+            logger.error(f'Unable to compile {obj["source"]}: {obj["error"]}')
+        else:
+            logger.info(f'Built {obj["object"]} in {obj["seconds"]:.2f}s{" (cached)" if obj["cached"] else ""}')
+    if any('error' in obj for obj in result['objects']):
+        raise SystemExit(1)
@@ -43,15 +43,17 @@ def generate():
 
 @generate.command()
 @click.argument('bpf_dir', type=click.Path(exists=True, file_okay=False, dir_okay=True), default='./bpf')
+@click.option('--prune', is_flag=True, default=False, help='Only include the types used by the *.bpf.c files in BPF_DIR.')
+@click.option('--pch', is_flag=True, default=False, help='Also precompile the header.')
 @click.help_option('-h', '--help')
-def vmlinux(bpf_dir):
+def vmlinux(bpf_dir, prune, pch):
     """
     Generate the vmlinux.h header file and place it in BPF_DIR.
     If not specified, BPF_DIR defaults to ./bpf
     """
     bpf_dir = os.path.abspath(bpf_dir)
     try:
-        Bootstrap.generate_vmlinux(bpfdir=bpf_dir)
+        Bootstrap.generate_vmlinux(bpfdir=bpf_dir, prune=prune, pch=pch)
     except Exception as e:
         logger.error(f'Unable to generate vmlinux: {repr(e)}')
 
@@ -66,8 +68,9 @@ def vmlinux(bpf_dir):
     type=click.Path(dir_okay=True, file_okay=False, exists=True),
     default='.'
 )
+@click.option('--embed', type=click.Choice(['raw', 'zlib']), default=None, help='Embed the BPF object in the skeleton, optionally compressed.')
 @click.help_option('-h', '--help')
-def skeleton(outdir: str, bpf: str):
+def skeleton(outdir: str, bpf: str, embed: str):
     """
     Generate the pybpf skeleton file from BPF.
 
@@ -75,4 +78,4 @@ def skeleton(outdir: str, bpf: str):
 
     OUTDIR is the output directory for the skeleton file. If not specified, defaults to '.'
     """
-    generate_skeleton(bpf, outdir)
+    generate_skeleton(bpf, outdir, embed)
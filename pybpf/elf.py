@@ -0,0 +1,274 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+"""
+
+import os
+import sys
+import mmap
+import struct
+import subprocess
+from typing import Dict, List, NamedTuple, Optional, Tuple
+
+from pybpf.utils import which
+
+SHT_SYMTAB = 2
+SHT_NOTE = 7
+SHT_DYNSYM = 11
+PT_LOAD = 1
+STT_FUNC = 2
+STT_GNU_IFUNC = 10
+SHN_UNDEF = 0
+
+class Section(NamedTuple):
+    name: str
+    type: int
+    addr: int
+    offset: int
+    size: int
+    link: int
+    entsize: int
+
+class Segment(NamedTuple):
+    type: int
+    offset: int
+    vaddr: int
+    filesz: int
+    memsz: int
+
+class Symbol(NamedTuple):
+    name: str
+    value: int
+    size: int
+    type: int
+
+class ElfFile:
+    """
+    A minimal read-only ELF parser, covering only what pybpf needs to attach
+    uprobes: sections, loadable segments, symbol tables, and notes.
+    """
+    def __init__(self, path: str):
+        self.path = path
+        with open(path, 'rb') as f:
+            self._data = mmap.mmap(f.fileno(), 0, prot=mmap.PROT_READ)
+
+        if self._data[:4] != b'\x7fELF':
+            raise ValueError(f'{path} is not an ELF file')
+        self.is64 = self._data[4] == 2
+        self.endian = '<' if self._data[5] == 1 else '>'
+
+        if self.is64:
+            hdr = self._unpack('HHIQQQIHHHHHH', 16)
+        else:
+            hdr = self._unpack('HHIIIIIHHHHHH', 16)
+        (self.type, _machine, _version, _entry, phoff, shoff, _flags, _ehsize,
+                phentsize, phnum, shentsize, shnum, shstrndx) = hdr
+
+        self.segments = [self._segment(phoff + i * phentsize) for i in range(phnum)]
+        raw_sections = [self._section(shoff + i * shentsize) for i in range(shnum)]
+        self.sections = [] # type: List[Section]
+        self._sections_by_name = {} # type: Dict[str, Section]
+        if raw_sections:
+            strtab = raw_sections[shstrndx]
+            for name_off, *rest in raw_sections:
+                section = Section(self._cstr(strtab[3] + name_off), *rest)
+                self.sections.append(section)
+                self._sections_by_name.setdefault(section.name, section)
+
+    def _unpack(self, fmt: str, offset: int) -> Tuple:
+        return struct.unpack_from(self.endian + fmt, self._data, offset)
+
+    def _cstr(self, offset: int) -> str:
+        end = self._data.find(b'\0', offset)
+        return self._data[offset:end].decode('utf-8', 'replace')
+
+    def _segment(self, offset: int) -> Segment:
+        if self.is64:
+            p_type, _flags, p_offset, p_vaddr, _paddr, p_filesz, p_memsz, _align = self._unpack('IIQQQQQQ', offset)
+        else:
+            p_type, p_offset, p_vaddr, _paddr, p_filesz, p_memsz, _flags, _align = self._unpack('IIIIIIII', offset)
+        return Segment(p_type, p_offset, p_vaddr, p_filesz, p_memsz)
+
+    def _section(self, offset: int) -> Tuple:
+        if self.is64:
+            name, sh_type, _flags, addr, off, size, link, _info, _align, entsize = self._unpack('IIQQQQIIQQ', offset)
+        else:
+            name, sh_type, _flags, addr, off, size, link, _info, _align, entsize = self._unpack('IIIIIIIIII', offset)
+        return (name, sh_type, addr, off, size, link, entsize)
+
+    def section(self, name: str) -> Optional[Section]:
+        """
+        Get the first section called @name, if any.
+        """
+        return self._sections_by_name.get(name)
+
+    def section_data(self, section: Section) -> bytes:
+        return self._data[section.offset:section.offset + section.size]
+
+    def symbols(self) -> Dict[str, Symbol]:
+        """
+        Return defined symbols from .symtab and .dynsym, keyed by name.
+        Function symbols take precedence over other symbols of the same name.
+        """
+        symbols = {} # type: Dict[str, Symbol]
+        for section in self.sections:
+            if section.type not in (SHT_SYMTAB, SHT_DYNSYM) or not section.entsize:
+                continue
+            strtab = self.sections[section.link]
+            for i in range(section.size // section.entsize):
+                offset = section.offset + i * section.entsize
+                if self.is64:
+                    st_name, st_info, _other, st_shndx, st_value, st_size = self._unpack('IBBHQQ', offset)
+                else:
+                    st_name, st_value, st_size, st_info, _other, st_shndx = self._unpack('IIIBBH', offset)
+                if st_shndx == SHN_UNDEF or not st_name or not st_value:
+                    continue
+                sym_type = st_info & 0xf
+                name = self._cstr(strtab.offset + st_name)
+                old = symbols.get(name)
+                if old is None or (old.type not in (STT_FUNC, STT_GNU_IFUNC) and sym_type in (STT_FUNC, STT_GNU_IFUNC)):
+                    symbols[name] = Symbol(name, st_value, st_size, sym_type)
+        return symbols
+
+    def vaddr_to_offset(self, vaddr: int) -> int:
+        """
+        Translate virtual address @vaddr into a file offset using the loadable
+        segment that contains it. This works for executables, PIE executables
+        and shared libraries alike.
+        """
+        for seg in self.segments:
+            if seg.type == PT_LOAD and seg.vaddr <= vaddr < seg.vaddr + seg.memsz:
+                return vaddr - seg.vaddr + seg.offset
+        raise ValueError(f'Address {vaddr:#x} is not in a loadable segment of {self.path}')
+
+    def notes(self, section_name: str) -> List[Tuple[str, int, bytes]]:
+        """
+        Parse the ELF notes in section @section_name into a list of
+        (owner name, note type, descriptor) tuples.
+        """
+        section = self.section(section_name)
+        if section is None or section.type != SHT_NOTE:
+            return []
+        notes = []
+        offset = section.offset
+        end = section.offset + section.size
+        while offset + 12 <= end:
+            namesz, descsz, note_type = self._unpack('III', offset)
+            offset += 12
+            name = bytes(self._data[offset:offset + namesz]).rstrip(b'\0').decode('utf-8', 'replace')
+            offset += (namesz + 3) & ~3
+            desc = bytes(self._data[offset:offset + descsz])
+            offset += (descsz + 3) & ~3
+            notes.append((name, note_type, desc))
+        return notes
+
+    def close(self):
+        self._data.close()
+
+# Cached ELF-derived data, keyed by (kind, path, inode, mtime)
+_elf_cache = {}
+
+def cached_elf(path: str, kind: str, parse):
+    """
+    Return @parse(ElfFile(@path)), caching the result per (@kind, path,
+    inode, mtime) so that a binary is only parsed again once it changes.
+    """
+    path = os.path.realpath(path)
+    st = os.stat(path)
+    key = (kind, path, st.st_ino, st.st_mtime_ns)
+    try:
+        return _elf_cache[key]
+    except KeyError:
+        pass
+    elf = ElfFile(path)
+    try:
+        res = parse(elf)
+    finally:
+        elf.close()
+    _elf_cache[key] = res
+    return res
+
+def _parse_symbol_offsets(elf: ElfFile) -> Dict[str, int]:
+    offsets = {}
+    for name, sym in elf.symbols().items():
+        try:
+            offsets[name] = elf.vaddr_to_offset(sym.value)
+        except ValueError:
+            pass
+    return offsets
+
+def symbol_offsets(path: str) -> Dict[str, int]:
+    """
+    Map each defined symbol in the ELF binary at @path to its file offset.
+    """
+    return cached_elf(path, 'symbols', _parse_symbol_offsets)
+
+_ldconfig_cache = None # type: Optional[List[Tuple[str, str, str]]]
+
+def _ldconfig() -> List[Tuple[str, str, str]]:
+    """
+    Parse `ldconfig -p` into (soname, flags, path) tuples, once per process.
+    """
+    global _ldconfig_cache
+    if _ldconfig_cache is not None:
+        return _ldconfig_cache
+    _ldconfig_cache = []
+    try:
+        out = subprocess.check_output([which('ldconfig'), '-p'], stderr=subprocess.DEVNULL)
+    except (FileNotFoundError, subprocess.CalledProcessError):
+        return _ldconfig_cache
+    for line in out.decode('utf-8', 'replace').splitlines()[1:]:
+        try:
+            lhs, path = line.strip().split(' => ')
+            soname, flags = lhs.split(' ', 1)
+        except ValueError:
+            continue
+        _ldconfig_cache.append((soname, flags, path))
+    return _ldconfig_cache
+
+def find_binary(name: str) -> str:
+    """
+    Resolve @name to the absolute path of an executable or shared library.
+    @name may be a path, a library soname such as "libssl.so.1.1", a short
+    library name such as "ssl", or an executable in $PATH.
+    """
+    if os.sep in name:
+        if not os.path.exists(name):
+            raise FileNotFoundError(f'No such binary {name}')
+        return os.path.abspath(name)
+    candidates = [(soname, flags, path) for soname, flags, path in _ldconfig()
+            if soname == name or soname.startswith(f'lib{name}.so') or soname.startswith(f'{name}.so')]
+    # Prefer libraries built for this process's word size
+    native = '64' if sys.maxsize > 2 ** 32 else '32'
+    candidates.sort(key=lambda c: native not in c[1])
+    if candidates:
+        return candidates[0][2]
+    return which(name)
+
+def resolve_symbol(binary: str, symbol: str) -> Tuple[str, int]:
+    """
+    Resolve @symbol in @binary, returning the binary's absolute path and the
+    symbol's file offset, suitable for uprobe attachment.
+    """
+    path = find_binary(binary)
+    # Ignore symbol versions such as malloc@@GLIBC_2.2.5
+    symbol = symbol.split('@', 1)[0]
+    try:
+        return path, symbol_offsets(path)[symbol]
+    except KeyError:
+        raise KeyError(f'Unable to find symbol {symbol} in {path}') from None
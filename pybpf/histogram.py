@@ -0,0 +1,142 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+"""
+
+import ctypes as ct
+from typing import List, Optional, Tuple
+
+from pybpf.maps import PerCpuArray
+
+LOG2 = 'log2'
+LINEAR = 'linear'
+
+class Histogram:
+    """
+    A reader for histograms declared with BPF_HISTOGRAM() or BPF_HISTOGRAM_2D()
+    in pybpf.bpf.h. @_map is the histogram's per-cpu array. @kind is LOG2 or
+    LINEAR; linear histograms also need the @min and @step their buckets were
+    recorded with. 2D histograms need their number of @slots per key.
+
+    Every read fetches all buckets for all cpus in one batch and merges them.
+    """
+    def __init__(self, _map: PerCpuArray, kind: str = LOG2, min: int = 0, step: int = 1, slots: Optional[int] = None):
+        if not isinstance(_map, PerCpuArray):
+            raise TypeError(f'Histograms must be per-cpu arrays, not {_map.__class__.__name__}')
+        if kind not in (LOG2, LINEAR):
+            raise ValueError(f'Unknown histogram kind {kind}')
+        if step < 1:
+            raise ValueError('Histogram step must be at least 1')
+        # Keep a value type the user registered, such as a one-u64 struct
+        if not isinstance(_map.ValueType, type):
+            _map.register_value_type(ct.c_uint64)
+        self._map = _map
+        self.kind = kind
+        self.min = min
+        self.step = step
+        self.slots = slots or _map.capacity()
+        if _map.capacity() % self.slots:
+            raise ValueError(f'Histogram of {_map.capacity()} buckets does not have {self.slots} slots per key')
+        self.nkeys = _map.capacity() // self.slots
+
+    def read(self) -> List[int]:
+        """
+        Return the count in every bucket, summed over all cpus, with the rows
+        of 2D histograms laid out one after the other.
+        """
+        return self._map.read_counters()
+
+    def buckets(self, key: int = 0) -> List[int]:
+        """
+        Return the bucket counts of row @key. Plain histograms only have row 0.
+        """
+        if not 0 <= key < self.nkeys:
+            raise KeyError(f'Histogram has no row {key}')
+        return self.read()[key * self.slots:(key + 1) * self.slots]
+
+    def rows(self) -> List[List[int]]:
+        """
+        Return the bucket counts of every row, using a single read.
+        """
+        merged = self.read()
+        return [merged[key * self.slots:(key + 1) * self.slots] for key in range(self.nkeys)]
+
+    def bucket_range(self, bucket: int) -> Tuple[int, int]:
+        """
+        Return the half-open range of values counted by @bucket. The last
+        bucket of a linear histogram also counts everything above its range,
+        and the first everything below.
+        """
+        if self.kind == LOG2:
+            return (0, 1) if bucket == 0 else (1 << (bucket - 1), 1 << bucket)
+        lo = self.min + bucket * self.step
+        return lo, lo + self.step
+
+    def percentile(self, p: float, key: int = 0, buckets: Optional[List[int]] = None) -> Optional[float]:
+        """
+        Estimate the @p-th percentile of the values in row @key, or in
+        @buckets if given, interpolating linearly inside the bucket it falls
+        in. Returns None if the histogram is empty.
+        """
+        if not 0 <= p <= 100:
+            raise ValueError('Percentile must be between 0 and 100')
+        if buckets is None:
+            buckets = self.buckets(key)
+        total = sum(buckets)
+        if not total:
+            return None
+        rank = p / 100 * total
+        seen = 0
+        for bucket, count in enumerate(buckets):
+            if count and seen + count >= rank:
+                lo, hi = self.bucket_range(bucket)
+                return lo + (hi - lo) * max(rank - seen, 0) / count
+            seen += count
+        return float(self.bucket_range(len(buckets) - 1)[1])
+
+    def percentiles(self, ps: List[float], key: int = 0) -> List[Optional[float]]:
+        """
+        Estimate several percentiles of row @key from a single read.
+        """
+        buckets = self.buckets(key)
+        return [self.percentile(p, buckets=buckets) for p in ps]
+
+    def clear(self):
+        """
+        Reset every bucket to zero.
+        """
+        zero = self._map.ValueType()
+        for i in range(self._map.capacity()):
+            self._map[i] = zero
+
+    def format(self, key: int = 0, label: str = 'value', width: int = 40) -> str:
+        """
+        Format row @key as a table of bucket ranges, counts and bars, leaving
+        out empty buckets at either end.
+        """
+        buckets = self.buckets(key)
+        used = [i for i, count in enumerate(buckets) if count]
+        if not used:
+            return ''
+        peak = max(buckets)
+        lines = [f'{label:>24} : count     distribution']
+        for i in range(used[0], used[-1] + 1):
+            lo, hi = self.bucket_range(i)
+            bar = '*' * (buckets[i] * width // peak)
+            lines.append(f'{lo:>10} -> {hi - 1:<10} : {buckets[i]:<8} |{bar:<{width}}|')
+        return '\n'.join(lines)
@@ -32,6 +32,195 @@ _LIBBPF = ct.CDLL('libbpf.so', use_errno=True)
 
 _RINGBUF_CB_TYPE = ct.CFUNCTYPE(ct.c_int, ct.c_void_p, ct.c_void_p, ct.c_int)
 
+class BpfTcHook(ct.Structure):
+    """
+    struct bpf_tc_hook from libbpf.h
+    """
+    _fields_ = [
+            ('sz', ct.c_size_t),
+            ('ifindex', ct.c_int),
+            ('attach_point', ct.c_int),
+            ('parent', ct.c_uint32),
+            ]
+
+class BpfObjectOpenOpts(ct.Structure):
+    """
+    struct bpf_object_open_opts from libbpf.h, up to the fields we use
+    """
+    _fields_ = [
+            ('sz', ct.c_size_t),
+            ('object_name', ct.c_char_p),
+            ('relaxed_maps', ct.c_bool),
+            ('pin_root_path', ct.c_char_p),
+            ]
+
+class BpfProgAttachOpts(ct.Structure):
+    """
+    struct bpf_prog_attach_opts from bpf.h, up to the fields we use
+    """
+    _fields_ = [
+            ('sz', ct.c_size_t),
+            ('flags', ct.c_uint32),
+            ('replace_prog_fd', ct.c_int),
+            ]
+
+class BpfMapBatchOpts(ct.Structure):
+    """
+    struct bpf_map_batch_opts from bpf.h
+    """
+    _fields_ = [
+            ('sz', ct.c_size_t),
+            ('elem_flags', ct.c_uint64),
+            ('flags', ct.c_uint64),
+            ]
+
+class BpfIterLinkInfo(ct.Structure):
+    """
+    union bpf_iter_link_info from bpf.h, up to the fields we use
+    """
+    _fields_ = [
+            ('map_fd', ct.c_uint32),
+            ]
+
+class BpfLinkCreateOpts(ct.Structure):
+    """
+    struct bpf_link_create_opts from bpf.h, up to the fields we use
+    """
+    _fields_ = [
+            ('sz', ct.c_size_t),
+            ('flags', ct.c_uint32),
+            ('iter_info', ct.POINTER(BpfIterLinkInfo)),
+            ('iter_info_len', ct.c_uint32),
+            ]
+
+class BpfTcOpts(ct.Structure):
+    """
+    struct bpf_tc_opts from libbpf.h
+    """
+    _fields_ = [
+            ('sz', ct.c_size_t),
+            ('prog_fd', ct.c_int),
+            ('flags', ct.c_uint32),
+            ('prog_id', ct.c_uint32),
+            ('handle', ct.c_uint32),
+            ('priority', ct.c_uint32),
+            ]
+
+class BpfUprobeOpts(ct.Structure):
+    """
+    struct bpf_uprobe_opts from libbpf.h
+    """
+    _fields_ = [
+            ('sz', ct.c_size_t),
+            ('ref_ctr_offset', ct.c_size_t),
+            ('bpf_cookie', ct.c_uint64),
+            ('retprobe', ct.c_bool),
+            ]
+
+class BpfKprobeMultiOpts(ct.Structure):
+    """
+    struct bpf_kprobe_multi_opts from libbpf.h
+    """
+    _fields_ = [
+            ('sz', ct.c_size_t),
+            ('syms', ct.POINTER(ct.c_char_p)),
+            ('addrs', ct.c_void_p),
+            ('cookies', ct.c_void_p),
+            ('cnt', ct.c_size_t),
+            ('retprobe', ct.c_bool),
+            ]
+
+class BpfTestRunOpts(ct.Structure):
+    """
+    struct bpf_test_run_opts from bpf.h, up to the fields we use
+    """
+    _fields_ = [
+            ('sz', ct.c_size_t),
+            ('data_in', ct.c_void_p),
+            ('data_out', ct.c_void_p),
+            ('data_size_in', ct.c_uint32),
+            ('data_size_out', ct.c_uint32),
+            ('ctx_in', ct.c_void_p),
+            ('ctx_out', ct.c_void_p),
+            ('ctx_size_in', ct.c_uint32),
+            ('ctx_size_out', ct.c_uint32),
+            ('retval', ct.c_uint32),
+            ('repeat', ct.c_int),
+            ('duration', ct.c_uint32),
+            ]
+
+class BpfProgLoadOpts(ct.Structure):
+    """
+    struct bpf_prog_load_opts from bpf.h
+    """
+    _fields_ = [
+            ('sz', ct.c_size_t),
+            ('attempts', ct.c_int),
+            ('expected_attach_type', ct.c_int),
+            ('prog_btf_fd', ct.c_uint32),
+            ('prog_flags', ct.c_uint32),
+            ('prog_ifindex', ct.c_uint32),
+            ('kern_version', ct.c_uint32),
+            ('attach_btf_id', ct.c_uint32),
+            ('attach_prog_fd', ct.c_uint32),
+            ('attach_btf_obj_fd', ct.c_uint32),
+            ('fd_array', ct.c_void_p),
+            ('func_info', ct.c_void_p),
+            ('func_info_cnt', ct.c_uint32),
+            ('func_info_rec_size', ct.c_uint32),
+            ('line_info', ct.c_void_p),
+            ('line_info_cnt', ct.c_uint32),
+            ('line_info_rec_size', ct.c_uint32),
+            ('log_level', ct.c_uint32),
+            ('log_size', ct.c_uint32),
+            ('log_buf', ct.c_void_p),
+            ]
+
+class BpfProgInfo(ct.Structure):
+    """
+    struct bpf_prog_info from include/uapi/linux/bpf.h
+    """
+    _fields_ = [
+            ('type', ct.c_uint32),
+            ('id', ct.c_uint32),
+            ('tag', ct.c_uint8 * 8),
+            ('jited_prog_len', ct.c_uint32),
+            ('xlated_prog_len', ct.c_uint32),
+            ('jited_prog_insns', ct.c_uint64),
+            ('xlated_prog_insns', ct.c_uint64),
+            ('load_time', ct.c_uint64),
+            ('created_by_uid', ct.c_uint32),
+            ('nr_map_ids', ct.c_uint32),
+            ('map_ids', ct.c_uint64),
+            ('name', ct.c_char * 16),
+            ('ifindex', ct.c_uint32),
+            ('gpl_compatible', ct.c_uint32),
+            ('netns_dev', ct.c_uint64),
+            ('netns_ino', ct.c_uint64),
+            ('nr_jited_ksyms', ct.c_uint32),
+            ('nr_jited_func_lens', ct.c_uint32),
+            ('jited_ksyms', ct.c_uint64),
+            ('jited_func_lens', ct.c_uint64),
+            ('btf_id', ct.c_uint32),
+            ('func_info_rec_size', ct.c_uint32),
+            ('func_info', ct.c_uint64),
+            ('nr_func_info', ct.c_uint32),
+            ('nr_line_info', ct.c_uint32),
+            ('line_info', ct.c_uint64),
+            ('jited_line_info', ct.c_uint64),
+            ('nr_jited_line_info', ct.c_uint32),
+            ('line_info_rec_size', ct.c_uint32),
+            ('jited_line_info_rec_size', ct.c_uint32),
+            ('nr_prog_tags', ct.c_uint32),
+            ('prog_tags', ct.c_uint64),
+            ('run_time_ns', ct.c_uint64),
+            ('run_cnt', ct.c_uint64),
+            ('recursion_misses', ct.c_uint64),
+            ('verified_insns', ct.c_uint32),
+            ('attach_btf_obj_id', ct.c_uint32),
+            ('attach_btf_id', ct.c_uint32),
+            ]
+
 def skeleton_fn(skeleton: ct.CDLL, name: str) -> Callable:
     """
     A decorator that wraps a skeleton function of the same name.
@@ -55,7 +244,9 @@ def skeleton_fn(skeleton: ct.CDLL, name: str) -> Callable:
 
 def libbpf_fn(name: str) -> Callable:
     """
-    A decorator that wraps a libbpf function of the same name.
+    A decorator that wraps a libbpf function of the same name. If the installed
+    libbpf does not provide the function, calling it raises NotImplementedError
+    instead of failing at import time.
     """
     def inner(func):
         th = get_type_hints(func)
@@ -66,6 +257,11 @@ def libbpf_fn(name: str) -> Callable:
                 restype = None
         except KeyError:
             restype = None
+        if not hasattr(_LIBBPF, name):
+            @staticmethod
+            def missing(*args, **kwargs):
+                raise NotImplementedError(f'{name} is not provided by the installed libbpf')
+            return missing
         @staticmethod
         def wrapper(*args, **kwargs):
             return getattr(_LIBBPF, name)(*args, **kwargs)
@@ -74,6 +270,17 @@ def libbpf_fn(name: str) -> Callable:
         return wrapper
     return inner
 
+def libbpf_raw(name: str) -> Callable:
+    """
+    Get the ctypes function for libbpf function @name directly, skipping the
+    Python wrapper in :class:Lib. Its argtypes and restype are those declared
+    in :class:Lib, so @name must be bound there. Meant for hot paths.
+    """
+    try:
+        return getattr(_LIBBPF, name)
+    except AttributeError:
+        raise NotImplementedError(f'{name} is not provided by the installed libbpf') from None
+
 class Lib:
     """
     Python bindings for libbpf.
@@ -88,6 +295,10 @@ class Lib:
     def bpf_object_open(path: ct.c_char_p) -> ct.c_void_p:
         pass
 
+    @libbpf_fn('bpf_object__open_mem')
+    def bpf_object_open_mem(obj_buf: ct.c_void_p, obj_buf_sz: ct.c_size_t, opts: ct.POINTER(BpfObjectOpenOpts)) -> ct.c_void_p:
+        pass
+
     @libbpf_fn('bpf_object__load')
     def bpf_object_load(obj: ct.c_void_p) -> ct.c_int:
         pass
@@ -108,6 +319,10 @@ class Lib:
     def bpf_map_fd(_map: ct.c_void_p) -> ct.c_int:
         pass
 
+    @libbpf_fn('bpf_map__reuse_fd')
+    def bpf_map_reuse_fd(_map: ct.c_void_p, fd: ct.c_int) -> ct.c_int:
+        pass
+
     @libbpf_fn('bpf_map__type')
     def bpf_map_type(_map: ct.c_void_p) -> ct.c_int:
         pass
@@ -153,6 +368,10 @@ class Lib:
     def bpf_map_update_elem(map_fd: ct.c_int, key: ct.c_void_p, value: ct.c_void_p, flags :ct.c_int) -> ct.c_int:
         pass
 
+    @libbpf_fn('bpf_map_create')
+    def bpf_map_create(map_type: ct.c_int, map_name: ct.c_char_p, key_size: ct.c_uint32, value_size: ct.c_uint32, max_entries: ct.c_uint32, opts: ct.c_void_p) -> ct.c_int:
+        pass
+
     @libbpf_fn('bpf_map_delete_elem')
     def bpf_map_delete_elem(map_fd: ct.c_int, key: ct.c_void_p) -> ct.c_int:
         pass
@@ -165,6 +384,14 @@ class Lib:
     def bpf_map_get_next_key(map_fd: ct.c_int, key: ct.c_void_p, next_key: ct.c_void_p) -> ct.c_int:
         pass
 
+    @libbpf_fn('bpf_map_lookup_batch')
+    def bpf_map_lookup_batch(map_fd: ct.c_int, in_batch: ct.c_void_p, out_batch: ct.c_void_p, keys: ct.c_void_p, values: ct.c_void_p, count: ct.POINTER(ct.c_uint32), opts: ct.POINTER(BpfMapBatchOpts)) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_map_lookup_and_delete_batch')
+    def bpf_map_lookup_and_delete_batch(map_fd: ct.c_int, in_batch: ct.c_void_p, out_batch: ct.c_void_p, keys: ct.c_void_p, values: ct.c_void_p, count: ct.POINTER(ct.c_uint32), opts: ct.POINTER(BpfMapBatchOpts)) -> ct.c_int:
+        pass
+
     # ====================================================================
     # Libbpf Ringbuf
     # ====================================================================
@@ -213,6 +440,22 @@ class Lib:
     def bpf_program_attach(prog: ct.c_void_p) -> ct.c_void_p:
         pass
 
+    @libbpf_fn('bpf_link_create')
+    def bpf_link_create(prog_fd: ct.c_int, target_fd: ct.c_int, attach_type: ct.c_int, opts: ct.POINTER(BpfLinkCreateOpts)) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_iter_create')
+    def bpf_iter_create(link_fd: ct.c_int) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_program__set_attach_target')
+    def bpf_program_set_attach_target(prog: ct.c_void_p, attach_prog_fd: ct.c_int, attach_func_name: ct.c_char_p) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_program__attach_freplace')
+    def bpf_program_attach_freplace(prog: ct.c_void_p, target_fd: ct.c_int, attach_func_name: ct.c_char_p) -> ct.c_void_p:
+        pass
+
     @libbpf_fn('bpf_program__next')
     def bpf_program_next(prog: ct.c_void_p, obj: ct.c_void_p) -> ct.c_void_p:
         pass
@@ -230,18 +473,142 @@ class Lib:
             yield prog
             prog = cls.bpf_program_next(prog, obj)
 
-    @libbpf_fn('bpf_prog_test_run')
-    def bpf_prog_test_run(prog_fd: ct.c_int, repeat: ct.c_int, data: ct.c_void_p, data_size: ct.c_uint32, data_out: ct.c_void_p, data_out_size: ct.POINTER(ct.c_uint32), retval: ct.POINTER(ct.c_uint32), duration: ct.POINTER(ct.c_uint32)) -> ct.c_int:
+    @libbpf_fn('bpf_prog_test_run_opts')
+    def bpf_prog_test_run_opts(prog_fd: ct.c_int, opts: ct.POINTER(BpfTestRunOpts)) -> ct.c_int:
         pass
 
     @libbpf_fn('bpf_program__attach_xdp')
     def bpf_program_attach_xdp(prog: ct.c_void_p, ifindex: ct.c_int) -> ct.c_void_p:
         pass
 
+    @libbpf_fn('bpf_object__find_program_by_name')
+    def find_program_by_name(obj: ct.c_void_p, name: ct.c_char_p) -> ct.c_void_p:
+        pass
+
+    @libbpf_fn('bpf_program__set_log_level')
+    def bpf_program_set_log_level(prog: ct.c_void_p, log_level: ct.c_uint32) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_program__set_log_buf')
+    def bpf_program_set_log_buf(prog: ct.c_void_p, log_buf: ct.c_void_p, log_size: ct.c_size_t) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_program__set_autoload')
+    def bpf_program_set_autoload(prog: ct.c_void_p, autoload: ct.c_bool) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_obj_get_info_by_fd')
+    def bpf_obj_get_info_by_fd(fd: ct.c_int, info: ct.c_void_p, info_len: ct.POINTER(ct.c_uint32)) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_program__get_expected_attach_type')
+    def bpf_program_expected_attach_type(prog: ct.c_void_p) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_program__attach_cgroup')
+    def bpf_program_attach_cgroup(prog: ct.c_void_p, cgroup_fd: ct.c_int) -> ct.c_void_p:
+        pass
+
+    @libbpf_fn('bpf_prog_attach')
+    def bpf_prog_attach(prog_fd: ct.c_int, attachable_fd: ct.c_int, attach_type: ct.c_int, flags: ct.c_uint) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_prog_attach_opts')
+    def bpf_prog_attach_opts(prog_fd: ct.c_int, attachable_fd: ct.c_int, attach_type: ct.c_int, opts: ct.POINTER(BpfProgAttachOpts)) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_prog_detach2')
+    def bpf_prog_detach2(prog_fd: ct.c_int, attachable_fd: ct.c_int, attach_type: ct.c_int) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_program__insns')
+    def bpf_program_insns(prog: ct.c_void_p) -> ct.c_void_p:
+        pass
+
+    @libbpf_fn('bpf_program__insn_cnt')
+    def bpf_program_insn_cnt(prog: ct.c_void_p) -> ct.c_size_t:
+        pass
+
+    @libbpf_fn('bpf_prog_load')
+    def bpf_prog_load(prog_type: ct.c_int, prog_name: ct.c_char_p, license: ct.c_char_p, insns: ct.c_void_p, insn_cnt: ct.c_size_t, opts: ct.POINTER(BpfProgLoadOpts)) -> ct.c_int:
+        pass
+
+    @libbpf_fn('libbpf_find_vmlinux_btf_id')
+    def find_vmlinux_btf_id(name: ct.c_char_p, attach_type: ct.c_int) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_raw_tracepoint_open')
+    def bpf_raw_tracepoint_open(name: ct.c_char_p, prog_fd: ct.c_int) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_program__attach_kprobe')
+    def bpf_program_attach_kprobe(prog: ct.c_void_p, retprobe: ct.c_bool, func_name: ct.c_char_p) -> ct.c_void_p:
+        pass
+
+    @libbpf_fn('bpf_program__attach_kprobe_multi_opts')
+    def bpf_program_attach_kprobe_multi_opts(prog: ct.c_void_p, pattern: ct.c_char_p, opts: ct.POINTER(BpfKprobeMultiOpts)) -> ct.c_void_p:
+        pass
+
     @libbpf_fn('bpf_set_link_xdp_fd')
     def bpf_set_link_xdp_fd(ifindex: ct.c_int, progfd: ct.c_int, flags: ct.c_uint32) -> ct.c_int:
         pass
 
+    # ====================================================================
+    # Link Functions
+    # ====================================================================
+
+    @libbpf_fn('bpf_link__fd')
+    def bpf_link_fd(link: ct.c_void_p) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_link__destroy')
+    def bpf_link_destroy(link: ct.c_void_p) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_link_update')
+    def bpf_link_update(link_fd: ct.c_int, new_prog_fd: ct.c_int, opts: ct.c_void_p) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_link__pin')
+    def bpf_link_pin(link: ct.c_void_p, path: ct.c_char_p) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_link__open')
+    def bpf_link_open(path: ct.c_char_p) -> ct.c_void_p:
+        pass
+
+    # ====================================================================
+    # Pinning
+    # ====================================================================
+
+    @libbpf_fn('bpf_obj_pin')
+    def bpf_obj_pin(fd: ct.c_int, pathname: ct.c_char_p) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_obj_get')
+    def bpf_obj_get(pathname: ct.c_char_p) -> ct.c_int:
+        pass
+
+    # ====================================================================
+    # TC Attachment
+    # ====================================================================
+
+    @libbpf_fn('bpf_tc_hook_create')
+    def bpf_tc_hook_create(hook: ct.POINTER(BpfTcHook)) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_tc_hook_destroy')
+    def bpf_tc_hook_destroy(hook: ct.POINTER(BpfTcHook)) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_tc_attach')
+    def bpf_tc_attach(hook: ct.POINTER(BpfTcHook), opts: ct.POINTER(BpfTcOpts)) -> ct.c_int:
+        pass
+
+    @libbpf_fn('bpf_tc_detach')
+    def bpf_tc_detach(hook: ct.POINTER(BpfTcHook), opts: ct.POINTER(BpfTcOpts)) -> ct.c_int:
+        pass
+
     # ====================================================================
     # Uprobe Attachment
     # ====================================================================
@@ -250,6 +617,10 @@ class Lib:
     def attach_uprobe(prog: ct.c_void_p, retprobe: ct.c_bool, pid: ct.c_int, binary_path: ct.c_char_p, func_offset: ct.c_size_t) -> ct.c_void_p:
         pass
 
+    @libbpf_fn('bpf_program__attach_uprobe_opts')
+    def attach_uprobe_opts(prog: ct.c_void_p, pid: ct.c_int, binary_path: ct.c_char_p, func_offset: ct.c_size_t, opts: ct.POINTER(BpfUprobeOpts)) -> ct.c_void_p:
+        pass
+
     # ====================================================================
     # Book Keeping
     # ====================================================================
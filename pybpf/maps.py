@@ -21,19 +21,45 @@
 """
 
 from __future__ import annotations
+import os
+import errno
 import ctypes as ct
+from array import array
 from struct import pack, unpack
 from collections.abc import MutableMapping
 from abc import ABC
 from enum import IntEnum, auto
-from typing import Callable, Any, Optional, Type, Union, TYPE_CHECKING
+from typing import Callable, Any, Optional, Type, Union, Mapping, List, TYPE_CHECKING
 
-from pybpf.lib import Lib, _RINGBUF_CB_TYPE
+from pybpf.lib import Lib, libbpf_raw, BpfMapBatchOpts, _RINGBUF_CB_TYPE
+from pybpf.programs import ProgBase, ProgTracing
 from pybpf.utils import cerr, force_bytes
 
 # Maps map type to map class
 maptype2class = {}
 
+# Instances of these are passed to libbpf as they are
+_CDATA_TYPES = (ct._SimpleCData, ct.Structure, ct.Union, ct.Array)
+
+def to_ctype(_type, value):
+    """
+    Convert @value to an instance of @_type, unless it is already a ctypes
+    instance.
+    """
+    if isinstance(value, _CDATA_TYPES):
+        return value
+    return _type(value)
+
+# Called directly on the fast lookup paths
+_lookup_elem = libbpf_raw('bpf_map_lookup_elem')
+
+# Entries fetched per bpf_map_lookup_batch() call when counting map entries
+BATCH_SIZE = 1024
+
+# Errors from bpf_map_lookup_batch() after which we count one key at a time
+# instead. ENOSPC means a hash bucket holds more than BATCH_SIZE entries.
+_BATCH_FALLBACK_ERRNOS = (errno.EINVAL, errno.EOPNOTSUPP, errno.ENOSPC, 524) # 524 is ENOTSUPP
+
 def register_map(map_type: BPFMapType):
     """
     Decorates a class to register if with the corresponding :IntEnum:BPFMapType.
@@ -50,7 +76,7 @@ class BPFMapType(IntEnum):
     UNSPEC                = 0
     HASH                  = auto()
     ARRAY                 = auto()
-    PROG_ARRAY            = auto() # TODO
+    PROG_ARRAY            = auto()
     PERF_EVENT_ARRAY      = auto() # TODO
     PERCPU_HASH           = auto()
     PERCPU_ARRAY          = auto()
@@ -110,10 +136,85 @@ class MapBase(MutableMapping):
         self._ksize = ksize
         self._vsize = vsize
         self._max_entries = max_entries
+        # Per-cpu element counter declared with BPF_MAP_OCCUPANCY(), if any
+        self._occupancy = None # type: Optional[PerCpuArray]
+        # Iterator program declared with BPF_MAP_ITER(), if any
+        self._iter_prog = None # type: Optional[ProgTracing]
+        self._record = None # type: Optional[Type[ct.Structure]]
 
         self.KeyType = self._no_key_type
         self.ValueType = self._no_value_type
 
+    @property
+    def KeyType(self):
+        return self._KeyType
+
+    @KeyType.setter
+    def KeyType(self, _type):
+        self._KeyType = _type
+        self._record = None
+        # Reusable key buffer for scalar keys, see get_int() and get_into()
+        if isinstance(_type, type) and issubclass(_type, ct._SimpleCData):
+            self._key_buf = _type()
+            self._key_addr = ct.addressof(self._key_buf)
+        else:
+            self._key_buf = None
+
+    @property
+    def ValueType(self):
+        return self._ValueType
+
+    @ValueType.setter
+    def ValueType(self, _type):
+        self._ValueType = _type
+        self._record = None
+        # Reusable value buffer for scalar values, see get_int()
+        if isinstance(_type, type) and issubclass(_type, ct._SimpleCData):
+            self._value_buf = _type()
+            self._value_addr = ct.addressof(self._value_buf)
+        else:
+            self._value_buf = None
+
+    def _key_ref(self, key):
+        """
+        Get a pointer to @key suitable for passing to libbpf. Integer keys of
+        scalar key types are written into the map's key buffer, so the pointer
+        is only valid until the next call.
+        """
+        if self._key_buf is not None and type(key) is int:
+            self._key_buf.value = key
+            return self._key_addr
+        return ct.byref(to_ctype(self.KeyType, key))
+
+    def get_int(self, key: int) -> int:
+        """
+        Look up @key and return its value as a Python int. Both the key and
+        value types must be scalar ctypes. This reuses per-map buffers instead
+        of allocating ctypes objects, so it is much cheaper than map[key] but
+        must not be called on the same map from several threads at once.
+        """
+        value_buf = self._value_buf
+        if value_buf is None:
+            raise TypeError(f'get_int() requires a scalar value type, not {self.ValueType!r}')
+        ret = _lookup_elem(self._map_fd, self._key_ref(key), self._value_addr)
+        if ret < 0:
+            raise KeyError(f'Unable to fetch item: {cerr(ret)}')
+        return value_buf.value
+
+    def get_into(self, key, out: ct._CData) -> ct._CData:
+        """
+        Look up @key and copy its value into the ctypes object @out, which
+        must be at least as large as the value type (for per-cpu maps, the
+        values of every possible CPU). Returns @out. Reusing @out across calls
+        avoids allocating a new value per lookup.
+        """
+        if ct.sizeof(out) < self._value_stride():
+            raise ValueError(f'Buffer of size {ct.sizeof(out)} is too small for value size {self._value_stride()}')
+        ret = _lookup_elem(self._map_fd, self._key_ref(key), ct.addressof(out))
+        if ret < 0:
+            raise KeyError(f'Unable to fetch item: {cerr(ret)}')
+        return out
+
     def _no_key_type(self, *args, **kwargs):
         raise Exception(f'Please define a ctype for key using {self.__class__.__name__}.register_key_type(ctype)')
 
@@ -142,6 +243,172 @@ class MapBase(MutableMapping):
         """
         return self._max_entries
 
+    def count(self, exact: bool = True) -> int:
+        """
+        Count the entries in the map. Exact counts enumerate the keys
+        BATCH_SIZE at a time with bpf_map_lookup_batch(), or one at a time on
+        kernels without batch support. If @exact is False and the map has a
+        counter declared with BPF_MAP_OCCUPANCY() in pybpf.bpf.h, that counter
+        is read instead, which takes a single syscall. The counter only tracks
+        insertions and deletions made through the pybpf.bpf.h helpers.
+        """
+        if not exact and self._occupancy is not None:
+            return max(0, min(sum(self._occupancy[0]), self._max_entries))
+        try:
+            return sum(count for _keys, _values, count in self._lookup_batches())
+        except NotImplementedError:
+            return self._count_keys()
+
+    def occupancy(self, exact: bool = True) -> float:
+        """
+        Return the fraction of the map's capacity in use. See count() for the
+        meaning of @exact.
+        """
+        return self.count(exact) / self._max_entries if self._max_entries else 0.0
+
+    def _value_stride(self) -> int:
+        """
+        The size of one value as copied out by batch operations.
+        """
+        return self._vsize
+
+    def _lookup_batches(self, delete: bool = False):
+        """
+        Walk the map with bpf_map_lookup_batch(), or with
+        bpf_map_lookup_and_delete_batch() if @delete is set, generating (keys,
+        values, count) for each batch, where @keys and @values are buffers
+        holding @count entries. The buffers are reused from one batch to the
+        next. Raises NotImplementedError if the map does not support batch
+        lookups.
+        """
+        lookup_batch = Lib.bpf_map_lookup_and_delete_batch if delete else Lib.bpf_map_lookup_batch
+        batch_size = max(1, min(self._max_entries, BATCH_SIZE))
+        keys = ct.create_string_buffer(batch_size * self._ksize)
+        values = ct.create_string_buffer(batch_size * self._value_stride())
+        # Opaque batch tokens, large enough for any map type's position
+        token_size = max(self._ksize, 8)
+        in_token = ct.create_string_buffer(token_size)
+        out_token = ct.create_string_buffer(token_size)
+        opts = BpfMapBatchOpts(sz=ct.sizeof(BpfMapBatchOpts))
+        count = ct.c_uint32()
+
+        in_batch = None
+        while True:
+            count.value = batch_size
+            ret = lookup_batch(self._map_fd, in_batch, out_token, keys, values, ct.byref(count), ct.byref(opts))
+            # libbpf either returns -errno or returns -1 and sets errno
+            err = ct.get_errno() if ret == -1 else -ret
+            if ret < 0 and err != errno.ENOENT:
+                if err in _BATCH_FALLBACK_ERRNOS:
+                    raise NotImplementedError(f'Unable to look up map entries in batches: {cerr(err)}')
+                raise Exception(f'Failed to look up map entries: {cerr(err)}')
+            yield keys, values, count.value
+            # ENOENT marks the last batch
+            if ret < 0:
+                return
+            ct.memmove(in_token, out_token, token_size)
+            in_batch = in_token
+
+    def lookup_batch(self):
+        """
+        Read every entry of the map, BATCH_SIZE entries per syscall with
+        bpf_map_lookup_batch(), or one at a time on kernels without batch
+        support. Returns a (keys, values) pair of ctypes arrays.
+        """
+        return self._read_batches(delete=False)
+
+    def pop_batch(self):
+        """
+        Read and delete every entry of the map, BATCH_SIZE entries per syscall
+        with bpf_map_lookup_and_delete_batch(). The kernel copies and deletes
+        each entry together, so this loses far fewer concurrent updates than
+        reading and then deleting, but it is not exact: a BPF program that
+        looked an entry up before it was deleted can still update the value
+        in place, for instance with an atomic add, and that update is lost
+        with the entry. On kernels without batch support, entries are read and
+        deleted one at a time, and any update that lands in between is lost
+        too. Returns a (keys, values) pair of ctypes arrays.
+        """
+        return self._read_batches(delete=True)
+
+    def _read_batches(self, delete: bool):
+        key_type, value_type = self._check_types()
+        keys, values, total = bytearray(), bytearray(), 0
+        try:
+            for batch_keys, batch_values, count in self._lookup_batches(delete):
+                keys += ct.string_at(batch_keys, count * self._ksize)
+                values += ct.string_at(batch_values, count * self._value_stride())
+                total += count
+        except NotImplementedError:
+            # Entries already deleted in batches are kept, but a plain lookup
+            # starts over
+            if not delete:
+                keys, values, total = bytearray(), bytearray(), 0
+            for key, value in self.items():
+                if delete:
+                    try:
+                        self.__delitem__(key)
+                    except KeyError:
+                        continue
+                keys += bytes(to_ctype(key_type, key))
+                values += bytes(value)
+                total += 1
+        return (key_type * total).from_buffer(keys), (value_type * total).from_buffer(values)
+
+    def dump(self, prog: Optional[ProgTracing] = None) -> ct.Array:
+        """
+        Read every entry of the map in a single kernel-side pass of the
+        bpf_map_elem iterator program @prog, or of the one declared for this
+        map with BPF_MAP_ITER() in pybpf.bpf.h. The iterator's output is read
+        in large chunks and decoded in bulk. Returns an array of records with
+        key and value fields. As in any ctypes structure, scalar fields read as
+        Python ints. Per-cpu maps are not supported.
+        """
+        prog = prog or self._iter_prog
+        if prog is None:
+            raise Exception(f'No iterator program to dump map with. Please declare one using BPF_MAP_ITER()')
+        if self._value_stride() != self._vsize:
+            raise NotImplementedError('Per-cpu maps cannot be dumped with an iterator')
+        record = self._record_type()
+        with open(prog.open_iter(self._map_fd), 'rb', buffering=0) as f:
+            data = f.read()
+        count, rest = divmod(len(data), ct.sizeof(record))
+        if rest:
+            raise Exception(f'Iterator output of {len(data)} bytes is not a whole number of {ct.sizeof(record)} byte records')
+        return (record * count).from_buffer_copy(data)
+
+    def _check_types(self):
+        """
+        Return the registered key and value types, raising an exception if
+        either is missing.
+        """
+        if not isinstance(self.KeyType, type):
+            self._no_key_type()
+        if not isinstance(self.ValueType, type):
+            self._no_value_type()
+        return self.KeyType, self.ValueType
+
+    def _record_type(self) -> Type[ct.Structure]:
+        """
+        A packed key and value pair, as written by BPF_MAP_ITER() programs.
+        """
+        if self._record is None:
+            key_type, value_type = self._check_types()
+            class Record(ct.Structure):
+                _pack_ = 1
+                _fields_ = [('key', key_type), ('value', value_type)]
+            self._record = Record
+        return self._record
+
+    def _count_keys(self) -> int:
+        """
+        Count the entries in the map one bpf_map_get_next_key() call at a time.
+        """
+        i = 0
+        for _k in self:
+            i += 1
+        return i
+
     def clear(self):
         """
         Clear the map, deleting all keys.
@@ -236,25 +503,16 @@ class MapBase(MutableMapping):
         Update a map value, operating according to specified flags.
         This provides more control than the traditional map[key] = value method.
         """
-        try:
-            key = self.KeyType(key)
-        except TypeError:
-            pass
-        try:
-            value = self.ValueType(value)
-        except TypeError:
-            pass
+        key = to_ctype(self.KeyType, key)
+        value = to_ctype(self.ValueType, value)
         ret = Lib.bpf_map_update_elem(self._map_fd, ct.byref(key), ct.byref(value), flags)
         if ret < 0:
             raise KeyError(f'Unable to update item: {cerr(ret)}')
 
     def __getitem__(self, key):
         value = self.ValueType()
-        try:
-            key = self.KeyType(key)
-        except TypeError:
-            pass
-        ret = Lib.bpf_map_lookup_elem(self._map_fd, ct.byref(key), ct.byref(value))
+        key = to_ctype(self.KeyType, key)
+        ret = _lookup_elem(self._map_fd, ct.byref(key), ct.byref(value))
         if ret < 0:
             raise KeyError(f'Unable to fetch item: {cerr(ret)}')
         return value
@@ -263,10 +521,7 @@ class MapBase(MutableMapping):
         self.update(key, value, 0)
 
     def __delitem__(self, key):
-        try:
-            key = self.KeyType(key)
-        except TypeError:
-            pass
+        key = to_ctype(self.KeyType, key)
         ret = Lib.bpf_map_delete_elem(self._map_fd, ct.byref(key))
         if ret < 0:
             raise KeyError(f'Unable to delete item item: {cerr(ret)}')
@@ -275,10 +530,7 @@ class MapBase(MutableMapping):
         return self.Iter(self)
 
     def __len__(self):
-        i = 0
-        for _k in self:
-            i += 1
-        return i
+        return self.count()
 
     def __eq__(self, other):
         return id(self) == id(other)
@@ -298,6 +550,8 @@ class PerCpuMixin(ABC):
             alignment = self._vsize % 8
             assert alignment == 0
 
+    def _value_stride(self) -> int:
+        return self._vsize * self._num_cpus
 
     def register_value_type(self, _type: ct.Structure):
         """
@@ -361,9 +615,57 @@ class Array(MapBase):
     def register_key_type(self, _type: ct.Structure):
         raise NotImplementedError('Arrays always have key type ct.c_uint. This cannot be changed')
 
+    def count(self, exact: bool = True) -> int:
+        """
+        Arrays preallocate every element, so they are always full.
+        """
+        return self._max_entries
+
     def __delitem__(self, key):
         self.__setitem__(key, self.ValueType())
 
+@register_map(BPFMapType.PROG_ARRAY)
+class ProgArray(Array):
+    """
+    A BPF array of program file descriptors, used as a jump table for
+    bpf_tail_call(). Programs can be installed directly, for example
+    `prog_array[3] = skel.progs.parse_ipv6`. Looking up an index from userspace
+    returns the id of the program installed there.
+    """
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+
+        self.KeyType = ct.c_uint
+        self.ValueType = ct.c_uint
+
+    def register_value_type(self, _type: ct.Structure):
+        raise NotImplementedError('Program arrays always have value type ct.c_uint. This cannot be changed')
+
+    def update(self, key: self.KeyType, value: Union[ProgBase, int], flags: int):
+        """
+        Install program @value (a ProgBase or a program fd) at index @key.
+        """
+        if isinstance(value, ProgBase):
+            value = value._prog_fd
+        super().update(key, value, flags)
+
+    def __delitem__(self, key):
+        MapBase.__delitem__(self, key)
+
+    def populate(self, progs: Mapping[str, ProgBase], prefix: str) -> List[int]:
+        """
+        Install every program in @progs named @prefix__<index> at <index>.
+        Returns the list of indices that were populated.
+        """
+        populated = []
+        for name, prog in progs.items():
+            head, sep, index = name.rpartition('__')
+            if not sep or head != prefix or not index.isdigit():
+                continue
+            self.__setitem__(int(index), prog)
+            populated.append(int(index))
+        return populated
+
 @register_map(BPFMapType.CGROUP_ARRAY)
 class CgroupArray(Array):
     """
@@ -377,6 +679,9 @@ class CgroupArray(Array):
         self.KeyType = ct.c_uint
         self.ValueType = ct.c_uint
 
+        # The next index to be filled by append_cgroup()
+        self._next_index = 0
+
     def register_value_type(self, _type: ct.Structure):
         raise NotImplementedError('Cgroup always have value type ct.c_uint. This cannot be changed')
 
@@ -389,12 +694,17 @@ class CgroupArray(Array):
         and append its file descriptor to the map. Returns the array index that
         was updated on success.
         """
-        with open(cgroup_path, 'r') as f:
-            fd = f.fileno
-        if fd < 0:
-            raise Exception(f'Unable to get file descriptor for cgroup {cgroup_path}')
-        key = len(self)
-        self.__setitem__(key, fd)
+        if self._next_index >= self._max_entries:
+            raise KeyError(f'Unable to append cgroup {cgroup_path}: map is full')
+        key = self._next_index
+        # The map holds its own reference to the cgroup, so the fd need only
+        # stay open for the update
+        fd = os.open(cgroup_path, os.O_RDONLY)
+        try:
+            self.__setitem__(key, fd)
+        finally:
+            os.close(fd)
+        self._next_index += 1
         return key
 
 @register_map(BPFMapType.PERCPU_ARRAY)
@@ -407,6 +717,28 @@ class PerCpuArray(PerCpuMixin, Array):
         Array.__init__(self, *args, **kwargs)
         PerCpuMixin.__init__(self, *args, **kwargs)
 
+    def read_counters(self) -> List[int]:
+        """
+        Read every element of a per-cpu array of u64 counters in one batch and
+        return their sums over all cpus. Values are decoded as u64 whatever
+        value type is registered, which is left as it is.
+        """
+        if self._vsize != ct.sizeof(ct.c_uint64):
+            raise Exception(f'Values of size {self._vsize} are not u64 counters')
+        values = bytearray()
+        try:
+            for _keys, batch_values, count in self._lookup_batches():
+                values += ct.string_at(batch_values, count * self._value_stride())
+        except NotImplementedError:
+            out = (ct.c_uint64 * self._num_cpus)()
+            values = bytearray()
+            for key in range(self._max_entries):
+                values += bytes(self.get_into(key, out))
+        counts = array('Q', bytes(values))
+        # Values are laid out element by element, with one count per cpu
+        ncpus = self._num_cpus
+        return [sum(cpus) for cpus in zip(*(counts[cpu::ncpus] for cpu in range(ncpus)))]
+
 @register_map(BPFMapType.CGROUP_STORAGE)
 class CgroupStorage(MapBase):
     """
@@ -457,10 +789,7 @@ class QueueStack(ABC):
         """
         Push an element onto the map.
         """
-        try:
-            value = self.ValueType(value)
-        except TypeError:
-            pass
+        value = to_ctype(self.ValueType, value)
         ret = Lib.bpf_map_update_elem(self._map_fd, None, ct.byref(value), flags)
         if ret < 0:
             raise KeyError(f'Unable to push value: {cerr(ret)}')
@@ -21,13 +21,19 @@
 """
 
 from __future__ import annotations
+import os
+import re
+import errno
+import socket
 import ctypes as ct
 from enum import IntEnum, auto
 from abc import ABC
-from typing import Callable, Any, Optional, Type, TYPE_CHECKING
+from typing import Callable, Any, Optional, Type, Iterable, Dict, List, Set, Tuple, Union, TYPE_CHECKING
 
-from pybpf.lib import Lib, _RINGBUF_CB_TYPE
-from pybpf.utils import cerr, force_bytes, get_encoded_kernel_version
+from pybpf.lib import Lib, BpfProgAttachOpts, BpfIterLinkInfo, BpfLinkCreateOpts, BpfTcHook, BpfTcOpts, BpfUprobeOpts, BpfKprobeMultiOpts, BpfProgLoadOpts, BpfProgInfo, BpfTestRunOpts, _RINGBUF_CB_TYPE
+from pybpf.utils import cerr, force_bytes, get_encoded_kernel_version, match_kernel_functions
+from pybpf.elf import resolve_symbol
+from pybpf.usdt import usdt_probes, usdt_spec_id
 
 # Maps prog type to prog class
 progtype2class = {}
@@ -79,6 +85,91 @@ class BPFProgType(IntEnum):
     # This must be the last entry
     PROG_TYPE_UNKNOWN       = auto()
 
+# enum bpf_tc_attach_point from libbpf.h
+TC_ATTACH_POINTS = {
+    'ingress': 1 << 0,
+    'egress': 1 << 1,
+}
+
+# Cgroup attach flags from include/uapi/linux/bpf.h
+BPF_F_ALLOW_OVERRIDE = 1 << 0
+BPF_F_ALLOW_MULTI    = 1 << 1
+BPF_F_REPLACE        = 1 << 2
+
+# enum bpf_attach_type values from include/uapi/linux/bpf.h
+BPF_TRACE_KPROBE_MULTI = 42
+BPF_TRACE_ITER = 28
+
+# enum bpf_tc_flags from libbpf.h
+BPF_TC_F_REPLACE = 1 << 0
+
+# Verifier log levels from include/linux/bpf_verifier.h
+BPF_LOG_LEVEL1 = 1
+BPF_LOG_LEVEL2 = 2
+BPF_LOG_STATS  = 4
+
+# Summary lines printed by the verifier at BPF_LOG_STATS
+_VERIFIER_STATS_RE = re.compile(
+        r'processed (?P<processed_insns>\d+) insns \(limit \d+\) '
+        r'max_states_per_insn (?P<max_states_per_insn>\d+) '
+        r'total_states (?P<total_states>\d+) '
+        r'peak_states (?P<peak_states>\d+) '
+        r'mark_read (?P<mark_read>\d+)')
+_VERIFIER_TIME_RE = re.compile(r'verification time (?P<verification_time_usec>\d+) usec')
+
+def parse_verifier_stats(log: str) -> Dict[str, int]:
+    """
+    Extract the complexity statistics from a verifier log written at
+    BPF_LOG_STATS or above. Missing statistics are left out.
+    """
+    stats = {}
+    for regex in (_VERIFIER_STATS_RE, _VERIFIER_TIME_RE):
+        match = None
+        for match in regex.finditer(log):
+            pass
+        if match:
+            stats.update({k: int(v) for k, v in match.groupdict().items()})
+    return stats
+
+def open_cgroup(cgroup_path: str) -> int:
+    """
+    Open the cgroup directory @cgroup_path and return a file descriptor for
+    it, which the caller must close. Attachments hold their own reference to
+    the cgroup, so the descriptor is only needed for the duration of a call.
+    """
+    return os.open(cgroup_path, os.O_RDONLY | os.O_DIRECTORY)
+
+def ifindex(ifname: str) -> int:
+    """
+    Get the interface index for interface @ifname.
+    """
+    try:
+        return socket.if_nametoindex(ifname)
+    except OSError:
+        raise KeyError(f'No such interface "{ifname}"') from None
+
+def open_pinned_link(path: str) -> ct.c_void_p:
+    """
+    Open the BPF link pinned at @path.
+    """
+    link = Lib.bpf_link_open(force_bytes(path))
+    if not link:
+        raise Exception(f'Failed to open pinned link {path}: {cerr()}')
+    return link
+
+def open_pinned_fd(path: str) -> int:
+    """
+    Open the BPF object pinned at @path and return a file descriptor for it.
+    """
+    fd = Lib.bpf_obj_get(force_bytes(path))
+    if fd < 0:
+        raise Exception(f'Failed to open pinned BPF object {path}: {cerr(fd)}')
+    return fd
+
+# A record describing one attachment of a program, saved with its pins, and
+# the fds of the links (or programs) that keep the attachment alive
+PinnedAttachment = Tuple[Dict[str, Any], List[int]]
+
 def create_prog(prog: ct.c_void_p, prog_name: str, prog_type: ct.c_int, prog_fd: ct.c_int) -> Optional[ProgBase]:
     """
     Create a BPF prog object from a prog description.
@@ -109,43 +200,325 @@ class ProgBase(ABC):
         self._name = name
         self._prog_fd = prog_fd
         self._link = None # type: ct.c_void_p
+        # Whether the program was adopted from pins, and so never loaded by libbpf
+        self._adopted = False
+        # Estimated time spent loading and verifying the program, in seconds
+        self.verification_time = None # type: Optional[float]
+        # Verifier log captured while loading the program, if any
+        self.verifier_log = '' # type: str
 
     def __eq__(self, other):
         return id(self) == id(other)
 
+    def _loaded_prog(self) -> ct.c_void_p:
+        """
+        Get the libbpf program, for calls that need it to be loaded. Programs
+        adopted from pins come from an object that was only opened, so libbpf
+        cannot attach them anew; only their pinned attachments, and those made
+        with their fd, are available.
+        """
+        if self._adopted:
+            raise Exception(f'BPF program {self._name} was adopted from pins and cannot be re-attached; load the BPF object to attach it anew')
+        return self._prog
+
     def attach(self):
         """
         Attach the BPF program.
         """
         if self._link:
             return
-        self._link = Lib.bpf_program_attach(self._prog)
+        self._link = Lib.bpf_program_attach(self._loaded_prog())
         if not self._link:
             raise Exception(f'Failed to attach BPF program {self._name}: {cerr()}')
 
+    def detach_all(self):
+        """
+        Remove every attachment of the BPF program, however it was made. The
+        program itself stays loaded.
+        """
+        if self._link:
+            Lib.bpf_link_destroy(self._link)
+            self._link = None
+
+    def close_links(self):
+        """
+        Destroy every BPF link the program holds. Attachments whose link is
+        pinned, and those the kernel keeps without a link (such as legacy
+        cgroup, TC and XDP attachments), stay in place.
+        """
+        if self._link:
+            Lib.bpf_link_destroy(self._link)
+            self._link = None
+
+    def _pin_attachments(self) -> List[PinnedAttachment]:
+        """
+        Describe every attachment of the program, for pin_bpf_object().
+        """
+        if self._link:
+            return [({'kind': 'link'}, [Lib.bpf_link_fd(self._link)])]
+        return []
+
+    def _adopt_attachment(self, record: Dict[str, Any], paths: List[str]):
+        """
+        Restore an attachment described by _pin_attachments() from the pins of
+        its fds at @paths.
+        """
+        if record['kind'] != 'link':
+            raise ValueError(f'BPF program {self._name} cannot adopt a {record["kind"]} attachment')
+        self._link = open_pinned_link(paths[0])
+
+    def prog_info(self) -> BpfProgInfo:
+        """
+        Get the kernel's bpf_prog_info for the loaded BPF program.
+        """
+        info = BpfProgInfo()
+        info_len = ct.c_uint32(ct.sizeof(info))
+        retval = Lib.bpf_obj_get_info_by_fd(self._prog_fd, ct.byref(info), ct.byref(info_len))
+        if retval < 0:
+            raise Exception(f'Failed to get info for BPF program {self._name}: {cerr(retval)}')
+        return info
+
+    def verifier_stats(self) -> Dict[str, int]:
+        """
+        Get the verifier's complexity statistics for the loaded BPF program:
+        verified_insns, jited_prog_len and xlated_prog_len from the kernel,
+        plus processed_insns, total_states, peak_states, max_states_per_insn,
+        mark_read and verification_time_usec parsed from the verifier log when
+        it was captured at BPF_LOG_STATS.
+        """
+        info = self.prog_info()
+        stats = parse_verifier_stats(self.verifier_log)
+        # Kernels before 5.16 do not report verified_insns
+        stats['verified_insns'] = info.verified_insns or stats.get('processed_insns', 0)
+        stats['jited_prog_len'] = info.jited_prog_len
+        stats['xlated_prog_len'] = info.xlated_prog_len
+        return stats
+
+    def pin(self, path: str):
+        """
+        Pin the BPF program's link at @path in a BPF filesystem, so that the
+        program stays attached after this process exits, until the pin is
+        removed. reattach_from_pins() does not know about links pinned this
+        way; use the skeleton's pin_bpf() for attachments that a new process
+        should adopt.
+        """
+        if not self._link:
+            raise Exception(f'BPF program {self._name} is not attached with a link')
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        if os.path.exists(path):
+            os.unlink(path)
+        retval = Lib.bpf_link_pin(self._link, force_bytes(path))
+        if retval < 0:
+            raise Exception(f'Failed to pin BPF program {self._name} at {path}: {cerr(retval)}')
+
     def invoke(self, data: ct.Structure = None):
         """
         Invoke the BPF program once and capture and return its return value.
         If the program is of type BPF_PROG_TYPE_USER, you can pass it data
         using a ctypes struct @data.
         """
-        if data == None:
-            data_p = None
-            data_size = ct.c_uint32(0)
-        else:
-            data_p = ct.addressof(data)
-            data_size = ct.sizeof(data)
+        bpf_retval, _ = self._test_run(data, 1)
+        return bpf_retval
 
-        # Make this signed so that we can express negative return values,
-        # should be okay to pass to the unsigned retval pointer
-        bpf_ret = ct.c_uint32()
+    def benchmark(self, repeat: int = 1000000, data: ct.Structure = None) -> float:
+        """
+        Run the BPF program @repeat times back to back in the kernel with
+        bpf_prog_test_run_opts(), passing it @data as in invoke(), and return
+        the mean run time in nanoseconds as measured by the kernel. Useful for
+        comparing variants of a hot path without attaching them anywhere.
+        Note that maps the program writes to are updated by every run.
+        """
+        if repeat < 1:
+            raise ValueError(f'repeat must be at least 1, got {repeat}')
+        _, duration = self._test_run(data, repeat)
+        return float(duration)
 
-        retval = Lib.bpf_prog_test_run(self._prog_fd, ct.c_int(1), data_p, data_size, None, ct.c_uint32(0), ct.byref(bpf_ret), None)
+    def _test_run(self, data: Optional[ct.Structure], repeat: int):
+        """
+        Run the BPF program @repeat times with bpf_prog_test_run_opts(),
+        returning its last return value and its mean duration in nanoseconds.
+        """
+        opts = BpfTestRunOpts(sz=ct.sizeof(BpfTestRunOpts), repeat=repeat)
+        if data is not None:
+            opts.data_in = ct.addressof(data)
+            opts.data_size_in = ct.sizeof(data)
+
+        retval = Lib.bpf_prog_test_run_opts(self._prog_fd, ct.byref(opts))
         if retval < 0:
             raise Exception(f'Failed to invoke BPF program {self._name}: {cerr(retval)}')
 
-        bpf_retval = ct.c_int16(bpf_ret.value)
-        return bpf_retval.value
+        # The return value is unsigned, so make it signed so that we can
+        # express negative return values
+        bpf_retval = ct.c_int16(opts.retval)
+        return bpf_retval.value, opts.duration
+
+    def _take_over(self, old: ProgBase):
+        """
+        Move the attachments of @old, the previous version of this program,
+        over to this program when hot swapping a BPF object. Links are pointed
+        at the new program atomically where the kernel supports it. Otherwise
+        the new program is attached before the old attachment is destroyed, so
+        that there is never a window in which neither program runs.
+        """
+        if not old._link:
+            return
+        if Lib.bpf_link_update(Lib.bpf_link_fd(old._link), self._prog_fd, None) == 0:
+            self._link, old._link = old._link, None
+            return
+        self.attach()
+        Lib.bpf_link_destroy(old._link)
+        old._link = None
+
+class CgroupAttachMixin(ABC):
+    """
+    Attach logic for programs that attach to cgroups.
+    """
+    _prog = None # type: ct.c_void_p
+    _prog_fd = None # type: int
+    _name = None # type: str
+    def __init__(self, *args, **kwargs):
+        # Maps cgroup path to its link, or None for a legacy attachment
+        self._cgroup_attachments = {} # type: Dict[str, Optional[ct.c_void_p]]
+        # Maps cgroup path to the flags used for a legacy attachment
+        self._cgroup_flags = {} # type: Dict[str, int]
+
+    def attach(self):
+        """
+        Cgroup programs need a target cgroup, so they are not attached
+        automatically. Use attach_cgroup() instead.
+        """
+        pass
+
+    def attach_cgroup(self, cgroup_path: str, flags: int = BPF_F_ALLOW_MULTI, replace: Optional[ProgBase] = None):
+        """
+        Attach the BPF program to the cgroup directory @cgroup_path. With the
+        default BPF_F_ALLOW_MULTI, the program is attached with a BPF link,
+        which always coexists with other programs on the cgroup. Other @flags
+        (0, BPF_F_ALLOW_OVERRIDE, or BPF_F_ALLOW_MULTI | BPF_F_REPLACE to
+        atomically swap out the attached program @replace) fall back to a
+        legacy bpf_prog_attach_opts() using the program's expected attach type.
+        The kernel can only replace programs attached without a link, so
+        @replace must have been attached with flags other than the default.
+        """
+        cgroup_path = os.path.abspath(cgroup_path)
+        if cgroup_path in self._cgroup_attachments:
+            return
+        if flags & BPF_F_REPLACE and replace is None:
+            raise ValueError('BPF_F_REPLACE requires the program to replace')
+        fd = open_cgroup(cgroup_path)
+        try:
+            if flags == BPF_F_ALLOW_MULTI:
+                link = Lib.bpf_program_attach_cgroup(self._loaded_prog(), fd)
+                if not link:
+                    raise Exception(f'Failed to attach BPF program {self._name} to cgroup {cgroup_path}: {cerr()}')
+            else:
+                self._prog_attach(fd, flags, replace._prog_fd if flags & BPF_F_REPLACE else 0, cgroup_path)
+                link = None
+                # BPF_F_REPLACE only applies to this call
+                self._cgroup_flags[cgroup_path] = flags & ~BPF_F_REPLACE
+        finally:
+            os.close(fd)
+        self._cgroup_attachments[cgroup_path] = link
+
+    def _prog_attach(self, fd: int, flags: int, replace_prog_fd: int, cgroup_path: str):
+        attach_type = Lib.bpf_program_expected_attach_type(self._prog)
+        opts = BpfProgAttachOpts(sz=ct.sizeof(BpfProgAttachOpts), flags=flags, replace_prog_fd=replace_prog_fd)
+        retval = Lib.bpf_prog_attach_opts(self._prog_fd, fd, attach_type, ct.byref(opts))
+        if retval < 0:
+            raise Exception(f'Failed to attach BPF program {self._name} to cgroup {cgroup_path}: {cerr(retval)}')
+
+    def attach_cgroups(self, cgroup_paths: Iterable[str], flags: int = BPF_F_ALLOW_MULTI) -> Dict[str, Exception]:
+        """
+        Attach the BPF program to every cgroup in @cgroup_paths. A failure on
+        one cgroup does not abort the batch. Returns a dictionary mapping each
+        cgroup path that failed to the exception it raised.
+        """
+        failures = {}
+        for cgroup_path in cgroup_paths:
+            try:
+                self.attach_cgroup(cgroup_path, flags)
+            except Exception as e:
+                failures[cgroup_path] = e
+        return failures
+
+    def detach_cgroup(self, cgroup_path: str):
+        """
+        Detach the BPF program from the cgroup directory @cgroup_path.
+        """
+        cgroup_path = os.path.abspath(cgroup_path)
+        try:
+            link = self._cgroup_attachments.pop(cgroup_path)
+            self._cgroup_flags.pop(cgroup_path, None)
+        except KeyError:
+            raise KeyError(f'BPF program {self._name} is not attached to cgroup {cgroup_path}') from None
+        if link:
+            retval = Lib.bpf_link_destroy(link)
+        else:
+            attach_type = Lib.bpf_program_expected_attach_type(self._prog)
+            fd = open_cgroup(cgroup_path)
+            try:
+                retval = Lib.bpf_prog_detach2(self._prog_fd, fd, attach_type)
+            finally:
+                os.close(fd)
+        if retval < 0:
+            raise Exception(f'Failed to detach BPF program {self._name} from cgroup {cgroup_path}: {cerr(retval)}')
+
+    def detach_all(self):
+        for cgroup_path in list(self._cgroup_attachments):
+            self.detach_cgroup(cgroup_path)
+        super().detach_all()
+
+    def close_links(self):
+        for link in self._cgroup_attachments.values():
+            if link:
+                Lib.bpf_link_destroy(link)
+        self._cgroup_attachments.clear()
+        self._cgroup_flags.clear()
+        super().close_links()
+
+    def _pin_attachments(self) -> List[PinnedAttachment]:
+        attachments = super()._pin_attachments()
+        for cgroup_path, link in self._cgroup_attachments.items():
+            if link:
+                attachments.append(({'kind': 'cgroup', 'path': cgroup_path}, [Lib.bpf_link_fd(link)]))
+            else:
+                # Legacy attachments belong to the cgroup, so there is nothing to pin
+                attachments.append(({'kind': 'cgroup', 'path': cgroup_path, 'flags': self._cgroup_flags[cgroup_path]}, []))
+        return attachments
+
+    def _adopt_attachment(self, record: Dict[str, Any], paths: List[str]):
+        if record['kind'] != 'cgroup':
+            return super()._adopt_attachment(record, paths)
+        if paths:
+            self._cgroup_attachments[record['path']] = open_pinned_link(paths[0])
+        else:
+            self._cgroup_attachments[record['path']] = None
+            self._cgroup_flags[record['path']] = record['flags']
+
+    def _take_over(self, old: CgroupAttachMixin):
+        for cgroup_path, link in old._cgroup_attachments.items():
+            if link and Lib.bpf_link_update(Lib.bpf_link_fd(link), self._prog_fd, None) == 0:
+                self._cgroup_attachments[cgroup_path] = link
+            elif link:
+                self.attach_cgroup(cgroup_path)
+                Lib.bpf_link_destroy(link)
+            else:
+                # Without BPF_F_ALLOW_MULTI, attaching again with the same
+                # flags replaces the old program atomically. With it, the old
+                # program is named explicitly with BPF_F_REPLACE.
+                flags = old._cgroup_flags[cgroup_path]
+                if flags & BPF_F_ALLOW_MULTI:
+                    flags |= BPF_F_REPLACE
+                fd = open_cgroup(cgroup_path)
+                try:
+                    self._prog_attach(fd, flags, old._prog_fd if flags & BPF_F_REPLACE else 0, cgroup_path)
+                finally:
+                    os.close(fd)
+                self._cgroup_attachments[cgroup_path] = None
+                self._cgroup_flags[cgroup_path] = flags & ~BPF_F_REPLACE
+        old._cgroup_attachments.clear()
+        old._cgroup_flags.clear()
+        super()._take_over(old)
 
 @register_prog(BPFProgType.SOCKET_FILTER)
 class ProgSocketFilter(ProgBase):
@@ -156,14 +529,302 @@ class ProgSocketFilter(ProgBase):
 class ProgKprobe(ProgBase):
     def __init__(self, *args, **kwargs):
         super().__init__(*args, **kwargs)
+        # Maps (binary path, offset, pid, retprobe) to uprobe link
+        self._uprobe_links = {}
+        # Maps (binary path, offset, pid, retprobe) to uprobe options, for USDT probes
+        self._uprobe_opts = {}
+        # Maps (kernel function, retprobe) to kprobe link, shared between functions for kprobe-multi links
+        self._kprobe_links = {}
 
-    def invoke(self, data: ct.Structure = None):
+    def attach_uprobe(self, binary: str, symbol: str, pid: int = -1, retprobe: bool = False, offset: int = 0):
+        """
+        Attach the BPF program as a uprobe (or uretprobe if @retprobe is true)
+        on @symbol + @offset in @binary, which may be an executable or shared
+        library given by path or by name (e.g. "ssl" or "libc.so.6"). Restrict
+        the uprobe to process @pid, or trace all processes if @pid is -1.
+        Symbol tables are cached per binary, so repeated attachments to the
+        same binary do not parse it again.
+        """
+        binary_path, func_offset = resolve_symbol(binary, symbol)
+        key = (binary_path, func_offset + offset, pid, retprobe)
+        if key in self._uprobe_links:
+            return
+        link = Lib.attach_uprobe(self._loaded_prog(), retprobe, pid, force_bytes(binary_path), func_offset + offset)
+        if not link:
+            raise Exception(f'Failed to attach BPF program {self._name} to uprobe {binary_path}:{symbol}: {cerr()}')
+        self._uprobe_links[key] = link
+
+    def detach_uprobe(self, binary: str, symbol: str, pid: int = -1, retprobe: bool = False, offset: int = 0):
+        """
+        Detach a uprobe previously attached with the same arguments using
+        attach_uprobe().
+        """
+        binary_path, func_offset = resolve_symbol(binary, symbol)
+        try:
+            link = self._uprobe_links.pop((binary_path, func_offset + offset, pid, retprobe))
+        except KeyError:
+            raise KeyError(f'BPF program {self._name} is not attached to uprobe {binary_path}:{symbol}') from None
+        Lib.bpf_link_destroy(link)
+
+    def attach_usdt(self, binary: str, provider: str, name: str, pid: int = -1, spec_map = None):
+        """
+        Attach the BPF program to every site of USDT probe @provider:@name in
+        @binary, restricted to process @pid unless @pid is -1. Probe
+        semaphores are maintained by the kernel for as long as the probe is
+        attached.
+
+        To read probe arguments with pybpf_usdt_arg(), the BPF program must
+        define PYBPF_USDT before including pybpf.bpf.h, and @spec_map must be
+        its pybpf_usdt_specs map (e.g. skel.maps.pybpf_usdt_specs).
+        """
+        probes = usdt_probes(binary, provider, name)
+        if not probes:
+            raise KeyError(f'No USDT probe {provider}:{name} in {binary}')
+        for probe in probes:
+            key = (probe.path, probe.offset, pid, False)
+            if key in self._uprobe_links:
+                continue
+            opts = BpfUprobeOpts(sz=ct.sizeof(BpfUprobeOpts), ref_ctr_offset=probe.semaphore_offset)
+            if spec_map is not None:
+                opts.bpf_cookie = usdt_spec_id(spec_map, probe.spec())
+            link = Lib.attach_uprobe_opts(self._loaded_prog(), pid, force_bytes(probe.path), probe.offset, ct.byref(opts))
+            if not link:
+                raise Exception(f'Failed to attach BPF program {self._name} to USDT probe {provider}:{name} in {probe.path}: {cerr()}')
+            self._uprobe_links[key] = link
+            self._uprobe_opts[key] = opts
+
+    def detach_usdt(self, binary: str, provider: str, name: str, pid: int = -1):
+        """
+        Detach the BPF program from USDT probe @provider:@name in @binary.
+        """
+        for probe in usdt_probes(binary, provider, name):
+            key = (probe.path, probe.offset, pid, False)
+            self._uprobe_opts.pop(key, None)
+            link = self._uprobe_links.pop(key, None)
+            if link:
+                Lib.bpf_link_destroy(link)
+
+    def attach_multi(self, targets: Union[str, Iterable[str]], retprobe: bool = False) -> Dict[str, Exception]:
+        """
+        Attach the BPF program as a kprobe (or kretprobe if @retprobe is true)
+        on every kernel function matching @targets, a glob pattern such as
+        "tcp_*" or a list of function names and patterns.
+
+        Programs declared with SEC("kprobe.multi") are attached to all
+        functions at once with a single kprobe-multi link (Linux 5.18+). Other
+        kprobe programs get one link per function, all sharing the same loaded
+        program, so nothing is reloaded or verified again either way. As the
+        kernel rejects a kprobe-multi link if any one function cannot be
+        probed, a failed batch is split up until the failing functions are
+        found, and the rest are still attached.
+
+        Returns a dict mapping each function that could not be attached to the
+        reason why.
+        """
+        funcs = [f for f in match_kernel_functions(targets) if (f, retprobe) not in self._kprobe_links]
+        if not funcs:
+            return {}
+
+        failures = {}
+        if Lib.bpf_program_expected_attach_type(self._prog) == BPF_TRACE_KPROBE_MULTI:
+            self._attach_kprobe_multi(funcs, retprobe, failures)
+            return failures
+
+        for func in funcs:
+            link = Lib.bpf_program_attach_kprobe(self._loaded_prog(), retprobe, force_bytes(func))
+            if not link:
+                failures[func] = Exception(f'Failed to attach BPF program {self._name} to kprobe {func}: {cerr()}')
+                continue
+            self._kprobe_links[(func, retprobe)] = link
+        return failures
+
+    def _attach_kprobe_multi(self, funcs: List[str], retprobe: bool, failures: Dict[str, Exception]):
+        # The kernel rejects the whole link if any function cannot be probed,
+        # so split a failed batch in half until the culprits are isolated
+        syms = (ct.c_char_p * len(funcs))(*map(force_bytes, funcs))
+        opts = BpfKprobeMultiOpts(sz=ct.sizeof(BpfKprobeMultiOpts), syms=syms, cnt=len(funcs), retprobe=retprobe)
+        link = Lib.bpf_program_attach_kprobe_multi_opts(self._loaded_prog(), None, ct.byref(opts))
+        if link:
+            for func in funcs:
+                self._kprobe_links[(func, retprobe)] = link
+        elif len(funcs) == 1:
+            failures[funcs[0]] = Exception(f'Failed to attach BPF program {self._name} to kprobe {funcs[0]}: {cerr()}')
+        else:
+            half = len(funcs) // 2
+            self._attach_kprobe_multi(funcs[:half], retprobe, failures)
+            self._attach_kprobe_multi(funcs[half:], retprobe, failures)
+
+    def detach_multi(self):
+        """
+        Detach the BPF program from every kprobe attached with attach_multi().
+        """
+        for link in set(self._kprobe_links.values()):
+            Lib.bpf_link_destroy(link)
+        self._kprobe_links.clear()
+
+    def detach_all(self):
+        self.close_links()
+
+    def close_links(self):
+        for link in self._uprobe_links.values():
+            Lib.bpf_link_destroy(link)
+        self._uprobe_links.clear()
+        self._uprobe_opts.clear()
+        self.detach_multi()
+        super().close_links()
+
+    def _pin_attachments(self) -> List[PinnedAttachment]:
+        attachments = super()._pin_attachments()
+        for key, link in self._uprobe_links.items():
+            record = {'kind': 'uprobe', 'key': list(key)}
+            opts = self._uprobe_opts.get(key)
+            if opts is not None:
+                record.update(ref_ctr_offset=opts.ref_ctr_offset, bpf_cookie=opts.bpf_cookie)
+            attachments.append((record, [Lib.bpf_link_fd(link)]))
+        # A kprobe-multi link covers many functions, so group them by link
+        funcs = {} # type: Dict[int, Tuple[ct.c_void_p, List[str], bool]]
+        for (func, retprobe), link in self._kprobe_links.items():
+            funcs.setdefault(link, (link, [], retprobe))[1].append(func)
+        for link, link_funcs, retprobe in funcs.values():
+            attachments.append(({'kind': 'kprobe', 'funcs': link_funcs, 'retprobe': retprobe}, [Lib.bpf_link_fd(link)]))
+        return attachments
+
+    def _adopt_attachment(self, record: Dict[str, Any], paths: List[str]):
+        if record['kind'] == 'uprobe':
+            key = tuple(record['key'])
+            self._uprobe_links[key] = open_pinned_link(paths[0])
+            if 'ref_ctr_offset' in record:
+                self._uprobe_opts[key] = BpfUprobeOpts(sz=ct.sizeof(BpfUprobeOpts),
+                        ref_ctr_offset=record['ref_ctr_offset'], bpf_cookie=record['bpf_cookie'])
+        elif record['kind'] == 'kprobe':
+            link = open_pinned_link(paths[0])
+            for func in record['funcs']:
+                self._kprobe_links[(func, record['retprobe'])] = link
+        else:
+            super()._adopt_attachment(record, paths)
+
+    def _take_over(self, old: ProgKprobe):
+        # Perf event based links cannot be updated, so attach first, then detach
+        for key, link in list(old._uprobe_links.items()):
+            binary_path, offset, pid, retprobe = key
+            opts = old._uprobe_opts.get(key)
+            if opts is not None:
+                new_link = Lib.attach_uprobe_opts(self._loaded_prog(), pid, force_bytes(binary_path), offset, ct.byref(opts))
+            else:
+                new_link = Lib.attach_uprobe(self._loaded_prog(), retprobe, pid, force_bytes(binary_path), offset)
+            if not new_link:
+                raise Exception(f'Failed to attach BPF program {self._name} to uprobe {binary_path}:{offset:#x}: {cerr()}')
+            self._uprobe_links[key] = new_link
+            if opts is not None:
+                self._uprobe_opts[key] = opts
+            Lib.bpf_link_destroy(link)
+        old._uprobe_links.clear()
+        old._uprobe_opts.clear()
+        for retprobe in (False, True):
+            funcs = [func for func, ret in old._kprobe_links if ret == retprobe]
+            if funcs:
+                self.attach_multi(funcs, retprobe)
+        old.detach_multi()
+        super()._take_over(old)
+
+    def _test_run(self, data: Optional[ct.Structure], repeat: int):
         raise NotImplementedError(f'{self.__class__.__name__} programs cannot yet be invoked with bpf_prog_test_run.')
 
 @register_prog(BPFProgType.SCHED_CLS)
 class ProgSchedCls(ProgBase):
     def __init__(self, *args, **kwargs):
         super().__init__(*args, **kwargs)
+        self._tc_attachments = set()
+
+    def _tc_hook(self, ifname: str, direction: str) -> BpfTcHook:
+        try:
+            attach_point = TC_ATTACH_POINTS[direction]
+        except KeyError:
+            raise ValueError(f'TC direction must be one of {list(TC_ATTACH_POINTS)}, not "{direction}"') from None
+        return BpfTcHook(sz=ct.sizeof(BpfTcHook), ifindex=ifindex(ifname), attach_point=attach_point)
+
+    def attach_tc(self, *ifnames: str, direction: str = 'ingress', priority: int = 1, handle: int = 1):
+        """
+        Attach the TC program in direct-action mode to the @direction ('ingress'
+        or 'egress') clsact hook of interfaces with names @ifnames, creating the
+        clsact qdisc if necessary. Attachment talks to the kernel over netlink
+        directly, so it is cheap to repeat across many interfaces.
+        """
+        for ifname in ifnames:
+            hook = self._tc_hook(ifname, direction)
+            retval = Lib.bpf_tc_hook_create(ct.byref(hook))
+            if retval < 0 and retval != -errno.EEXIST:
+                raise Exception(f'Failed to create clsact qdisc on interface "{ifname}" ({hook.ifindex}): {cerr(retval)}')
+            hook_created = retval == 0
+            opts = BpfTcOpts(sz=ct.sizeof(BpfTcOpts), prog_fd=self._prog_fd, handle=handle, priority=priority)
+            retval = Lib.bpf_tc_attach(ct.byref(hook), ct.byref(opts))
+            if retval < 0:
+                # Nothing else can be using a qdisc we just created
+                if hook_created:
+                    self.destroy_tc_hook(ifname)
+                raise Exception(f'Failed to attach TC program {self._name} to interface "{ifname}" ({hook.ifindex}): {cerr(retval)}')
+            self._tc_attachments.add((ifname, direction, opts.priority, opts.handle))
+
+    def detach_tc(self, *ifnames: str, direction: str = 'ingress', priority: int = 1, handle: int = 1):
+        """
+        Detach the TC program from the @direction clsact hook of interfaces with
+        names @ifnames. This is the inverse of attach_tc(), except that the
+        clsact qdisc is left in place, since other programs or tc users may
+        still have filters on it. Use destroy_tc_hook() to remove it.
+        """
+        for ifname in ifnames:
+            hook = self._tc_hook(ifname, direction)
+            opts = BpfTcOpts(sz=ct.sizeof(BpfTcOpts), handle=handle, priority=priority)
+            retval = Lib.bpf_tc_detach(ct.byref(hook), ct.byref(opts))
+            if retval < 0:
+                raise Exception(f'Failed to detach TC program {self._name} from interface "{ifname}" ({hook.ifindex}): {cerr(retval)}')
+            self._tc_attachments.discard((ifname, direction, priority, handle))
+
+    def destroy_tc_hook(self, *ifnames: str):
+        """
+        Destroy the clsact qdisc on interfaces with names @ifnames, if there is
+        one. This removes every filter on it, including those of other programs
+        and tc users, so only call it when nothing else shares the interface.
+        """
+        for ifname in ifnames:
+            # Both attach points together name the clsact qdisc itself
+            hook = BpfTcHook(sz=ct.sizeof(BpfTcHook), ifindex=ifindex(ifname),
+                    attach_point=TC_ATTACH_POINTS['ingress'] | TC_ATTACH_POINTS['egress'])
+            retval = Lib.bpf_tc_hook_destroy(ct.byref(hook))
+            if retval < 0 and retval != -errno.ENOENT:
+                raise Exception(f'Failed to destroy clsact qdisc on interface "{ifname}" ({hook.ifindex}): {cerr(retval)}')
+            self._tc_attachments = {a for a in self._tc_attachments if a[0] != ifname}
+
+    def detach_all(self):
+        for ifname, direction, priority, handle in list(self._tc_attachments):
+            self.detach_tc(ifname, direction=direction, priority=priority, handle=handle)
+        super().detach_all()
+
+    def _pin_attachments(self) -> List[PinnedAttachment]:
+        # TC filters hold the program themselves, so there is nothing to pin
+        attachments = super()._pin_attachments()
+        for ifname, direction, priority, handle in self._tc_attachments:
+            attachments.append(({'kind': 'tc', 'ifname': ifname, 'direction': direction, 'priority': priority,
+                    'handle': handle}, []))
+        return attachments
+
+    def _adopt_attachment(self, record: Dict[str, Any], paths: List[str]):
+        if record['kind'] != 'tc':
+            return super()._adopt_attachment(record, paths)
+        self._tc_attachments.add((record['ifname'], record['direction'], record['priority'], record['handle']))
+
+    def _take_over(self, old: ProgSchedCls):
+        # Replacing the filter at the same handle and priority is atomic
+        for attachment in old._tc_attachments:
+            ifname, direction, priority, handle = attachment
+            hook = self._tc_hook(ifname, direction)
+            opts = BpfTcOpts(sz=ct.sizeof(BpfTcOpts), prog_fd=self._prog_fd, flags=BPF_TC_F_REPLACE, handle=handle, priority=priority)
+            retval = Lib.bpf_tc_attach(ct.byref(hook), ct.byref(opts))
+            if retval < 0:
+                raise Exception(f'Failed to replace TC program {self._name} on interface "{ifname}" ({hook.ifindex}): {cerr(retval)}')
+            self._tc_attachments.add(attachment)
+        old._tc_attachments.clear()
+        super()._take_over(old)
 
 @register_prog(BPFProgType.SCHED_ACT)
 class ProgSchedAct(ProgBase):
@@ -175,13 +836,15 @@ class ProgTracepoint(ProgBase):
     def __init__(self, *args, **kwargs):
         super().__init__(*args, **kwargs)
 
-    def invoke(self, data: ct.Structure = None):
+    def _test_run(self, data: Optional[ct.Structure], repeat: int):
         raise NotImplementedError(f'{self.__class__.__name__} programs cannot yet be invoked with bpf_prog_test_run.')
 
 @register_prog(BPFProgType.XDP)
 class ProgXdp(ProgBase):
     def __init__(self, *args, **kwargs):
         super().__init__(*args, **kwargs)
+        # Maps interface index to name for every interface this program is attached to
+        self._xdp_ifindexes = {} # type: Dict[int, str]
 
     def attach_xdp(self, *ifnames: str):
         """
@@ -198,8 +861,9 @@ class ProgXdp(ProgBase):
             except IndexError:
                 raise KeyError(f'No such interface "{ifname}"') from None
             retval = Lib.bpf_set_link_xdp_fd(ifindex, self._prog_fd, 0)
-        if retval < 0:
-            raise Exception(f'Failed to attach XDP program {self._name} to interface "{ifname}" ({ifindex}): {cerr(retval)}')
+            if retval < 0:
+                raise Exception(f'Failed to attach XDP program {self._name} to interface "{ifname}" ({ifindex}): {cerr(retval)}')
+            self._xdp_ifindexes[ifindex] = ifname
 
     def remove_xdp(self, *ifnames: str):
         """
@@ -216,8 +880,36 @@ class ProgXdp(ProgBase):
             except IndexError:
                 raise KeyError(f'No such interface "{ifname}"') from None
             retval = Lib.bpf_set_link_xdp_fd(ifindex, -1, 0)
-        if retval < 0:
-            raise Exception(f'Failed to remove XDP program {self._name} to interface "{ifname}" ({ifindex}): {cerr(retval)}')
+            if retval < 0:
+                raise Exception(f'Failed to remove XDP program {self._name} to interface "{ifname}" ({ifindex}): {cerr(retval)}')
+            self._xdp_ifindexes.pop(ifindex, None)
+
+    def detach_all(self):
+        if self._xdp_ifindexes:
+            self.remove_xdp(*self._xdp_ifindexes.values())
+        super().detach_all()
+
+    def _pin_attachments(self) -> List[PinnedAttachment]:
+        # The interface holds the program itself, so there is nothing to pin
+        attachments = super()._pin_attachments()
+        for ifindex, ifname in self._xdp_ifindexes.items():
+            attachments.append(({'kind': 'xdp', 'ifindex': ifindex, 'ifname': ifname}, []))
+        return attachments
+
+    def _adopt_attachment(self, record: Dict[str, Any], paths: List[str]):
+        if record['kind'] != 'xdp':
+            return super()._adopt_attachment(record, paths)
+        self._xdp_ifindexes[record['ifindex']] = record['ifname']
+
+    def _take_over(self, old: ProgXdp):
+        # Setting a new XDP program over netlink replaces the old one atomically
+        for ifindex, ifname in old._xdp_ifindexes.items():
+            retval = Lib.bpf_set_link_xdp_fd(ifindex, self._prog_fd, 0)
+            if retval < 0:
+                raise Exception(f'Failed to replace XDP program {self._name} on interface "{ifname}" ({ifindex}): {cerr(retval)}')
+            self._xdp_ifindexes[ifindex] = ifname
+        old._xdp_ifindexes.clear()
+        super()._take_over(old)
 
 @register_prog(BPFProgType.PERF_EVENT)
 class ProgPerfEvent(ProgBase):
@@ -225,14 +917,16 @@ class ProgPerfEvent(ProgBase):
         super().__init__(*args, **kwargs)
 
 @register_prog(BPFProgType.CGROUP_SKB)
-class ProgCgroupSkb(ProgBase):
+class ProgCgroupSkb(CgroupAttachMixin, ProgBase):
     def __init__(self, *args, **kwargs):
-        super().__init__(*args, **kwargs)
+        ProgBase.__init__(self, *args, **kwargs)
+        CgroupAttachMixin.__init__(self, *args, **kwargs)
 
 @register_prog(BPFProgType.CGROUP_SOCK)
-class ProgCgroupSock(ProgBase):
+class ProgCgroupSock(CgroupAttachMixin, ProgBase):
     def __init__(self, *args, **kwargs):
-        super().__init__(*args, **kwargs)
+        ProgBase.__init__(self, *args, **kwargs)
+        CgroupAttachMixin.__init__(self, *args, **kwargs)
 
 @register_prog(BPFProgType.LWT_IN)
 class ProgLwtIn(ProgBase):
@@ -250,9 +944,10 @@ class ProgLwtXmit(ProgBase):
         super().__init__(*args, **kwargs)
 
 @register_prog(BPFProgType.SOCK_OPS)
-class ProgSockOps(ProgBase):
+class ProgSockOps(CgroupAttachMixin, ProgBase):
     def __init__(self, *args, **kwargs):
-        super().__init__(*args, **kwargs)
+        ProgBase.__init__(self, *args, **kwargs)
+        CgroupAttachMixin.__init__(self, *args, **kwargs)
 
 @register_prog(BPFProgType.SK_SKB)
 class ProgSkSkb(ProgBase):
@@ -260,9 +955,10 @@ class ProgSkSkb(ProgBase):
         super().__init__(*args, **kwargs)
 
 @register_prog(BPFProgType.CGROUP_DEVICE)
-class ProgCgroupDevice(ProgBase):
+class ProgCgroupDevice(CgroupAttachMixin, ProgBase):
     def __init__(self, *args, **kwargs):
-        super().__init__(*args, **kwargs)
+        ProgBase.__init__(self, *args, **kwargs)
+        CgroupAttachMixin.__init__(self, *args, **kwargs)
 
 @register_prog(BPFProgType.SK_MSG)
 class ProgSkMsg(ProgBase):
@@ -275,9 +971,10 @@ class ProgRawTracepoint(ProgBase):
         super().__init__(*args, **kwargs)
 
 @register_prog(BPFProgType.CGROUP_SOCK_ADDR)
-class ProgCgroupSockAddr(ProgBase):
+class ProgCgroupSockAddr(CgroupAttachMixin, ProgBase):
     def __init__(self, *args, **kwargs):
-        super().__init__(*args, **kwargs)
+        ProgBase.__init__(self, *args, **kwargs)
+        CgroupAttachMixin.__init__(self, *args, **kwargs)
 
 @register_prog(BPFProgType.LWT_SEG6LOCAL)
 class ProgLwtSeg6local(ProgBase):
@@ -300,9 +997,10 @@ class ProgFlowDissector(ProgBase):
         super().__init__(*args, **kwargs)
 
 @register_prog(BPFProgType.CGROUP_SYSCTL)
-class ProgCgroupSysctl(ProgBase):
+class ProgCgroupSysctl(CgroupAttachMixin, ProgBase):
     def __init__(self, *args, **kwargs):
-        super().__init__(*args, **kwargs)
+        ProgBase.__init__(self, *args, **kwargs)
+        CgroupAttachMixin.__init__(self, *args, **kwargs)
 
 @register_prog(BPFProgType.RAW_TRACEPOINT_WRITABLE)
 class ProgRawTracepointWritable(ProgBase):
@@ -310,14 +1008,147 @@ class ProgRawTracepointWritable(ProgBase):
         super().__init__(*args, **kwargs)
 
 @register_prog(BPFProgType.CGROUP_SOCKOPT)
-class ProgCgroupSockopt(ProgBase):
+class ProgCgroupSockopt(CgroupAttachMixin, ProgBase):
     def __init__(self, *args, **kwargs):
-        super().__init__(*args, **kwargs)
+        ProgBase.__init__(self, *args, **kwargs)
+        CgroupAttachMixin.__init__(self, *args, **kwargs)
 
 @register_prog(BPFProgType.TRACING)
 class ProgTracing(ProgBase):
     def __init__(self, *args, **kwargs):
         super().__init__(*args, **kwargs)
+        # Maps kernel function to (prog fd, link fd) of the clone attached to it
+        self._clones = {}
+        # Maps target map fd to the fd of the iterator link created for it by open_iter()
+        self._iter_links = {} # type: Dict[Optional[int], int]
+
+    def attach(self):
+        """
+        Attach the BPF program. Iterator programs are skipped, as they are
+        attached on demand by open_iter().
+        """
+        if Lib.bpf_program_expected_attach_type(self._prog) == BPF_TRACE_ITER:
+            return
+        super().attach()
+
+    def open_iter(self, map_fd: Optional[int] = None) -> int:
+        """
+        Create a new instance of this iterator program (SEC("iter/...")) and
+        return a file descriptor from which its output can be read, in as few
+        read(2) calls as the buffer size allows. bpf_map_elem iterators
+        traverse the map with fd @map_fd. The program stays attached for the
+        next call with the same @map_fd. The link is made from the program's
+        fd, so iterators adopted from pins work too.
+        """
+        link_fd = self._iter_links.get(map_fd)
+        if link_fd is None:
+            opts = BpfLinkCreateOpts(sz=ct.sizeof(BpfLinkCreateOpts))
+            if map_fd is not None:
+                link_info = BpfIterLinkInfo(map_fd=map_fd)
+                opts.iter_info = ct.pointer(link_info)
+                opts.iter_info_len = ct.sizeof(link_info)
+            link_fd = Lib.bpf_link_create(self._prog_fd, 0, BPF_TRACE_ITER, ct.byref(opts))
+            if link_fd < 0:
+                raise Exception(f'Failed to attach iterator {self._name}: {cerr(link_fd)}')
+            self._iter_links[map_fd] = link_fd
+        iter_fd = Lib.bpf_iter_create(link_fd)
+        if iter_fd < 0:
+            raise Exception(f'Failed to create iterator {self._name}: {cerr(iter_fd)}')
+        return iter_fd
+
+    def attach_multi(self, targets: Union[str, Iterable[str]]) -> Dict[str, Exception]:
+        """
+        Attach this fentry/fexit program to every kernel function matching
+        @targets, a glob pattern such as "vfs_*" or a list of function names
+        and patterns.
+
+        The kernel binds a tracing program to a single function when it is
+        loaded, so each function gets a clone built from the program's already
+        relocated instructions. The object file is not reopened or relocated
+        again, and the clones share the skeleton's maps. Programs that call
+        global BPF functions cannot be cloned this way.
+
+        Returns a dict mapping each function that could not be attached to the
+        reason why.
+        """
+        # Only a loaded program's instructions have been relocated
+        prog = self._loaded_prog()
+        attach_type = Lib.bpf_program_expected_attach_type(prog)
+        insns = Lib.bpf_program_insns(prog)
+        insn_cnt = Lib.bpf_program_insn_cnt(prog)
+        if not insns:
+            raise Exception(f'Failed to get instructions for BPF program {self._name}')
+        license = self._license()
+
+        failures = {}
+        for func in match_kernel_functions(targets):
+            if func in self._clones:
+                continue
+            try:
+                self._clones[func] = self._attach_clone(func, attach_type, insns, insn_cnt, license)
+            except Exception as e:
+                failures[func] = e
+        return failures
+
+    def _license(self) -> bytes:
+        """
+        A license for clones of this program that the kernel treats the same
+        way as the license of its BPF object. The kernel only records whether
+        a program's license is GPL-compatible, which decides the helpers it
+        may call.
+        """
+        return b'GPL' if self.prog_info().gpl_compatible & 1 else b'Proprietary'
+
+    def _attach_clone(self, func: str, attach_type: int, insns: ct.c_void_p, insn_cnt: int, license: bytes):
+        btf_id = Lib.find_vmlinux_btf_id(force_bytes(func), attach_type)
+        if btf_id < 0:
+            raise KeyError(f'Unable to find kernel function {func} in vmlinux BTF: {cerr(btf_id)}')
+        opts = BpfProgLoadOpts(sz=ct.sizeof(BpfProgLoadOpts), expected_attach_type=attach_type, attach_btf_id=btf_id)
+        prog_fd = Lib.bpf_prog_load(BPFProgType.TRACING, force_bytes(self._name[:15]), license, insns, insn_cnt, ct.byref(opts))
+        if prog_fd < 0:
+            raise Exception(f'Failed to load BPF program {self._name} for {func}: {cerr(prog_fd)}')
+        link_fd = Lib.bpf_raw_tracepoint_open(None, prog_fd)
+        if link_fd < 0:
+            os.close(prog_fd)
+            raise Exception(f'Failed to attach BPF program {self._name} to {func}: {cerr(link_fd)}')
+        return prog_fd, link_fd
+
+    def detach_multi(self):
+        """
+        Detach and unload every clone attached with attach_multi().
+        """
+        for prog_fd, link_fd in self._clones.values():
+            os.close(link_fd)
+            os.close(prog_fd)
+        self._clones.clear()
+
+    def detach_all(self):
+        self.close_links()
+
+    def close_links(self):
+        self.detach_multi()
+        for link_fd in self._iter_links.values():
+            os.close(link_fd)
+        self._iter_links.clear()
+        super().close_links()
+
+    def _pin_attachments(self) -> List[PinnedAttachment]:
+        # Iterator links are not pinned, as open_iter() recreates them on demand
+        attachments = super()._pin_attachments()
+        for func, (prog_fd, link_fd) in self._clones.items():
+            attachments.append(({'kind': 'clone', 'func': func}, [prog_fd, link_fd]))
+        return attachments
+
+    def _adopt_attachment(self, record: Dict[str, Any], paths: List[str]):
+        if record['kind'] != 'clone':
+            return super()._adopt_attachment(record, paths)
+        self._clones[record['func']] = (open_pinned_fd(paths[0]), open_pinned_fd(paths[1]))
+
+    def _take_over(self, old: ProgTracing):
+        if old._clones:
+            self.attach_multi(list(old._clones))
+            old.detach_multi()
+        super()._take_over(old)
 
 @register_prog(BPFProgType.STRUCT_OPS)
 class ProgStructOps(ProgBase):
@@ -328,6 +1159,50 @@ class ProgStructOps(ProgBase):
 class ProgExt(ProgBase):
     def __init__(self, *args, **kwargs):
         super().__init__(*args, **kwargs)
+        # (target prog fd, function name) set by attach_freplace(), or with no
+        # function name for a target set before the program was loaded
+        self._freplace_target = None # type: Optional[Tuple[int, Optional[str]]]
+
+    def attach_freplace(self, target: ProgBase, func_name: str):
+        """
+        Replace global function @func_name in the loaded BPF program @target
+        with this program. The function's signature in @target must match this
+        program's. This is usually done for you by hot_swap() on the skeleton,
+        but can be used to plug an extension into a program owned by a
+        different skeleton.
+        """
+        if self._link:
+            return
+        self._link = Lib.bpf_program_attach_freplace(self._loaded_prog(), target._prog_fd, force_bytes(func_name))
+        if not self._link:
+            raise Exception(f'Failed to attach BPF program {self._name} to {target._name}:{func_name}: {cerr()}')
+        self._freplace_target = (target._prog_fd, func_name)
+
+    def _take_over(self, old: ProgExt):
+        # A function can only be replaced by one extension at a time, so the
+        # old extension has to go before the new one can attach
+        if not old._link:
+            return
+        Lib.bpf_link_destroy(old._link)
+        old._link = None
+        # A target given to hot_swap() was fixed when this program was loaded
+        target = self._freplace_target or old._freplace_target
+        try:
+            self._attach_to(target)
+        except Exception:
+            # Put the old extension back, so the function stays replaced
+            old._attach_to(old._freplace_target)
+            raise
+        self._freplace_target = target
+
+    def _attach_to(self, target: Optional[Tuple[int, Optional[str]]]):
+        if target and target[1]:
+            target_fd, func_name = target
+            self._link = Lib.bpf_program_attach_freplace(self._loaded_prog(), target_fd, force_bytes(func_name))
+            if not self._link:
+                raise Exception(f'Failed to attach BPF program {self._name} to {func_name}: {cerr()}')
+        else:
+            self.attach()
 
 @register_prog(BPFProgType.LSM)
 class ProgLsm(ProgBase):
@@ -0,0 +1,139 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+"""
+
+import ctypes as ct
+from abc import ABC
+from typing import Mapping, Tuple, Type
+
+# These must match the config structs in pybpf.bpf.h
+
+class SamplerConfig(ct.Structure):
+    _fields_ = [
+            ('rate', ct.c_uint64),
+            ]
+
+class RateLimitConfig(ct.Structure):
+    _fields_ = [
+            ('interval_ns', ct.c_uint64),
+            ('burst', ct.c_uint64),
+            ]
+
+class BudgetConfig(ct.Structure):
+    _fields_ = [
+            ('window_ns', ct.c_uint64),
+            ('limit', ct.c_uint64),
+            ]
+
+NSEC_PER_SEC = 1000000000
+
+class FilterBase(ABC):
+    """
+    A base class for the runtime knobs of the event filters declared with
+    BPF_SAMPLER(), BPF_RATE_LIMITER() and BPF_BUDGET() in pybpf.bpf.h, given
+    the skeleton's @maps and the filter's @name.
+    """
+    ConfigType = None # type: Type[ct.Structure]
+
+    def __init__(self, maps: Mapping, name: str):
+        self.name = name
+        self._config = maps[f'{name}__config']
+        self._config.register_value_type(self.ConfigType)
+        self._stats = maps[f'{name}__stats']
+
+    def config(self) -> ct.Structure:
+        """
+        Return the current config. Fields left at zero use the defaults from
+        the filter's declaration.
+        """
+        return self._config[0]
+
+    def _update(self, **fields):
+        config = self._config[0]
+        for field, value in fields.items():
+            setattr(config, field, value)
+        self._config[0] = config
+
+    def reset(self):
+        """
+        Go back to the defaults from the filter's declaration.
+        """
+        self._config[0] = self.ConfigType()
+
+    def stats(self) -> Tuple[int, int]:
+        """
+        Return the number of events kept and dropped so far, over all cpus.
+        """
+        kept, dropped = self._stats.read_counters()
+        return kept, dropped
+
+class Sampler(FilterBase):
+    """
+    A sampler declared with BPF_SAMPLER(), used with bpf_sample().
+    """
+    ConfigType = SamplerConfig
+
+    def set_rate(self, rate: int):
+        """
+        Keep one in @rate events. A @rate of 1 keeps every event.
+        """
+        if rate < 1:
+            raise ValueError('Sampling rate must be at least 1')
+        self._update(rate=rate)
+
+class RateLimiter(FilterBase):
+    """
+    A per-key rate limiter declared with BPF_RATE_LIMITER(), used with
+    bpf_rate_limit().
+    """
+    ConfigType = RateLimitConfig
+
+    def __init__(self, maps: Mapping, name: str):
+        super().__init__(maps, name)
+        self._keys = maps[name]
+
+    def set_rate(self, rate: float, burst: int = 1):
+        """
+        Let through @rate events per second for each key, in bursts of up to
+        @burst events.
+        """
+        if rate <= 0 or burst < 1:
+            raise ValueError('Rate must be positive and burst at least 1')
+        self._update(interval_ns=max(1, int(NSEC_PER_SEC / rate)), burst=burst)
+
+    def forget(self):
+        """
+        Forget the state of every key, giving each one a full burst again.
+        """
+        self._keys.clear()
+
+class Budget(FilterBase):
+    """
+    A per-cpu budget declared with BPF_BUDGET(), used with
+    bpf_budget_consume().
+    """
+    ConfigType = BudgetConfig
+
+    def set_limit(self, limit: int, window: float = 1.0):
+        """
+        Let each cpu spend @limit units every @window seconds.
+        """
+        if limit < 1 or window <= 0:
+            raise ValueError('Limit must be at least 1 and window positive')
+        self._update(limit=limit, window_ns=max(1, int(window * NSEC_PER_SEC)))
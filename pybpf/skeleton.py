@@ -21,14 +21,22 @@
 """
 
 import os
+import json
+import zlib
+import time
+import base64
+import shutil
 import logging
 import ctypes as ct
 from textwrap import dedent
+from typing import Optional, Tuple
 
 from pybpf.utils import drop_privileges, strip_full_extension, to_camel, force_bytes, cerr, FILESYSTEMENCODING
-from pybpf.programs import create_prog
-from pybpf.maps import create_map
-from pybpf.lib import Lib
+from pybpf.programs import create_prog, BPFProgType
+from pybpf.maps import create_map, MapBase, ProgArray, Ringbuf, BPFMapType
+from pybpf.lib import Lib, BpfObjectOpenOpts
+from pybpf.timing import record_span
+from pybpf.btf import skeleton_types, SkeletonTypes
 
 logger = logging.getLogger(__name__)
 
@@ -39,6 +47,33 @@ def open_bpf_object(bpf_obj_path: str) -> ct.c_void_p:
         raise Exception(f'Failed to open BPF object: {cerr()}')
     return res
 
+def open_bpf_object_mem(data: bytes, name: str) -> ct.c_void_p:
+    """
+    Open a BPF object from the ELF image @data, naming it @name as if it had
+    been opened from a file called @name.bpf.o. @data must stay alive until
+    the object is loaded.
+    """
+    opts = BpfObjectOpenOpts(sz=ct.sizeof(BpfObjectOpenOpts), object_name=force_bytes(name))
+    res = Lib.bpf_object_open_mem(data, len(data), ct.byref(opts))
+    if not res:
+        raise Exception(f'Failed to open BPF object {name}: {cerr()}')
+    return res
+
+EMBED_MODES = ('raw', 'zlib')
+
+def embed_bpf_object(bpf_obj_path: str, embed: str) -> str:
+    """
+    Read the BPF object at @bpf_obj_path and return a Python expression that
+    evaluates to its bytes, compressed with zlib if @embed is 'zlib'.
+    """
+    if embed not in EMBED_MODES:
+        raise ValueError(f'Unknown embed mode {embed}, expected one of {EMBED_MODES}')
+    with open(bpf_obj_path, 'rb') as f:
+        data = f.read()
+    if embed == 'zlib':
+        return f"zlib.decompress(b64decode(b'{base64.b64encode(zlib.compress(data, 9)).decode()}'))"
+    return f"b64decode(b'{base64.b64encode(data).decode()}')"
+
 def load_bpf_object(bpf_obj: ct.c_void_p):
     res = Lib.bpf_object_load(bpf_obj)
     if res < 0:
@@ -50,48 +85,481 @@ def close_bpf_object(bpf_obj: ct.c_void_p):
         return
     Lib.bpf_object_close(bpf_obj)
 
-def generate_progs(bpf_obj: ct.c_void_p):
+def generate_progs(bpf_obj: ct.c_void_p, report = None):
     progs = {}
     for prog in Lib.obj_programs(bpf_obj):
         if not prog:
             continue
         prog_fd = Lib.bpf_program_fd(prog)
+        # Programs with autoload disabled are never loaded
+        if prog_fd < 0:
+            continue
         prog_name = Lib.bpf_program_name(prog).decode(FILESYSTEMENCODING)
-        prog_type = Lib.bpf_program_type(prog)
-        progs[prog_name] = create_prog(prog, prog_name, prog_type, prog_fd)
+        with record_span(report, prog_name, 'prog'):
+            prog_type = Lib.bpf_program_type(prog)
+            progs[prog_name] = create_prog(prog, prog_name, prog_type, prog_fd)
     return progs
 
-def generate_maps(skel, bpf_obj: ct.c_void_p):
+def generate_maps(skel, bpf_obj: ct.c_void_p, report = None):
     maps = {}
     for _map in Lib.obj_maps(bpf_obj):
         if not _map:
             continue
-        map_fd = Lib.bpf_map_fd(_map)
         map_name = Lib.bpf_map_name(_map).decode(FILESYSTEMENCODING)
-        map_entries = Lib.bpf_map_max_entries(_map)
-        map_ksize = Lib.bpf_map_key_size(_map)
-        map_vsize = Lib.bpf_map_value_size(_map)
-        map_type = Lib.bpf_map_type(_map)
-        maps[map_name] = create_map(skel, _map, map_fd, map_type, map_ksize, map_vsize, map_entries)
+        with record_span(report, map_name, 'map'):
+            map_fd = Lib.bpf_map_fd(_map)
+            map_entries = Lib.bpf_map_max_entries(_map)
+            map_ksize = Lib.bpf_map_key_size(_map)
+            map_vsize = Lib.bpf_map_value_size(_map)
+            map_type = Lib.bpf_map_type(_map)
+            maps[map_name] = create_map(skel, _map, map_fd, map_type, map_ksize, map_vsize, map_entries)
+    link_occupancy_maps(maps)
     return maps
 
-def generate_skeleton_class(bpf_obj_path: str, bpf_obj_name: str, bpf_class_name: str):
+def link_occupancy_maps(maps):
+    """
+    Attach each per-cpu counter NAME__occupancy declared with
+    BPF_MAP_OCCUPANCY() in pybpf.bpf.h to map NAME in @maps.
+    """
+    for map_name, _map in maps.items():
+        name, sep, suffix = map_name.rpartition('__')
+        if not sep or suffix != 'occupancy' or name not in maps:
+            continue
+        _map.register_value_type(ct.c_int64)
+        maps[name]._occupancy = _map
+
+def register_map_types(maps, map_types, datasec_types):
+    """
+    Register the key and value types generated from BTF for each map in @maps.
+    @map_types maps map names to (key type, value type), and @datasec_types maps
+    global data section names to value types. Maps that fix their own types,
+    or whose sizes do not match, are left alone.
+    """
+    for map_name, _map in maps.items():
+        key_type, value_type = map_types.get(map_name, (None, None))
+        # Internal maps are named <object name>.<section>
+        for sec, sec_type in datasec_types.items():
+            if map_name.endswith(sec) and map_name not in map_types:
+                value_type = sec_type
+        for register, _type in ((getattr(_map, 'register_key_type', None), key_type), (getattr(_map, 'register_value_type', None), value_type)):
+            if register is None or _type is None:
+                continue
+            try:
+                register(_type)
+            except NotImplementedError:
+                pass
+            except Exception as e:
+                logger.debug(f'Not registering BTF type {_type.__name__} for map {map_name}: {e}')
+
+def set_autoload(bpf_obj: ct.c_void_p, prog_name: str, autoload: bool):
+    """
+    Enable or disable loading of the program @prog_name in the opened, but not
+    yet loaded, @bpf_obj. Programs that are not loaded cost no verifier time.
+    """
+    prog = Lib.find_program_by_name(bpf_obj, force_bytes(prog_name))
+    if not prog:
+        raise KeyError(f'No such BPF program {prog_name}')
+    retval = Lib.bpf_program_set_autoload(prog, autoload)
+    if retval < 0:
+        raise Exception(f'Failed to set autoload for BPF program {prog_name}: {cerr(retval)}')
+
+def set_attach_target(bpf_obj: ct.c_void_p, prog_name: str, target_fd: int, func_name: Optional[str] = None):
+    """
+    Point the program @prog_name in the opened, but not yet loaded, @bpf_obj
+    at the function @func_name of the loaded program with fd @target_fd. If
+    @func_name is None, the function named in the program's section is used.
+    """
+    prog = Lib.find_program_by_name(bpf_obj, force_bytes(prog_name))
+    if not prog:
+        raise KeyError(f'No such BPF program {prog_name}')
+    retval = Lib.bpf_program_set_attach_target(prog, target_fd, force_bytes(func_name) if func_name else None)
+    if retval < 0:
+        raise Exception(f'Failed to set attach target for {prog_name}: {cerr(retval)}')
+
+def select_progs(bpf_obj: ct.c_void_p, prog_names):
+    """
+    Disable loading of every program in the opened @bpf_obj that is not named
+    in @prog_names.
+    """
+    all_names = [Lib.bpf_program_name(prog).decode(FILESYSTEMENCODING) for prog in Lib.obj_programs(bpf_obj) if prog]
+    unknown = set(prog_names) - set(all_names)
+    if unknown:
+        raise KeyError(f'No such BPF programs {sorted(unknown)}')
+    for prog_name in all_names:
+        set_autoload(bpf_obj, prog_name, prog_name in prog_names)
+
+def set_log_bufs(bpf_obj: ct.c_void_p, log_level: int, log_size: int):
+    """
+    Give each program in the opened @bpf_obj its own verifier log buffer of
+    @log_size bytes at @log_level. Returns the buffers keyed by program name,
+    which must be kept alive until the object is loaded.
+    """
+    bufs = {}
+    for prog in Lib.obj_programs(bpf_obj):
+        if not prog:
+            continue
+        prog_name = Lib.bpf_program_name(prog).decode(FILESYSTEMENCODING)
+        buf = ct.create_string_buffer(log_size)
+        if Lib.bpf_program_set_log_buf(prog, buf, log_size) < 0 or Lib.bpf_program_set_log_level(prog, log_level) < 0:
+            raise Exception(f'Failed to set verifier log buffer for BPF program {prog_name}: {cerr()}')
+        bufs[prog_name] = buf
+    return bufs
+
+def verifier_logs(log_bufs):
+    """
+    Decode the verifier logs in @log_bufs, skipping empty ones.
+    """
+    logs = {}
+    for prog_name, buf in log_bufs.items():
+        log = buf.value.decode('utf-8', 'replace')
+        if log:
+            logs[prog_name] = log
+    return logs
+
+def load_error(bpf_obj: ct.c_void_p, retval: int, log_bufs) -> Exception:
+    """
+    Build the exception for a failed load of @bpf_obj, including the verifier
+    log of each program that failed to load.
+    """
+    msg = f'Unable to load BPF object: {cerr(retval)}'
+    failed = {Lib.bpf_program_name(prog).decode(FILESYSTEMENCODING) for prog in Lib.obj_programs(bpf_obj)
+            if prog and Lib.bpf_program_fd(prog) < 0}
+    for prog_name, log in verifier_logs(log_bufs).items():
+        if prog_name in failed:
+            msg += f'\n\nVerifier log for {prog_name}:\n{log}'
+    return Exception(msg)
+
+def estimate_verification_times(progs, load_start_ns: int, load_end_ns: int, report = None):
+    """
+    Estimate how long each program in @progs took to load and verify, given
+    the CLOCK_BOOTTIME bounds of bpf_object__load(). The kernel records when
+    each program's load began, and libbpf loads programs one at a time, so each
+    program's share is the time until the next program's load began. Each
+    estimate is also added to @report, if given, under 'verify'.
+    """
+    # Translates CLOCK_BOOTTIME to the perf counter clock used by reports
+    offset = time.perf_counter_ns() - time.clock_gettime_ns(time.CLOCK_BOOTTIME)
+    starts = sorted(((prog.prog_info().load_time, prog) for prog in progs.values()), key=lambda item: item[0])
+    for i, (start, prog) in enumerate(starts):
+        start = max(start, load_start_ns)
+        end = starts[i + 1][0] if i + 1 < len(starts) else load_end_ns
+        prog.verification_time = max(end - start, 0) / 1e9
+        if report is not None:
+            report.record(prog._name, 'verify', start + offset, max(end - start, 0))
+
+def populate_prog_arrays(progs, maps):
+    """
+    Fill each program array in @maps with the programs in @progs that follow the
+    naming convention <map_name>__<index>, so that tail calls are wired up as
+    soon as the BPF object is loaded.
+    """
+    for map_name, _map in maps.items():
+        if isinstance(_map, ProgArray):
+            _map.populate(progs, map_name)
+
+def link_map_iters(progs, maps):
+    """
+    Give each map NAME in @maps the iterator program NAME__iter in @progs,
+    declared with BPF_MAP_ITER() in pybpf.bpf.h, for use by its dump().
+    """
+    for map_name, _map in maps.items():
+        prog = progs.get(f'{map_name}__iter')
+        if prog is not None and isinstance(_map, MapBase):
+            _map._iter_prog = prog
+
+def reuse_maps(bpf_obj: ct.c_void_p, maps):
+    """
+    Make each map in the not yet loaded @bpf_obj reuse the fd of its namesake
+    in @maps, if it has the same type and sizes, so that a new version of a BPF
+    object shares state with the old one. Read-only data is never reused, as
+    its contents are baked in at load time.
+    """
+    for _map in Lib.obj_maps(bpf_obj):
+        if not _map:
+            continue
+        map_name = Lib.bpf_map_name(_map).decode(FILESYSTEMENCODING)
+        old = maps.get(map_name)
+        if old is None or '.rodata' in map_name or '.kconfig' in map_name:
+            continue
+        if (Lib.bpf_map_type(_map), Lib.bpf_map_key_size(_map), Lib.bpf_map_value_size(_map), Lib.bpf_map_max_entries(_map)) != \
+                (Lib.bpf_map_type(old._map), Lib.bpf_map_key_size(old._map), Lib.bpf_map_value_size(old._map), Lib.bpf_map_max_entries(old._map)):
+            logger.warning(f'Map {map_name} has changed shape and will not be reused')
+            continue
+        retval = Lib.bpf_map_reuse_fd(_map, old.map_fd if isinstance(old, Ringbuf) else old._map_fd)
+        if retval < 0:
+            raise Exception(f'Failed to reuse map {map_name}: {cerr(retval)}')
+
+def set_ext_targets(bpf_obj: ct.c_void_p, progs, ext_targets):
+    """
+    Point each freplace (EXT) program in the not yet loaded @bpf_obj at the
+    program it extends: the one named in @ext_targets if any, or otherwise the
+    target of its namesake in @progs.
+    """
+    for prog in Lib.obj_programs(bpf_obj):
+        if not prog or Lib.bpf_program_type(prog) != BPFProgType.EXT:
+            continue
+        prog_name = Lib.bpf_program_name(prog).decode(FILESYSTEMENCODING)
+        if prog_name in ext_targets:
+            target_fd, func_name = ext_targets[prog_name]._prog_fd, None
+        elif prog_name in progs and progs[prog_name]._freplace_target:
+            target_fd, func_name = progs[prog_name]._freplace_target
+        else:
+            continue
+        set_attach_target(bpf_obj, prog_name, target_fd, func_name)
+
+def hot_swap_bpf_object(skel, bpf_obj_path: Optional[str], ext_targets, bpf_obj_data: Optional[bytes] = None, bpf_obj_name: Optional[str] = None):
+    """
+    Open and load the BPF object at @bpf_obj_path, or from the ELF image
+    @bpf_obj_data named @bpf_obj_name if given, sharing maps with @skel, and
+    hand every attachment of @skel's programs over to their namesakes in the
+    new object. Programs of @skel without a namesake are detached. Returns the
+    new object and its programs and maps. If any attachment cannot be handed
+    over, those already handed over are given back to @skel's programs, the
+    new object is closed, and the error is raised.
+    """
+    if bpf_obj_data is not None:
+        bpf_obj = open_bpf_object_mem(bpf_obj_data, bpf_obj_name)
+    else:
+        bpf_obj = open_bpf_object(bpf_obj_path)
+    try:
+        reuse_maps(bpf_obj, skel.maps)
+        set_ext_targets(bpf_obj, skel.progs, ext_targets)
+        load_bpf_object(bpf_obj)
+    except Exception:
+        close_bpf_object(bpf_obj)
+        raise
+    progs = generate_progs(bpf_obj)
+    for prog_name, target in ext_targets.items():
+        if prog_name in progs:
+            progs[prog_name]._freplace_target = (target._prog_fd, None)
+    maps = generate_maps(skel, bpf_obj)
+    # Keep registered types, ringbuf callbacks and USDT spec ids from the old maps
+    for map_name, _map in maps.items():
+        old = skel.maps.get(map_name)
+        if type(old) is not type(_map):
+            continue
+        for attr in ('KeyType', 'ValueType', '_cb', '_usdt_spec_ids'):
+            if hasattr(old, attr):
+                setattr(_map, attr, getattr(old, attr))
+    populate_prog_arrays(progs, maps)
+    link_map_iters(progs, maps)
+    started = []
+    try:
+        for prog_name, prog in progs.items():
+            old = skel.progs.get(prog_name)
+            started.append((prog, old))
+            if old is not None:
+                prog._take_over(old)
+            else:
+                prog.attach()
+    except Exception:
+        # Hand everything back, most recent first, so the old version keeps
+        # running. Programs adopted from pins cannot always be re-attached, in
+        # which case the new program is left attached rather than nothing.
+        for prog, old in reversed(started):
+            try:
+                if old is not None:
+                    old._take_over(prog)
+                prog.detach_all()
+            except Exception as e:
+                logger.warning(f'Failed to roll back hot swap of BPF program {prog._name}, leaving the new version attached: {e}')
+        close_bpf_object(bpf_obj)
+        raise
+    # Whatever the new programs did not take over, such as the attachments of
+    # programs dropped from the new version, goes away with the old object
+    for prog in skel.progs.values():
+        prog.detach_all()
+    return bpf_obj, progs, maps
+
+PIN_ROOT = '/sys/fs/bpf/pybpf'
+
+def pin_name(name: str) -> str:
+    # The BPF filesystem does not allow periods in names, e.g. in prog.bss
+    return name.replace('.', '_')
+
+def pin_fd(fd: int, path: str):
+    if os.path.exists(path):
+        os.unlink(path)
+    retval = Lib.bpf_obj_pin(fd, force_bytes(path))
+    if retval < 0:
+        raise Exception(f'Failed to pin {path}: {cerr(retval)}')
+
+# The BPF filesystem cannot hold regular files, so the record of each
+# program's attachments is stored in an array map of fixed-size chunks
+ATTACHMENTS_PIN = 'attachments'
+ATTACHMENTS_CHUNK_SIZE = 4096
+
+def pin_json(obj, path: str):
+    """
+    Pin @obj, serialized as JSON, at @path in a BPF filesystem.
+    """
+    data = force_bytes(json.dumps(obj))
+    n_chunks = max(1, -(-len(data) // ATTACHMENTS_CHUNK_SIZE))
+    fd = Lib.bpf_map_create(BPFMapType.ARRAY, b'pybpf_json', ct.sizeof(ct.c_uint32), ATTACHMENTS_CHUNK_SIZE, n_chunks, None)
+    if fd < 0:
+        raise Exception(f'Failed to create map for {path}: {cerr(fd)}')
+    try:
+        for i in range(n_chunks):
+            key = ct.c_uint32(i)
+            value = ct.create_string_buffer(data[i * ATTACHMENTS_CHUNK_SIZE:(i + 1) * ATTACHMENTS_CHUNK_SIZE], ATTACHMENTS_CHUNK_SIZE)
+            retval = Lib.bpf_map_update_elem(fd, ct.byref(key), value, 0)
+            if retval < 0:
+                raise Exception(f'Failed to write {path}: {cerr(retval)}')
+        pin_fd(fd, path)
+    finally:
+        os.close(fd)
+
+def load_pinned_json(path: str):
+    """
+    Load the JSON pinned at @path by pin_json().
+    """
+    fd = Lib.bpf_obj_get(force_bytes(path))
+    if fd < 0:
+        raise FileNotFoundError(f'Failed to open {path}: {cerr(fd)}')
+    data = b''
+    try:
+        value = ct.create_string_buffer(ATTACHMENTS_CHUNK_SIZE)
+        key = ct.c_uint32(0)
+        # Lookups past the last chunk of an array map fail
+        while Lib.bpf_map_lookup_elem(fd, ct.byref(key), value) == 0:
+            data += value.raw
+            key.value += 1
+    finally:
+        os.close(fd)
+    return json.loads(data.rstrip(b'\0').decode(FILESYSTEMENCODING))
+
+def pin_bpf_object(progs, maps, pin_dir: str):
+    """
+    Pin every map and program in @maps and @progs under @pin_dir, along with
+    every link the programs hold, such as uprobe, kprobe, cgroup and fentry
+    clone links, and a record of all their attachments. Existing pins are
+    replaced.
+    """
+    for sub in ('maps', 'progs', 'links'):
+        os.makedirs(os.path.join(pin_dir, sub), exist_ok=True)
+    for map_name, _map in maps.items():
+        map_fd = _map.map_fd if isinstance(_map, Ringbuf) else _map._map_fd
+        pin_fd(map_fd, os.path.join(pin_dir, 'maps', pin_name(map_name)))
+    attachments = {}
+    for prog_name, prog in progs.items():
+        pin_fd(prog._prog_fd, os.path.join(pin_dir, 'progs', pin_name(prog_name)))
+        # Start afresh, so that links since destroyed are not adopted later
+        link_dir = os.path.join(pin_dir, 'links', pin_name(prog_name))
+        if os.path.isdir(link_dir):
+            shutil.rmtree(link_dir)
+        elif os.path.exists(link_dir):
+            os.unlink(link_dir)
+        records = []
+        for i, (record, fds) in enumerate(prog._pin_attachments()):
+            os.makedirs(link_dir, exist_ok=True)
+            record['pins'] = [f'{i}_{j}' for j in range(len(fds))]
+            for fd, name in zip(fds, record['pins']):
+                pin_fd(fd, os.path.join(link_dir, name))
+            records.append(record)
+        attachments[prog_name] = records
+    pin_json(attachments, os.path.join(pin_dir, ATTACHMENTS_PIN))
+
+def adopt_pinned_bpf_object(skel, bpf_obj: ct.c_void_p, pin_dir: str):
+    """
+    Build programs and maps for the opened, but not loaded, @bpf_obj from the
+    pins under @pin_dir, instead of loading it again. The object only provides
+    names, types and sizes. The programs take back all of the attachments
+    recorded by pin_bpf_object(), but as libbpf never loads them, they cannot
+    be attached anew. Returns the programs and maps.
+    """
+    if not os.path.isdir(pin_dir):
+        raise FileNotFoundError(f'No pinned BPF object at {pin_dir}')
+    maps = {}
+    for _map in Lib.obj_maps(bpf_obj):
+        if not _map:
+            continue
+        map_name = Lib.bpf_map_name(_map).decode(FILESYSTEMENCODING)
+        path = os.path.join(pin_dir, 'maps', pin_name(map_name))
+        map_fd = Lib.bpf_obj_get(force_bytes(path))
+        if map_fd < 0:
+            raise FileNotFoundError(f'Failed to open pinned map {path}: {cerr(map_fd)}')
+        maps[map_name] = create_map(skel, _map, map_fd, Lib.bpf_map_type(_map), Lib.bpf_map_key_size(_map),
+                Lib.bpf_map_value_size(_map), Lib.bpf_map_max_entries(_map))
+    attachments = load_pinned_json(os.path.join(pin_dir, ATTACHMENTS_PIN))
+    progs = {}
+    for prog in Lib.obj_programs(bpf_obj):
+        if not prog:
+            continue
+        prog_name = Lib.bpf_program_name(prog).decode(FILESYSTEMENCODING)
+        path = os.path.join(pin_dir, 'progs', pin_name(prog_name))
+        if not os.path.exists(path):
+            continue
+        prog_fd = Lib.bpf_obj_get(force_bytes(path))
+        if prog_fd < 0:
+            raise Exception(f'Failed to open pinned program {path}: {cerr(prog_fd)}')
+        progs[prog_name] = create_prog(prog, prog_name, Lib.bpf_program_type(prog), prog_fd)
+        progs[prog_name]._adopted = True
+        link_dir = os.path.join(pin_dir, 'links', pin_name(prog_name))
+        for record in attachments.get(prog_name, []):
+            progs[prog_name]._adopt_attachment(record, [os.path.join(link_dir, name) for name in record['pins']])
+    link_occupancy_maps(maps)
+    return progs, maps
+
+def unpin_bpf_object(pin_dir: str):
+    """
+    Remove the pins under @pin_dir. Programs stay attached only as long as
+    something else holds a reference to them, such as this process.
+    """
+    if os.path.isdir(pin_dir):
+        shutil.rmtree(pin_dir)
+
+def generate_types(bpf_obj_path: str) -> SkeletonTypes:
+    """
+    Generate map key and value types for the skeleton of @bpf_obj_path. A
+    skeleton without them still works, so BTF we cannot handle is not fatal.
+    """
+    try:
+        return skeleton_types(bpf_obj_path, indent='    ')
+    except Exception as e:
+        logger.warning(f'Unable to generate map types from the BTF of {bpf_obj_path}: {e}')
+        return SkeletonTypes('', {}, {}, [])
+
+def generate_skeleton_class(bpf_obj_path: str, bpf_obj_name: str, bpf_class_name: str, embed: Optional[str] = None):
+    types = generate_types(bpf_obj_path)
+    map_types = ', '.join(f"'{name}': ({key}, {value})" for name, (key, value) in types.map_types.items())
+    datasec_types = ', '.join(f"'{name}': {value}" for name, value in types.datasec_types.items())
+    type_names = ', '.join(f"'{name}': {name}" for name in types.classes)
+    bpf_obj_data = embed_bpf_object(bpf_obj_path, embed) if embed else 'None'
+    # libbpf names objects opened from a file after the file name, up to the first period
+    libbpf_obj_name = os.path.basename(bpf_obj_path).split('.')[0]
     SKEL_CLASS = f"""
     from __future__ import annotations
     from collections.abc import Mapping
+    from base64 import b64decode
     import os
+    import zlib
+    import time
+    import ctypes as ct
     import resource
     import atexit
-    from typing import Callable, Type, TypeVar, NamedTuple, Union
+    from typing import Callable, Type, TypeVar, NamedTuple, Union, Dict, Optional, Iterable
 
     from pybpf import Lib
-    from pybpf.skeleton import generate_maps, generate_progs, open_bpf_object, close_bpf_object
+    from pybpf.skeleton import generate_maps, generate_progs, populate_prog_arrays, link_map_iters, open_bpf_object, open_bpf_object_mem, close_bpf_object, hot_swap_bpf_object
+    from pybpf.skeleton import pin_bpf_object, adopt_pinned_bpf_object, unpin_bpf_object, PIN_ROOT
+    from pybpf.skeleton import set_autoload, set_attach_target, select_progs, estimate_verification_times, set_log_bufs, verifier_logs, load_error, register_map_types
+    from pybpf.btf import bitfield
     from pybpf.maps import MapBase, QueueStack, Ringbuf
-    from pybpf.programs import ProgBase
+    from pybpf.programs import ProgBase, BPF_LOG_STATS
+    from pybpf.timing import LoadReport
 
     __all__ = ['{bpf_class_name}Skeleton']
 
     BPF_OBJECT = '{bpf_obj_path}'
+    # The contents of BPF_OBJECT, if it was embedded when this skeleton was generated
+    BPF_OBJECT_DATA = {bpf_obj_data}
+    PIN_DIR = os.path.join(PIN_ROOT, '{bpf_obj_name}')
+
+    # ctypes equivalents of the map key and value types in the BPF object's BTF
+{types.source}
+    MAP_TYPES = {{{map_types}}}
+    DATASEC_TYPES = {{{datasec_types}}}
+    TYPES = {{{type_names}}}
 
     class ImmutableDict(Mapping):
         def __init__(self, _dict):
@@ -143,14 +611,28 @@ def generate_skeleton_class(bpf_obj_path: str, bpf_obj_name: str, bpf_class_name
         def _initialization_function(self):
             pass
 
-        def __init__(self, autoload: bool = True, bump_rlimit: bool = True):
+        def __init__(self, autoload: bool = True, bump_rlimit: bool = True, load_progs: Optional[Iterable[str]] = None, attach_progs: Optional[Iterable[str]] = None, load_report: Optional[LoadReport] = None, log_level: int = BPF_LOG_STATS, log_size: int = 1 << 16):
+            \"\"\"
+            Create the skeleton, loading and attaching the BPF object unless @autoload is false. If @load_progs is given, only the named programs are loaded and verified. If @attach_progs is given, only the named programs are attached by attach_bpf(). Both can be adjusted per program with set_prog_autoload() and set_prog_autoattach(). Timings for each phase are added to @load_report, for example one passed to Bootstrap.bootstrap(), or to a new report otherwise, available as self.load_report. Each program's verifier log is captured at @log_level (0 to disable) into a buffer of @log_size bytes; the default level records only the verifier's statistics and any error. Key and value types generated from the object's BTF are registered on each map when it is loaded, and the generated ctypes classes are available as self.types.
+            \"\"\"
             self._ringbuf_mgr = None
+            self._log_level = log_level
+            self._log_size = log_size
+            self._log_bufs = {{}}
+            self.load_report = load_report if load_report is not None else LoadReport()
+            self._load_progs = None if load_progs is None else set(load_progs)
+            # Maps program name to whether attach_bpf() should attach it
+            self._autoattach = {{name: True for name in attach_progs or ()}}
+            self._autoattach_default = attach_progs is None
+            # Maps freplace (EXT) program name to (target prog fd, function name)
+            self._ext_targets = {{}}
 
             if os.geteuid() != 0:
                 raise OSError('Using eBPF requries root privileges')
 
             self.progs = ProgDict({{}})
             self.maps = MapDict({{}})
+            self.types = ImmutableDict(TYPES)
 
             if bump_rlimit:
                 self._bump_rlimit()
@@ -166,15 +648,21 @@ def generate_skeleton_class(bpf_obj_path: str, bpf_obj_name: str, bpf_class_name
 
         def _autoload(self):
             self.open_bpf()
-            self._initialization_function()
+            with self.load_report.span('init'):
+                self._initialization_function()
             self.load_bpf()
             self.attach_bpf()
 
         def _cleanup(self):
+            # Pinned links stay attached once closed
+            for prog in self.progs.values():
+                prog.close_links()
             if self.bpf_object:
                 close_bpf_object(self.bpf_object)
+                self.bpf_object = None
             if self._ringbuf_mgr:
                 Lib.ring_buffer_free(self._ringbuf_mgr)
+                self._ringbuf_mgr = None
 
         @classmethod
         def register_init_fn(cls, fn: Callable[{bpf_class_name}Skeleton, None]) -> None:
@@ -185,27 +673,131 @@ def generate_skeleton_class(bpf_obj_path: str, bpf_obj_name: str, bpf_class_name
 
         def open_bpf(self):
             \"\"\"
-            Open the BPF object managed by this skeleton.
+            Open the BPF object managed by this skeleton, from memory if it is embedded in the skeleton and from BPF_OBJECT otherwise.
             \"\"\"
-            self.bpf_object = open_bpf_object(BPF_OBJECT)
+            with self.load_report.span('open_bpf'):
+                if BPF_OBJECT_DATA is not None:
+                    self.bpf_object = open_bpf_object_mem(BPF_OBJECT_DATA, '{libbpf_obj_name}')
+                else:
+                    self.bpf_object = open_bpf_object(BPF_OBJECT)
+                if self._load_progs is not None:
+                    select_progs(self.bpf_object, self._load_progs)
+                if self._log_level:
+                    self._log_bufs = set_log_bufs(self.bpf_object, self._log_level, self._log_size)
+
+        def set_prog_autoload(self, prog_name: str, autoload: bool):
+            \"\"\"
+            Choose whether the program @prog_name is loaded by load_bpf(). Must be called after open_bpf() and before load_bpf(), for example from an initialization function.
+            \"\"\"
+            set_autoload(self.bpf_object, prog_name, autoload)
+
+        def set_prog_attach_target(self, prog_name: str, target: ProgBase, func_name: Optional[str] = None):
+            \"\"\"
+            Make the freplace (EXT) program @prog_name extend the loaded program @target, replacing its global function @func_name, or the function named in the program's section by default. EXT programs cannot be loaded without a target. Must be called after open_bpf() and before load_bpf(). The program is then attached by attach_bpf() as usual.
+            \"\"\"
+            set_attach_target(self.bpf_object, prog_name, target._prog_fd, func_name)
+            self._ext_targets[prog_name] = (target._prog_fd, func_name)
+
+        def set_prog_autoattach(self, prog_name: str, autoattach: bool):
+            \"\"\"
+            Choose whether the program @prog_name is attached by attach_bpf().
+            \"\"\"
+            self._autoattach[prog_name] = autoattach
 
         def load_bpf(self):
             \"\"\"
             Load the BPF programs managed by this skeleton.
             \"\"\"
-            res = Lib.bpf_object_load(self.bpf_object)
-            if res < 0:
-                raise Exception('Unable to load BPF object')
-            self.progs = ProgDict(generate_progs(self.bpf_object))
-            self.maps = MapDict(generate_maps(self, self.bpf_object))
+            report = self.load_report
+            with report.span('load_bpf'):
+                with report.span('bpf_object__load'):
+                    load_start_ns = time.clock_gettime_ns(time.CLOCK_BOOTTIME)
+                    res = Lib.bpf_object_load(self.bpf_object)
+                    load_end_ns = time.clock_gettime_ns(time.CLOCK_BOOTTIME)
+                if res < 0:
+                    raise load_error(self.bpf_object, res, self._log_bufs)
+                with report.span('generate_progs'):
+                    self.progs = ProgDict(generate_progs(self.bpf_object, report))
+                for prog_name, target in self._ext_targets.items():
+                    if prog_name in self.progs:
+                        self.progs[prog_name]._freplace_target = target
+                for prog_name, log in verifier_logs(self._log_bufs).items():
+                    if prog_name in self.progs:
+                        self.progs[prog_name].verifier_log = log
+                self._log_bufs = {{}}
+                estimate_verification_times(self.progs, load_start_ns, load_end_ns, report)
+                with report.span('generate_maps'):
+                    self.maps = MapDict(generate_maps(self, self.bpf_object, report))
+                    register_map_types(self.maps, MAP_TYPES, DATASEC_TYPES)
+                with report.span('populate_prog_arrays'):
+                    populate_prog_arrays(self.progs, self.maps)
+                link_map_iters(self.progs, self.maps)
             atexit.register(self._cleanup)
 
         def attach_bpf(self):
             \"\"\"
             Attach the BPF programs managed by this skeleton.
             \"\"\"
-            for prog in self.progs.values():
-                prog.attach()
+            with self.load_report.span('attach_bpf'):
+                for prog_name, prog in self.progs.items():
+                    if self._autoattach.get(prog_name, self._autoattach_default):
+                        with self.load_report.span(prog_name, 'attach'):
+                            prog.attach()
+
+        def verifier_stats(self) -> Dict[str, Dict[str, int]]:
+            \"\"\"
+            Get the verifier's complexity statistics for each loaded program, as returned by ProgBase.verifier_stats().
+            \"\"\"
+            return {{name: prog.verifier_stats() for name, prog in self.progs.items()}}
+
+        def verification_times(self) -> Dict[str, float]:
+            \"\"\"
+            Get the estimated time in seconds that each loaded program took to load and verify, slowest first.
+            \"\"\"
+            times = {{name: prog.verification_time for name, prog in self.progs.items() if prog.verification_time is not None}}
+            return dict(sorted(times.items(), key=lambda item: item[1], reverse=True))
+
+        def hot_swap(self, bpf_obj_path: Optional[str] = None, ext_targets: Optional[Dict[str, ProgBase]] = None):
+            \"\"\"
+            Replace the running BPF programs with those in a new build of the BPF object at @bpf_obj_path (by default, the object this skeleton was generated from, or its embedded copy if there is one), without a gap in coverage. Maps with the same name and shape are shared with the new object by fd, so no state is lost. Each new program takes over the attachments of the old program with the same name, atomically where the kernel allows and attach-before-detach otherwise; freplace (EXT) programs are the exception, as only one extension may replace a function at a time. Programs that are new in this version are attached as usual, and programs missing from it are detached. @ext_targets optionally maps EXT program names in the new object to the programs they extend; otherwise they extend the same program as before. If an attachment cannot be handed over, the swap is rolled back and the old programs keep running.
+            \"\"\"
+            if bpf_obj_path is None and BPF_OBJECT_DATA is not None:
+                bpf_object, progs, maps = hot_swap_bpf_object(self, None, ext_targets or {{}}, BPF_OBJECT_DATA, '{libbpf_obj_name}')
+            else:
+                bpf_object, progs, maps = hot_swap_bpf_object(self, bpf_obj_path or BPF_OBJECT, ext_targets or {{}})
+            close_bpf_object(self.bpf_object)
+            self.bpf_object = bpf_object
+            self.progs = ProgDict(progs)
+            self.maps = MapDict(maps)
+
+        def pin_bpf(self, pin_dir: str = PIN_DIR):
+            \"\"\"
+            Pin the maps, programs and links managed by this skeleton under @pin_dir in a BPF filesystem, so that they outlive this process. This covers the links of every attachment, including those made with attach_cgroup(), attach_uprobe(), attach_usdt() and attach_multi(). A restarted process can then adopt them with reattach_from_pins() instead of loading the BPF object again, without a gap in coverage.
+            \"\"\"
+            pin_bpf_object(self.progs, self.maps, pin_dir)
+
+        def reattach_from_pins(self, pin_dir: str = PIN_DIR):
+            \"\"\"
+            Adopt the maps, programs and links pinned under @pin_dir by pin_bpf(), instead of loading and attaching the BPF object. Use this in place of load_bpf() and attach_bpf() on a skeleton created with autoload=False. Raises FileNotFoundError if nothing is pinned at @pin_dir. Adopted programs keep their attachments, can be hot swapped, and serve dump() as map iterators, but as the BPF object is never loaded they cannot be attached anew: attach() and the attach_*() methods raise an exception for them.
+            \"\"\"
+            self.open_bpf()
+            try:
+                progs, maps = adopt_pinned_bpf_object(self, self.bpf_object, pin_dir)
+            except Exception:
+                close_bpf_object(self.bpf_object)
+                self.bpf_object = None
+                raise
+            self.progs = ProgDict(progs)
+            self.maps = MapDict(maps)
+            register_map_types(self.maps, MAP_TYPES, DATASEC_TYPES)
+            link_map_iters(self.progs, self.maps)
+            atexit.register(self._cleanup)
+
+        def unpin_bpf(self, pin_dir: str = PIN_DIR):
+            \"\"\"
+            Remove the pins created by pin_bpf(), so that the BPF programs are detached once this process exits.
+            \"\"\"
+            unpin_bpf_object(pin_dir)
 
         def ringbuf_consume(self):
             \"\"\"
@@ -229,8 +821,17 @@ def generate_skeleton_class(bpf_obj_path: str, bpf_obj_name: str, bpf_class_name
     return SKEL_CLASS
 
 
+def skeleton_path(bpf_obj_path: str, outdir: str) -> Tuple[str, str]:
+    """
+    Get the path of the skeleton file for @bpf_obj_path in @outdir and the
+    name of its skeleton class.
+    """
+    bpf_obj_name = strip_full_extension(os.path.basename(bpf_obj_path))
+    outpath = os.path.abspath(os.path.join(outdir, f'{bpf_obj_name}_skel.py'))
+    return outpath, f'{to_camel(bpf_obj_name, True)}Skeleton'
+
 @drop_privileges
-def generate_skeleton(bpf_obj_path: str, outdir: str) -> str:
+def generate_skeleton(bpf_obj_path: str, outdir: str, embed: Optional[str] = None) -> str:
     SKEL_PREAMBLE = """
     \"\"\"
         pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
@@ -258,18 +859,15 @@ def generate_skeleton(bpf_obj_path: str, outdir: str) -> str:
     \"\"\"
     """
 
-    SKEL_FILENAME = '{}_skel.py'
-
     bpf_obj_name = strip_full_extension(os.path.basename(bpf_obj_path))
     bpf_class_name = to_camel(bpf_obj_name, True)
 
 
     txt = SKEL_PREAMBLE
-    txt += generate_skeleton_class(bpf_obj_path, bpf_obj_name, bpf_class_name)
+    txt += generate_skeleton_class(bpf_obj_path, bpf_obj_name, bpf_class_name, embed)
 
     # Determine output path
-    outfile = SKEL_FILENAME.format(bpf_obj_name)
-    outpath = os.path.abspath(os.path.join(outdir, outfile))
+    outpath, _ = skeleton_path(bpf_obj_path, outdir)
 
     with open(outpath, 'w+') as f:
        f.write(dedent(txt.strip('\n')))
@@ -0,0 +1,266 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+"""
+
+import math
+import ctypes as ct
+from typing import Any, List, Mapping, NamedTuple, Optional
+
+from pybpf.maps import PerCpuArray
+
+# Must match PYBPF_CMS_DEPTH in pybpf.bpf.h
+CMS_DEPTH = 4
+
+_FNV_OFFSET = 14695981039346656037
+_FNV_PRIME = 1099511628211
+_MASK32 = 0xFFFFFFFF
+_MASK64 = 0xFFFFFFFFFFFFFFFF
+
+def pybpf_hash(data: bytes) -> int:
+    """
+    64-bit FNV-1a hash of @data, as computed by pybpf_hash() in pybpf.bpf.h.
+    """
+    h = _FNV_OFFSET
+    for b in data:
+        h = ((h ^ b) * _FNV_PRIME) & _MASK64
+    return h
+
+def pybpf_fmix32(h: int) -> int:
+    """
+    The MurmurHash3 finalizer, as computed by pybpf_fmix32() in pybpf.bpf.h.
+    """
+    h &= _MASK32
+    h ^= h >> 16
+    h = (h * 0x85ebca6b) & _MASK32
+    h ^= h >> 13
+    h = (h * 0xc2b2ae35) & _MASK32
+    h ^= h >> 16
+    return h
+
+def pybpf_fmix64(h: int) -> int:
+    """
+    The MurmurHash3 64-bit finalizer, as computed by pybpf_fmix64() in
+    pybpf.bpf.h.
+    """
+    h ^= h >> 33
+    h = (h * 0xff51afd7ed558ccd) & _MASK64
+    h ^= h >> 33
+    h = (h * 0xc4ceb9fe1a85ec53) & _MASK64
+    h ^= h >> 33
+    return h
+
+class CountMinSketch:
+    """
+    A reader for the counters of a count-min sketch declared with
+    BPF_COUNT_MIN_SKETCH() in pybpf.bpf.h.
+    """
+    def __init__(self, _map: PerCpuArray):
+        if not isinstance(_map, PerCpuArray) or _map.capacity() % CMS_DEPTH:
+            raise TypeError('Count-min sketches must be per-cpu arrays of CMS_DEPTH rows')
+        self._map = _map
+        self.width = _map.capacity() // CMS_DEPTH
+
+    def read(self) -> List[int]:
+        """
+        Read every counter, summed over all cpus, in one batch.
+        """
+        return self._map.read_counters()
+
+    def indices(self, key) -> List[int]:
+        """
+        Return the index of the counter for @key, a ctypes key or its raw
+        bytes, in each row of the sketch.
+        """
+        h = pybpf_hash(bytes(key))
+        h1 = pybpf_fmix32(h)
+        h2 = pybpf_fmix32(h >> 32) | 1
+        return [row * self.width + ((h1 + row * h2) & _MASK32) % self.width for row in range(CMS_DEPTH)]
+
+    def estimate(self, key, counters: Optional[List[int]] = None) -> int:
+        """
+        Estimate the count of @key, a ctypes key or its raw bytes, from @counters as
+        returned by read(), or from a fresh read. Estimates never fall short of
+        the true count.
+        """
+        if counters is None:
+            counters = self.read()
+        return min(counters[i] for i in self.indices(key))
+
+    def error_bound(self, counters: Optional[List[int]] = None) -> int:
+        """
+        Return how far any estimate may exceed the true count, with
+        probability 1 - e^-CMS_DEPTH: e / width times the total count.
+        """
+        if counters is None:
+            counters = self.read()
+        total = sum(counters[:self.width])
+        return math.ceil(math.e / self.width * total)
+
+    def clear(self):
+        """
+        Reset every counter to zero.
+        """
+        zero = self._map.ValueType()
+        for i in range(self._map.capacity()):
+            self._map[i] = zero
+
+class HeavyHitter(NamedTuple):
+    """
+    A key and its estimated count, which exceeds the true count by at most
+    @error with high probability.
+    """
+    key: Any
+    count: int
+    error: int
+
+class TopK:
+    """
+    Track the @k most frequent keys counted with bpf_cms_add() in the sketch
+    @name declared with BPF_COUNT_MIN_SKETCH(), given the skeleton's @maps.
+    """
+    def __init__(self, maps: Mapping, name: str, k: int):
+        self.sketch = CountMinSketch(maps[name])
+        self._candidates = maps[f'{name}__candidates']
+        self._threshold = maps[f'{name}__threshold']
+        self._threshold.register_value_type(ct.c_uint64)
+        self._ncpus = maps[name]._num_cpus
+        self.k = k
+
+    def read(self, prune: bool = True) -> List[HeavyHitter]:
+        """
+        Return the top k candidates by estimated count, highest first. If
+        @prune is set, candidates that did not make the cut are dropped to
+        make room for new ones, and the admission threshold is raised to the
+        smallest count that could still make the top k. Keys are admitted on
+        their count on one cpu, so the threshold is the kth count divided by
+        the number of possible cpus, which the per-cpu sketch is sized for,
+        rather than the number online. Where many possible cpus are offline,
+        it is lower than it needs to be and admits more candidates, but it
+        never keeps out a key that could make the top k.
+        """
+        counters = self.sketch.read()
+        error = self.sketch.error_bound(counters)
+        keys, _values = self._candidates.lookup_batch()
+        key_type = self._candidates.KeyType
+        ksize = ct.sizeof(key_type)
+        raw = bytes(keys)
+        hitters = []
+        for i in range(len(keys)):
+            key = raw[i * ksize:(i + 1) * ksize]
+            hitters.append(HeavyHitter(key_type.from_buffer_copy(key), self.sketch.estimate(key, counters), error))
+        hitters.sort(key=lambda h: h.count, reverse=True)
+        top, rest = hitters[:self.k], hitters[self.k:]
+        if prune and len(top) == self.k:
+            for hitter in rest:
+                try:
+                    del self._candidates[hitter.key]
+                except KeyError:
+                    pass
+            # A key with the kth largest count must have at least its share
+            # of that count on some cpu
+            self._threshold[0] = top[-1].count // self._ncpus
+        return top
+
+    def clear(self):
+        """
+        Reset the sketch, the candidates and the admission threshold.
+        """
+        self.sketch.clear()
+        self._candidates.clear()
+        self._threshold[0] = 0
+
+class HyperLogLog:
+    """
+    A reader for a HyperLogLog sketch declared with BPF_HYPERLOGLOG() in
+    pybpf.bpf.h. Every read fetches the registers of all cpus in one lookup
+    and merges them by taking the maximum of each register.
+    """
+    def __init__(self, _map: PerCpuArray):
+        if not isinstance(_map, PerCpuArray) or _map.capacity() != 1:
+            raise TypeError('HyperLogLog sketches must be per-cpu arrays of one element')
+        self.m = _map._vsize
+        self.precision = self.m.bit_length() - 1
+        if self.m != 1 << self.precision:
+            raise ValueError(f'HyperLogLog sketch of {self.m} registers is not a power of two')
+        _map.register_value_type(ct.c_uint8 * self.m)
+        self._map = _map
+
+    def registers(self) -> List[int]:
+        """
+        Read the registers, merged over all cpus.
+        """
+        raw = bytes(self._map[0])
+        return list(map(max, *(raw[cpu * self.m:(cpu + 1) * self.m] for cpu in range(self._map._num_cpus))))
+
+    def estimate(self, registers: Optional[List[int]] = None) -> float:
+        """
+        Estimate the number of distinct keys added to the sketch, from
+        @registers if given or from a fresh read. This uses Ertl's improved
+        estimator, which corrects the bias of the original HyperLogLog
+        estimate at both small and large cardinalities without empirical
+        tables.
+        """
+        if registers is None:
+            registers = self.registers()
+        m = self.m
+        q = 64 - self.precision
+        counts = [0] * (q + 2)
+        for r in registers:
+            counts[r] += 1
+        z = m * _tau(1 - counts[q + 1] / m)
+        for k in range(q, 0, -1):
+            z = 0.5 * (z + counts[k])
+        z += m * _sigma(counts[0] / m)
+        return m * m / (2 * math.log(2) * z)
+
+    def error(self) -> float:
+        """
+        The standard error of estimates, relative to the true count.
+        """
+        return 1.04 / math.sqrt(self.m)
+
+    def clear(self):
+        """
+        Reset every register to zero, for instance to start a new interval.
+        """
+        self._map[0] = self._map.ValueType()
+
+def _sigma(x: float) -> float:
+    if x == 1:
+        return math.inf
+    y, z = 1.0, x
+    while True:
+        x *= x
+        z_old = z
+        z += x * y
+        y += y
+        if z == z_old:
+            return z
+
+def _tau(x: float) -> float:
+    if x == 0 or x == 1:
+        return 0.0
+    y, z = 1.0, 1 - x
+    while True:
+        x = math.sqrt(x)
+        z_old = z
+        y *= 0.5
+        z -= (1 - x) ** 2 * y
+        if z == z_old:
+            return z / 3
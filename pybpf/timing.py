@@ -0,0 +1,135 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+"""
+
+import os
+import json
+import time
+import threading
+from contextlib import contextmanager
+from typing import Any, Dict, List, NamedTuple, Optional
+
+class TimingRecord(NamedTuple):
+    """
+    A single timed span. @start_ns is on the time.perf_counter_ns() clock.
+    """
+    name: str
+    category: str
+    start_ns: int
+    duration_ns: int
+    args: Dict[str, Any]
+
+    @property
+    def duration(self) -> float:
+        return self.duration_ns / 1e9
+
+class LoadReport:
+    """
+    High resolution timing records for building, opening, loading and
+    attaching a BPF object. Records are grouped by category: 'bootstrap' for
+    Bootstrap.bootstrap() steps, 'phase' for skeleton phases, and 'prog',
+    'verify', 'map' and 'attach' for individual programs and maps.
+    """
+    def __init__(self):
+        self.records = [] # type: List[TimingRecord]
+        self._lock = threading.Lock()
+
+    def record(self, name: str, category: str, start_ns: int, duration_ns: int, **args):
+        """
+        Add a record for a span that has already been measured.
+        """
+        with self._lock:
+            self.records.append(TimingRecord(name, category, start_ns, duration_ns, args))
+
+    @contextmanager
+    def span(self, name: str, category: str = 'phase', **args):
+        """
+        Time the body of a with statement and record it as @name.
+        """
+        start = time.perf_counter_ns()
+        try:
+            yield
+        finally:
+            self.record(name, category, start, time.perf_counter_ns() - start, **args)
+
+    def category(self, category: str) -> List[TimingRecord]:
+        """
+        Get all records in @category, in the order they were recorded.
+        """
+        return [r for r in self.records if r.category == category]
+
+    def durations(self, category: str) -> Dict[str, float]:
+        """
+        Map the name of each record in @category to its duration in seconds.
+        """
+        return {r.name: r.duration for r in self.category(category)}
+
+    def to_chrome_trace(self) -> Dict[str, Any]:
+        """
+        Convert the report to the Chrome trace event format, which can be
+        opened in chrome://tracing or https://ui.perfetto.dev.
+        """
+        pid = os.getpid()
+        # Give each category its own named track
+        tids = {}
+        for r in self.records:
+            tids.setdefault(r.category, len(tids) + 1)
+        events = [{
+            'name': 'thread_name',
+            'ph': 'M',
+            'pid': pid,
+            'tid': tid,
+            'args': {'name': category},
+            } for category, tid in tids.items()]
+        events += [{
+            'name': r.name,
+            'cat': r.category,
+            'ph': 'X',
+            'ts': r.start_ns / 1e3,
+            'dur': r.duration_ns / 1e3,
+            'pid': pid,
+            'tid': tids[r.category],
+            'args': r.args,
+            } for r in self.records]
+        return {'traceEvents': events, 'displayTimeUnit': 'ms'}
+
+    def write_chrome_trace(self, path: str):
+        """
+        Write the report to @path as Chrome trace event JSON.
+        """
+        with open(path, 'w') as f:
+            json.dump(self.to_chrome_trace(), f)
+
+    def __str__(self):
+        lines = []
+        for r in self.records:
+            lines.append(f'{r.category:>10} {r.name:<40} {r.duration * 1e3:10.3f} ms')
+        return '\n'.join(lines)
+
+def record_span(report: Optional[LoadReport], name: str, category: str = 'phase', **args):
+    """
+    Like LoadReport.span(), but does nothing if @report is None.
+    """
+    if report is None:
+        return _null_span()
+    return report.span(name, category, **args)
+
+@contextmanager
+def _null_span():
+    yield
@@ -0,0 +1,225 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+"""
+
+import re
+import struct
+import platform
+import ctypes as ct
+from enum import IntEnum
+from typing import Dict, List, NamedTuple, Optional
+
+from pybpf.elf import ElfFile, cached_elf, find_binary
+
+# Must match PYBPF_USDT_MAX_ARGS in pybpf.bpf.h
+USDT_MAX_ARGS = 12
+
+NT_STAPSDT = 3
+
+class UsdtArgType(IntEnum):
+    """
+    Integer enum representing how a USDT argument is located.
+    Must match PYBPF_USDT_ARG_* in pybpf.bpf.h.
+    """
+    CONST     = 0
+    REG       = 1
+    REG_DEREF = 2
+
+class UsdtArgSpec(ct.Structure):
+    """
+    struct pybpf_usdt_arg_spec from pybpf.bpf.h
+    """
+    _fields_ = [
+            ('val_off', ct.c_uint64),
+            ('arg_type', ct.c_uint32),
+            ('reg_off', ct.c_int16),
+            ('arg_signed', ct.c_uint8),
+            ('arg_bitshift', ct.c_int8),
+            ]
+
+class UsdtSpec(ct.Structure):
+    """
+    struct pybpf_usdt_spec from pybpf.bpf.h
+    """
+    _fields_ = [
+            ('args', UsdtArgSpec * USDT_MAX_ARGS),
+            ('arg_cnt', ct.c_uint32),
+            ('used', ct.c_uint32),
+            ]
+
+# Offsets into struct pt_regs on x86_64, keyed by every name of each register
+_X86_64_PT_REGS = {}
+for _names, _off in [
+        (('rax', 'eax', 'ax', 'al'), 80),
+        (('rbx', 'ebx', 'bx', 'bl'), 40),
+        (('rcx', 'ecx', 'cx', 'cl'), 88),
+        (('rdx', 'edx', 'dx', 'dl'), 96),
+        (('rsi', 'esi', 'si', 'sil'), 104),
+        (('rdi', 'edi', 'di', 'dil'), 112),
+        (('rbp', 'ebp', 'bp', 'bpl'), 32),
+        (('rsp', 'esp', 'sp', 'spl'), 152),
+        (('rip', 'eip'), 128),
+        ]:
+    for _name in _names:
+        _X86_64_PT_REGS[_name] = _off
+for _num, _off in [(8, 72), (9, 64), (10, 56), (11, 48), (12, 24), (13, 16), (14, 8), (15, 0)]:
+    for _suffix in ('', 'd', 'w', 'b'):
+        _X86_64_PT_REGS[f'r{_num}{_suffix}'] = _off
+
+_arg_re = re.compile(r'(-?)(\d+)@(.+)')
+_const_re = re.compile(r'\$(-?(?:0x[0-9a-fA-F]+|\d+))')
+_reg_re = re.compile(r'%(\w+)')
+_deref_re = re.compile(r'(-?(?:0x[0-9a-fA-F]+|\d+))?\(%(\w+)\)')
+
+def _reg_off(reg: str) -> int:
+    if platform.machine() != 'x86_64':
+        raise NotImplementedError(f'USDT arguments are not yet supported on {platform.machine()}')
+    try:
+        return _X86_64_PT_REGS[reg]
+    except KeyError:
+        raise ValueError(f'Unsupported USDT argument register %{reg}') from None
+
+def parse_usdt_arg(arg: str) -> UsdtArgSpec:
+    """
+    Parse one USDT argument in the SystemTap assembler format, for example
+    "-4@%edi", "8@-16(%rbp)" or "4@$5".
+    """
+    match = _arg_re.fullmatch(arg)
+    if not match:
+        raise ValueError(f'Unable to parse USDT argument "{arg}"')
+    signed, size, loc = match[1] == '-', int(match[2]), match[3]
+    if size not in (1, 2, 4, 8):
+        raise ValueError(f'Invalid USDT argument size in "{arg}"')
+    spec = UsdtArgSpec(arg_signed=signed, arg_bitshift=64 - size * 8)
+    const, reg, deref = _const_re.fullmatch(loc), _reg_re.fullmatch(loc), _deref_re.fullmatch(loc)
+    if const:
+        spec.arg_type = UsdtArgType.CONST
+        spec.val_off = int(const[1], 0) & 0xffffffffffffffff
+    elif reg:
+        spec.arg_type = UsdtArgType.REG
+        spec.reg_off = _reg_off(reg[1])
+    elif deref:
+        spec.arg_type = UsdtArgType.REG_DEREF
+        spec.reg_off = _reg_off(deref[2])
+        spec.val_off = int(deref[1] or '0', 0) & 0xffffffffffffffff
+    else:
+        raise ValueError(f'Unsupported USDT argument location in "{arg}"')
+    return spec
+
+class UsdtProbe(NamedTuple):
+    """
+    A single USDT probe site. Offsets are file offsets into @path, as used
+    for uprobe attachment. @semaphore_offset is 0 if the probe has no
+    semaphore.
+    """
+    provider: str
+    name: str
+    path: str
+    offset: int
+    semaphore_offset: int
+    args: str
+
+    def spec(self) -> UsdtSpec:
+        """
+        Build the argument spec for this probe site.
+        """
+        spec = UsdtSpec()
+        args = self.args.split()
+        if len(args) > USDT_MAX_ARGS:
+            raise ValueError(f'USDT probe {self.provider}:{self.name} has more than {USDT_MAX_ARGS} arguments')
+        for i, arg in enumerate(args):
+            spec.args[i] = parse_usdt_arg(arg)
+        spec.arg_cnt = len(args)
+        return spec
+
+def _parse_usdt_probes(elf: ElfFile) -> List[UsdtProbe]:
+    probes = []
+    # Prelink may move the binary, in which case .stapsdt.base tells us by how much
+    base = elf.section('.stapsdt.base')
+    addr_fmt = 'QQQ' if elf.is64 else 'III'
+    addr_size = struct.calcsize(addr_fmt)
+    for owner, note_type, desc in elf.notes('.note.stapsdt'):
+        if owner != 'stapsdt' or note_type != NT_STAPSDT:
+            continue
+        pc, note_base, semaphore = struct.unpack_from(elf.endian + addr_fmt, desc)
+        provider, name, args = desc[addr_size:].split(b'\0')[:3]
+        if base is not None:
+            pc += base.addr - note_base
+            if semaphore:
+                semaphore += base.addr - note_base
+        probes.append(UsdtProbe(
+            provider=provider.decode('utf-8', 'replace'),
+            name=name.decode('utf-8', 'replace'),
+            path=elf.path,
+            offset=elf.vaddr_to_offset(pc),
+            semaphore_offset=elf.vaddr_to_offset(semaphore) if semaphore else 0,
+            args=args.decode('utf-8', 'replace'),
+            ))
+    return probes
+
+def usdt_probes(binary: str, provider: Optional[str] = None, name: Optional[str] = None) -> List[UsdtProbe]:
+    """
+    List the USDT probe sites in @binary, optionally filtered by @provider
+    and probe @name. Results are cached per binary, so repeated lookups (for
+    example, when attaching to many processes) do not parse it again.
+    """
+    path = find_binary(binary)
+    return [p for p in cached_elf(path, 'usdt', _parse_usdt_probes)
+            if (provider is None or p.provider == provider) and (name is None or p.name == name)]
+
+def _spec_ids(spec_map) -> Dict[bytes, int]:
+    """
+    Get the ids of the specs stored in @spec_map, keyed by spec bytes so that
+    identical specs share an id. They are kept on the map object rather than
+    by map fd, as a closed skeleton's fds are reused by the next one. Specs
+    already in the map, for example one adopted from pins, are kept. Slots in
+    use are told apart by their used flag, since a zero-argument spec is
+    otherwise all zeros.
+    """
+    ids = getattr(spec_map, '_usdt_spec_ids', None)
+    if ids is None:
+        ids = {}
+        for spec_id in range(spec_map.capacity()):
+            spec = spec_map[spec_id]
+            if spec.used:
+                ids.setdefault(bytes(spec), spec_id)
+        spec_map._usdt_spec_ids = ids
+    return ids
+
+def usdt_spec_id(spec_map, spec: UsdtSpec) -> int:
+    """
+    Store @spec in @spec_map (the pybpf_usdt_specs array declared by
+    pybpf.bpf.h) and return its index, to be used as the attach cookie.
+    """
+    if spec_map.ValueType is not UsdtSpec:
+        spec_map.register_value_type(UsdtSpec)
+    ids = _spec_ids(spec_map)
+    spec = UsdtSpec.from_buffer_copy(spec)
+    spec.used = 1
+    key = bytes(spec)
+    try:
+        return ids[key]
+    except KeyError:
+        pass
+    spec_id = max(ids.values()) + 1 if ids else 0
+    if spec_id >= spec_map.capacity():
+        raise Exception(f'No room left in USDT spec map ({spec_map.capacity()} entries)')
+    spec_map[spec_id] = spec
+    ids[key] = spec_id
+    return spec_id
@@ -23,11 +23,12 @@
 import os
 import sys
 import re
+import fnmatch
 import subprocess
 import platform
 from enum import IntEnum, auto
 from ctypes import get_errno
-from typing import Union, Optional
+from typing import Union, Optional, Iterable, List
 
 
 def module_path(pathname: str) -> str:
@@ -281,3 +282,48 @@ def get_encoded_kernel_version() -> int:
     # /usr/include/linux/version.h
     kversion_cache = ((major) << 16) + ((minor) << 8) + patch
     return kversion_cache
+
+TRACEFS_FILTER_FUNCTIONS = [
+    '/sys/kernel/tracing/available_filter_functions',
+    '/sys/kernel/debug/tracing/available_filter_functions',
+]
+kernel_functions_cache = None
+def kernel_functions() -> List[str]:
+    """
+    Get the names of traceable kernel functions from tracefs, falling back to
+    text symbols in /proc/kallsyms if tracefs is not mounted. The list is read
+    once per process.
+    """
+    global kernel_functions_cache
+    if kernel_functions_cache is not None:
+        return kernel_functions_cache
+    funcs = None
+    for path in TRACEFS_FILTER_FUNCTIONS:
+        try:
+            with open(path, 'r') as f:
+                funcs = [line.split()[0] for line in f if line.strip()]
+            break
+        except OSError:
+            pass
+    if funcs is None:
+        with open('/proc/kallsyms', 'r') as f:
+            # Skip the __pfx_ padding symbols emitted ahead of functions by newer kernels
+            funcs = [parts[2] for parts in map(str.split, f)
+                    if parts[1] in ('t', 'T') and not parts[2].startswith('__pfx_')]
+    kernel_functions_cache = list(dict.fromkeys(funcs))
+    return kernel_functions_cache
+
+def match_kernel_functions(patterns: Union[str, Iterable[str]]) -> List[str]:
+    """
+    Expand a glob pattern, or a list of names and glob patterns, into a list
+    of kernel function names.
+    """
+    if isinstance(patterns, str):
+        patterns = [patterns]
+    matches = []
+    for pattern in patterns:
+        if any(c in pattern for c in '*?['):
+            matches += fnmatch.filter(kernel_functions(), pattern)
+        else:
+            matches.append(pattern)
+    return list(dict.fromkeys(matches))
@@ -0,0 +1,341 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+"""
+
+import os
+import re
+import hashlib
+import logging
+import subprocess
+from typing import Dict, Iterable, List, Optional, Set, Tuple
+
+from pybpf.cache import source_deps, include_dirs, copy_atomic, tmp_suffix
+
+logger = logging.getLogger(__name__)
+
+# Give up on the compile-and-collect pass after this many rounds
+MAX_PRUNE_PASSES = 32
+
+_attribute_re = re.compile(r'__attribute__\s*\(\((?:[^()]|\([^()]*\))*\)\)')
+_tag_re = re.compile(r'\b(struct|union|enum)\s+([A-Za-z_]\w*)(\s*\*)?')
+_ident_re = re.compile(r'\b[A-Za-z_]\w*\b')
+_tag_def_re = re.compile(r'^(?:typedef\s+)?(struct|union|enum)\s+([A-Za-z_]\w*)\s*(?::[^{;]*)?\{')
+_tag_fwd_re = re.compile(r'^(struct|union|enum)\s+([A-Za-z_]\w*)\s*;$')
+_fn_ptr_name_re = re.compile(r'\(\s*\**\s*([A-Za-z_]\w*)\s*\)\s*\(')
+_fn_name_re = re.compile(r'([A-Za-z_]\w*)\s*\(')
+_missing_tag_re = re.compile(r"incomplete (?:definition of )?type '(?:const |volatile )*(struct|union|enum) ([A-Za-z_]\w*)")
+_missing_ident_re = re.compile(r"(?:unknown type name|use of undeclared identifier) '([A-Za-z_]\w*)'")
+
+def _strip_braces(text: str) -> Tuple[str, List[str]]:
+    """
+    Split @text into what lies outside of braces and the bodies of its
+    top-level brace pairs.
+    """
+    outside = []
+    bodies = []
+    depth = 0
+    start = 0
+    for i, c in enumerate(text):
+        if c == '{':
+            if depth == 0:
+                outside.append(text[start:i])
+                start = i + 1
+            depth += 1
+        elif c == '}':
+            depth -= 1
+            if depth == 0:
+                bodies.append(text[start:i])
+                start = i + 1
+    outside.append(text[start:])
+    return ' '.join(outside), bodies
+
+class Decl:
+    """
+    A top-level declaration in a bpftool generated vmlinux.h.
+    """
+    def __init__(self, text: str):
+        self.text = text
+        # struct, union and enum tags are named 'struct foo', etc.
+        self.defines = set() # type: Set[str]
+        # Types this declaration needs complete, and struct or union types it only points to
+        self.needs = set() # type: Set[str]
+        self.points_to = set() # type: Set[str]
+        # Set for forward declarations, which are regenerated rather than copied
+        self.forward = None # type: Optional[str]
+
+        flat = ' '.join(_attribute_re.sub('', text).split())
+        m = _tag_fwd_re.match(flat)
+        if m:
+            self.forward = f'{m[1]} {m[2]}'
+            return
+
+        outside, bodies = _strip_braces(flat)
+        m = _tag_def_re.match(flat)
+        if m:
+            self.defines.add(f'{m[1]} {m[2]}')
+        if flat.startswith('enum') or flat.startswith('typedef enum'):
+            for body in bodies:
+                for enumerator in body.split(','):
+                    m = _ident_re.search(enumerator)
+                    if m:
+                        self.defines.add(m[0])
+        outside = re.sub(r'\[[^\]]*\]', '', outside).rstrip(' ;')
+        if flat.startswith('typedef'):
+            m = _fn_ptr_name_re.search(outside) or _fn_name_re.search(outside)
+            if m:
+                self.defines.add(m[1])
+            else:
+                self.defines.add(_ident_re.findall(outside)[-1])
+        elif not bodies:
+            # Function and variable declarations, e.g. kfunc prototypes
+            m = _fn_name_re.search(outside)
+            idents = _ident_re.findall(outside)
+            if m:
+                self.defines.add(m[1])
+            elif idents:
+                self.defines.add(idents[-1])
+
+        tags = set()
+        for kind, name, ptr in _tag_re.findall(flat):
+            tag = f'{kind} {name}'
+            tags.add(name)
+            if ptr and kind != 'enum':
+                self.points_to.add(tag)
+            else:
+                self.needs.add(tag)
+        for ident in _ident_re.findall(flat):
+            if ident not in tags:
+                self.needs.add(ident)
+        self.needs -= self.defines
+        self.points_to -= self.defines | self.needs
+
+class VmlinuxHeader:
+    """
+    A parsed vmlinux.h, as generated by "bpftool btf dump ... format c", that
+    can be pruned down to the declarations some set of names depends on.
+    Preprocessor lines are always kept, in place.
+    """
+    def __init__(self, text: str):
+        self.items = [] # type: List[object]
+        self.by_name = {} # type: Dict[str, int]
+        # Tags bpftool only forward declares, such as opaque types
+        self.declared = set() # type: Set[str]
+        buf = [] # type: List[str]
+        depth = 0
+        for line in text.splitlines():
+            stripped = line.strip()
+            if not buf and (not stripped or stripped.startswith('#')):
+                self.items.append(line)
+                continue
+            buf.append(line)
+            depth += line.count('{') - line.count('}')
+            if depth == 0 and stripped.endswith(';'):
+                decl = Decl('\n'.join(buf))
+                if decl.forward:
+                    self.declared.add(decl.forward)
+                for name in decl.defines:
+                    self.by_name.setdefault(name, len(self.items))
+                self.items.append(decl)
+                buf = []
+        self.items.extend(buf)
+
+    def names(self) -> Set[str]:
+        return set(self.by_name)
+
+    def closure(self, needs: Iterable[str], points_to: Iterable[str] = ()) -> Tuple[Set[int], Set[str]]:
+        """
+        Find the declarations needed to make every name in @needs complete and
+        every tag in @points_to at least declared. Returns the indices of the
+        declarations to keep and the tags to forward declare.
+        """
+        keep = set() # type: Set[int]
+        forward = set(t for t in points_to if not t.startswith('enum '))
+        stack = list(needs)
+        while stack:
+            name = stack.pop()
+            try:
+                idx = self.by_name[name]
+            except KeyError:
+                continue
+            if idx in keep:
+                continue
+            keep.add(idx)
+            decl = self.items[idx]
+            stack.extend(decl.needs)
+            for tag in decl.points_to:
+                if tag.startswith('enum '):
+                    stack.append(tag)
+                else:
+                    forward.add(tag)
+        return keep, forward
+
+    def prune(self, needs: Iterable[str], points_to: Iterable[str] = ()) -> str:
+        """
+        Render a header containing only what @needs and @points_to depend on.
+        """
+        keep, forward = self.closure(needs, points_to)
+        forward = set(t for t in forward if t in self.by_name or t in self.declared)
+        for idx in keep:
+            forward.update(t for t in self.items[idx].defines if t.startswith('struct ') or t.startswith('union '))
+        lines = []
+        emitted_forward = False
+        for idx, item in enumerate(self.items):
+            if isinstance(item, str):
+                lines.append(item)
+                continue
+            if not emitted_forward:
+                # Forward declare everything up front, which also takes care of cycles
+                lines.extend(f'{tag};' for tag in sorted(forward))
+                lines.append('')
+                emitted_forward = True
+            if idx in keep:
+                lines.append(item.text)
+                lines.append('')
+        return re.sub(r'\n{3,}', '\n\n', '\n'.join(lines)).strip() + '\n'
+
+def source_names(bpf_srcs: Iterable[str], clang_args: List[str]) -> Tuple[Set[str], Set[str]]:
+    """
+    Collect the names used by @bpf_srcs and everything they include, other
+    than vmlinux.h itself. Returns the names that must be complete and the
+    struct and union tags that are only ever pointed to.
+    """
+    needs = set() # type: Set[str]
+    points_to = set() # type: Set[str]
+    for bpf_src in bpf_srcs:
+        for name, path in source_deps(bpf_src, include_dirs(clang_args)):
+            if path is None or os.path.basename(name).startswith('vmlinux'):
+                continue
+            with open(path, 'r', errors='replace') as f:
+                text = f.read()
+            tags = set()
+            for kind, tag, ptr in _tag_re.findall(text):
+                tags.add(tag)
+                if ptr and kind != 'enum':
+                    points_to.add(f'{kind} {tag}')
+                else:
+                    needs.add(f'{kind} {tag}')
+            needs.update(ident for ident in _ident_re.findall(text) if ident not in tags)
+    return needs, points_to - needs
+
+def missing_names(clang_output: str) -> Set[str]:
+    """
+    Parse the names of missing and incomplete types and undeclared
+    identifiers out of clang diagnostics.
+    """
+    names = set(_missing_ident_re.findall(clang_output))
+    names.update(f'{kind} {tag}' for kind, tag in _missing_tag_re.findall(clang_output))
+    return names
+
+def prune_key(full_h: str, bpf_srcs: List[str], clang_args: List[str]) -> str:
+    """
+    Hash everything a pruned header for @bpf_srcs depends on.
+    """
+    h = hashlib.sha256()
+    st = os.stat(full_h)
+    h.update(f'{os.path.realpath(full_h)}:{st.st_size}:{st.st_mtime_ns}\0'.encode())
+    h.update(' '.join(clang_args).encode() + b'\0')
+    for bpf_src in sorted(bpf_srcs):
+        for name, path in source_deps(bpf_src, include_dirs(clang_args)):
+            h.update(name.encode() + b'\0')
+            if path is None or os.path.basename(name).startswith('vmlinux'):
+                continue
+            with open(path, 'rb') as f:
+                h.update(f.read())
+    return h.hexdigest()
+
+def prune_vmlinux(full_h: str, out_h: str, bpf_srcs: List[str], clang: List[str], clang_args: List[str]) -> str:
+    """
+    Write a copy of the vmlinux header @full_h to @out_h that only contains
+    the types @bpf_srcs use. Names used in the sources seed a walk of the
+    header's type dependencies, then each source is syntax checked against the
+    result and any types clang reports as missing or incomplete are added,
+    until the sources compile. If they still do not, @out_h gets all of
+    @full_h instead, so that pruning never breaks a build. @out_h is left
+    untouched if it was already pruned for the same header, sources and flags.
+    """
+    key = prune_key(full_h, bpf_srcs, clang_args)
+    tag = f'/* Pruned by pybpf from {os.path.basename(full_h)}, key {key} */'
+    try:
+        with open(out_h, 'r') as f:
+            if f.readline().strip() == tag:
+                return out_h
+    except FileNotFoundError:
+        pass
+
+    with open(full_h, 'r') as f:
+        full_text = f.read()
+    header = VmlinuxHeader(full_text)
+    needs, points_to = source_names(bpf_srcs, clang_args)
+    known = header.names()
+
+    tmp_h = f'{out_h}.{tmp_suffix()}'
+    try:
+        for _ in range(MAX_PRUNE_PASSES):
+            with open(tmp_h, 'w') as f:
+                f.write(tag + '\n')
+                f.write(header.prune(needs, points_to))
+            missing = set() # type: Set[str]
+            errors = []
+            for bpf_src in bpf_srcs:
+                # Including the candidate first defines the include guard, so
+                # the sources' own #include "vmlinux.h" adds nothing
+                proc = subprocess.run(clang + clang_args + ['-fsyntax-only', '-ferror-limit=0', '-include', tmp_h, bpf_src],
+                        stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+                if proc.returncode:
+                    missing |= missing_names(proc.stdout)
+                    errors.append(proc.stdout)
+            new = (missing & known) - needs
+            if not new:
+                break
+            needs |= new
+        if errors:
+            logger.warning(f'Sources do not compile against pruned {out_h}, using all of {full_h} instead:\n' + '\n'.join(errors))
+            with open(tmp_h, 'w') as f:
+                f.write(tag + '\n')
+                f.write(full_text)
+            needs = known
+        copy_atomic(tmp_h, out_h)
+    finally:
+        if os.path.exists(tmp_h):
+            os.unlink(tmp_h)
+    logger.info(f'Pruned {full_h} to {len(needs & known)} of {len(known)} types -> {out_h}')
+    return out_h
+
+def build_pch(header: str, clang: List[str], clang_args: List[str]) -> str:
+    """
+    Precompile @header with @clang_args into @header.pch, unless it is already
+    newer than the file @header resolves to. Objects must be compiled with the
+    same flags to use it.
+    """
+    pch = f'{os.path.realpath(header)}.pch'
+    try:
+        if os.stat(pch).st_mtime_ns >= os.stat(header).st_mtime_ns:
+            return pch
+    except FileNotFoundError:
+        pass
+    tmp_pch = f'{pch}.{tmp_suffix()}'
+    try:
+        subprocess.check_call(clang + clang_args + ['-x', 'c-header', header, '-o', tmp_pch], stdout=subprocess.DEVNULL)
+        os.replace(tmp_pch, pch)
+    except subprocess.CalledProcessError:
+        raise Exception(f'Failed to precompile {header}') from None
+    finally:
+        if os.path.exists(tmp_pch):
+            os.unlink(tmp_pch)
+    return pch
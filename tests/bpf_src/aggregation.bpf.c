@@ -0,0 +1,25 @@
+#include "pybpf.bpf.h"
+#include "trigger.h"
+
+/* getpgid() arguments in [TRIGGER_BASE, TRIGGER_BASE + 1024) are recorded, less
+ * TRIGGER_BASE, under key value % 3 */
+
+BPF_AGGREGATION(by_residue, u32, 16);
+
+SEC("tracepoint/syscalls/sys_enter_getpgid")
+int aggregate_getpgid(struct trace_event_raw_sys_enter *ctx)
+{
+    s64 arg = ctx->args[0];
+    u32 value, key;
+
+    if (arg < TRIGGER_BASE || arg >= TRIGGER_BASE + 1024)
+        return 0;
+
+    value = arg - TRIGGER_BASE;
+    key = value % 3;
+    bpf_aggregate(by_residue, &key, value);
+
+    return 0;
+}
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,27 @@
+#include "pybpf.bpf.h"
+
+/* Calls seen by kprobe_multi_count and fentry_count respectively */
+BPF_ARRAY(calls, u64, 2, 0);
+
+static __always_inline void count_call(int index) {
+    u64 *count = bpf_map_lookup_elem(&calls, &index);
+    if (count)
+        lock_xadd(count, 1);
+}
+
+SEC("kprobe.multi")
+int kprobe_multi_count(struct pt_regs *ctx)
+{
+    count_call(0);
+    return 0;
+}
+
+/* Loaded against bpf_modify_return_test, then cloned by attach_multi() */
+SEC("fentry/bpf_modify_return_test")
+int fentry_count(void *ctx)
+{
+    count_call(1);
+    return 0;
+}
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,15 @@
+#include "pybpf.bpf.h"
+
+BPF_ARRAY(values, u64, 1, 0);
+
+SEC("tracepoint/raw_syscalls/sys_enter")
+int unchecked_lookup(void *args)
+{
+    int zero = 0;
+    u64 *value = bpf_map_lookup_elem(&values, &zero);
+    /* Missing NULL check, so the verifier must reject this */
+    *value += 1;
+    return 0;
+}
+
+char _license[] SEC("license") = "GPL";
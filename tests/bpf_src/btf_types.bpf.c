@@ -0,0 +1,38 @@
+#include "pybpf.bpf.h"
+
+struct event {
+    u32 pid;
+    char comm[16];
+    u64 ts;
+    unsigned int flag : 1;
+    unsigned int level : 3;
+    int delta : 4;
+};
+
+BPF_HASH(events, u32, struct event, 16, 0);
+
+/* The union is padded to 16 bytes, past its largest member */
+union tagged {
+    u64 a;
+    char b[9];
+};
+
+struct tagged_value {
+    union tagged u;
+    u32 tail;
+};
+
+BPF_ARRAY(tagged_values, struct tagged_value, 1, 0);
+
+int counter = 0;
+const volatile u64 threshold = 42;
+
+SEC("tracepoint/raw_syscalls/sys_enter")
+int count_sys_enter(void *ctx)
+{
+    if (threshold)
+        __sync_fetch_and_add(&counter, 1);
+    return 0;
+}
+
+char _license[] SEC("license") = "GPL";
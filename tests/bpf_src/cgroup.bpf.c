@@ -2,3 +2,17 @@
 
 BPF_CGROUP_ARRAY(cgroup_fds, 10240, 0);
 BPF_CGROUP_STORAGE(cgroup_storage, u64, 0);
+
+SEC("cgroup_skb/egress")
+int cgroup_egress(struct __sk_buff *skb)
+{
+    return 1;
+}
+
+SEC("cgroup_skb/egress")
+int cgroup_egress_v2(struct __sk_buff *skb)
+{
+    return 1;
+}
+
+char _license[] SEC("license") = "GPL";
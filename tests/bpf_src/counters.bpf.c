@@ -0,0 +1,22 @@
+#include "pybpf.bpf.h"
+
+BPF_HASH(shared_counts, u32, u64, 16, 0);
+BPF_PERCPU_HASH(percpu_counts, u32, u64, 16, 0);
+BPF_PERCPU_ARRAY(percpu_total, u64, 1, 0);
+
+SEC("xdp")
+int count_packets(struct xdp_md *ctx) {
+    u32 key = 1;
+    u32 zero = 0;
+
+    bpf_counter_increment(shared_counts, &key, 1);
+    bpf_counter_increment(percpu_counts, &key, 2);
+
+    u64 *total = bpf_map_lookup_elem(&percpu_total, &zero);
+    if (total)
+        bpf_counter_add(percpu_total, total, 3);
+
+    return XDP_PASS;
+}
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,9 @@
+#include "pybpf.bpf.h"
+
+SEC("freplace/verdict")
+int new_verdict(struct xdp_md *ctx)
+{
+    return XDP_DROP;
+}
+
+char _license[] SEC("license") = "GPL";
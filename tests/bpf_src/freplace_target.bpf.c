@@ -0,0 +1,17 @@
+#include "pybpf.bpf.h"
+
+/* A global function, which freplace (EXT) programs can replace */
+__noinline int verdict(struct xdp_md *ctx)
+{
+    if (!ctx)
+        return XDP_ABORTED;
+    return XDP_PASS;
+}
+
+SEC("xdp")
+int xdp_entry(struct xdp_md *ctx)
+{
+    return verdict(ctx);
+}
+
+char _license[] SEC("license") = "GPL";
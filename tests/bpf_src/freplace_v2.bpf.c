@@ -0,0 +1,11 @@
+#include "pybpf.bpf.h"
+
+/* A new version of freplace.bpf.c, for hot swapping */
+
+SEC("freplace/verdict")
+int new_verdict(struct xdp_md *ctx)
+{
+    return XDP_TX;
+}
+
+char _license[] SEC("license") = "GPL";
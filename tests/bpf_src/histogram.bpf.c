@@ -0,0 +1,26 @@
+#include "pybpf.bpf.h"
+#include "trigger.h"
+
+/* getpgid() arguments in [TRIGGER_BASE, TRIGGER_BASE + 2^20) are recorded, less
+ * TRIGGER_BASE, in every histogram */
+
+BPF_HISTOGRAM(log2_hist, 32);
+BPF_HISTOGRAM(linear_hist, 10);
+BPF_HISTOGRAM_2D(keyed_hist, 4, 32);
+
+SEC("tracepoint/syscalls/sys_enter_getpgid")
+int record_getpgid(struct trace_event_raw_sys_enter *ctx)
+{
+    s64 value = ctx->args[0] - TRIGGER_BASE;
+
+    if (value < 0 || value >= (1 << 20))
+        return 0;
+
+    bpf_hist_log2_increment(log2_hist, value);
+    bpf_hist_linear_increment(linear_hist, value, 0, 10);
+    bpf_hist_log2_increment_keyed(keyed_hist, (u64)value % 4, value);
+
+    return 0;
+}
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,24 @@
+#include "pybpf.bpf.h"
+#include "trigger.h"
+
+/* getpgid() arguments in [TRIGGER_BASE, TRIGGER_BASE + 2^20) are added, less
+ * TRIGGER_BASE, to the sketch */
+
+BPF_HYPERLOGLOG(distinct, 12);
+
+SEC("tracepoint/syscalls/sys_enter_getpgid")
+int count_getpgid(struct trace_event_raw_sys_enter *ctx)
+{
+    s64 arg = ctx->args[0];
+    u32 key;
+
+    if (arg < TRIGGER_BASE || arg >= TRIGGER_BASE + (1 << 20))
+        return 0;
+
+    key = arg - TRIGGER_BASE;
+    bpf_hll_add(distinct, &key);
+
+    return 0;
+}
+
+char _license[] SEC("license") = "GPL";
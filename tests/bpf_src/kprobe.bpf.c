@@ -0,0 +1,15 @@
+#include "pybpf.bpf.h"
+
+BPF_ARRAY(calls, u64, 1, 0);
+
+SEC("kprobe")
+int kprobe_count(struct pt_regs *ctx)
+{
+    int zero = 0;
+    u64 *count = bpf_map_lookup_elem(&calls, &zero);
+    if (count)
+        lock_xadd(count, 1);
+    return 0;
+}
+
+char _license[] SEC("license") = "GPL";
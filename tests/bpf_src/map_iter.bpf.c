@@ -0,0 +1,11 @@
+#include "pybpf.bpf.h"
+
+struct value {
+    u64 count;
+    u32 flags;
+};
+
+BPF_HASH(hash, u32, struct value, 4096, 0);
+BPF_MAP_ITER(hash, u32, struct value);
+
+char _license[] SEC("license") = "GPL";
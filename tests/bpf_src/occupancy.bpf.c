@@ -0,0 +1,26 @@
+#include "pybpf.bpf.h"
+#include "trigger.h"
+
+/* getpgid() arguments in [TRIGGER_BASE, TRIGGER_BASE + 1024) insert into
+ * the map, and their negations delete from it */
+
+BPF_HASH(counted, s64, u64, 1024, 0);
+BPF_MAP_OCCUPANCY(counted);
+
+SEC("tracepoint/syscalls/sys_enter_getpgid")
+int count_getpgid(struct trace_event_raw_sys_enter *ctx)
+{
+    s64 key = ctx->args[0];
+    u64 one = 1;
+
+    if (key >= TRIGGER_BASE && key < TRIGGER_BASE + 1024) {
+        bpf_map_update_counted(counted, &key, &one, BPF_ANY);
+    } else if (-key >= TRIGGER_BASE && -key < TRIGGER_BASE + 1024) {
+        key = -key;
+        bpf_map_delete_counted(counted, &key);
+    }
+
+    return 0;
+}
+
+char _license[] SEC("license") = "GPL";
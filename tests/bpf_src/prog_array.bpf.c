@@ -0,0 +1,18 @@
+#include "pybpf.bpf.h"
+
+BPF_PROG_ARRAY(dispatch, 4, 0);
+
+SEC("xdp")
+int xdp_dispatch(struct xdp_md *ctx)
+{
+    bpf_tail_call(ctx, &dispatch, 0);
+    return XDP_PASS;
+}
+
+SEC("xdp")
+int dispatch__0(struct xdp_md *ctx)
+{
+    return XDP_DROP;
+}
+
+char _license[] SEC("license") = "GPL";
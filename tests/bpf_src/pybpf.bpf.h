@@ -42,14 +42,49 @@
 
 #define lock_xadd(ptr, val) ((void)__sync_fetch_and_add(ptr, val))
 
+/* Look up @key in @map, inserting @val first if it is missing. A hit costs a
+ * single lookup; only a miss pays for the update and the second lookup. */
 static __always_inline void *bpf_map_lookup_or_try_init(void *map, const void * key, const void *val) {
     void *res = bpf_map_lookup_elem(map, key);
-    if (!res) {
-        bpf_map_update_elem(map, key, val, BPF_NOEXIST);
+    if (res) {
+        return res;
     }
+    /* Losing a race with another cpu inserting the same key is fine */
+    bpf_map_update_elem(map, key, val, BPF_NOEXIST);
     return bpf_map_lookup_elem(map, key);
 }
 
+/* The type of a map declared with __uint(type, ...), as a constant */
+#define __pybpf_map_type(MAP) (sizeof(*(MAP).type) / sizeof(int))
+
+/* Whether each cpu has its own copy of the values of @MAP */
+#define __pybpf_map_is_percpu(MAP) \
+    (__pybpf_map_type(MAP) == BPF_MAP_TYPE_PERCPU_HASH || \
+     __pybpf_map_type(MAP) == BPF_MAP_TYPE_PERCPU_ARRAY || \
+     __pybpf_map_type(MAP) == BPF_MAP_TYPE_LRU_PERCPU_HASH || \
+     __pybpf_map_type(MAP) == BPF_MAP_TYPE_PERCPU_CGROUP_STORAGE)
+
+/* Add @VAL to the counter at @PTR, a value of map @MAP. Values of per-cpu maps
+ * are only written by the current cpu, so they get a plain add; shared maps
+ * get lock_xadd(). The choice is made at compile time. */
+#define bpf_counter_add(MAP, PTR, VAL) \
+    do { \
+        if (__pybpf_map_is_percpu(MAP)) \
+            *(PTR) += (VAL); \
+        else \
+            lock_xadd(PTR, VAL); \
+    } while (0)
+
+/* Add @VAL to the counter for @KEY_PTR in map @MAP, starting it at zero if
+ * the key is missing */
+#define bpf_counter_increment(MAP, KEY_PTR, VAL) \
+    do { \
+        typeof(*(MAP).value) __zero = 0; \
+        typeof(*(MAP).value) *__count = bpf_map_lookup_or_try_init(&(MAP), KEY_PTR, &__zero); \
+        if (__count) \
+            bpf_counter_add(MAP, __count, VAL); \
+    } while (0)
+
 /* =========================================================================
  * Map Definition Helpers
  * ========================================================================= */
@@ -151,6 +186,19 @@ static __always_inline void *bpf_map_lookup_or_try_init(void *map, const void *
         __uint(map_flags, FLAGS); \
     } NAME SEC(".maps")
 
+/* Declare a BPF program array @NAME with @SIZE max entries, to be used as a
+ * jump table with bpf_tail_call(). The map creation flags may be specified with
+ * @FLAGS. Programs named NAME__<index> are installed at <index> automatically
+ * when the skeleton is loaded. Userspace may also install programs directly. */
+#define BPF_PROG_ARRAY(NAME, SIZE, FLAGS) \
+    struct { \
+        __uint(type, BPF_MAP_TYPE_PROG_ARRAY); \
+        __uint(max_entries, SIZE); \
+        __uint(key_size, sizeof(unsigned int)); \
+        __uint(value_size, sizeof(unsigned int)); \
+        __uint(map_flags, FLAGS); \
+    } NAME SEC(".maps")
+
 /* Declare a BPF stack @NAME with value type @VALUE, and @SIZE max entries.
  * The map creation flags may be specified with @FLAGS. */
 #define BPF_STACK(NAME, VALUE, SIZE, FLAGS) \
@@ -175,4 +223,589 @@ static __always_inline void *bpf_map_lookup_or_try_init(void *map, const void *
 
 /* TODO: add remaining map types */
 
+/* =========================================================================
+ * Occupancy Helpers
+ *
+ * Declare BPF_MAP_OCCUPANCY(NAME) after a hash map @NAME and insert and delete
+ * its entries with bpf_map_update_counted() and bpf_map_delete_counted() to
+ * maintain a per-cpu element count. Userspace reads it with a single syscall
+ * using map.count(exact=False). Entries evicted from LRU maps or changed from
+ * userspace are not counted.
+ * ========================================================================= */
+
+#ifndef EEXIST
+#define EEXIST 17
+#endif
+
+/* Declare a per-cpu element counter for map @NAME */
+#define BPF_MAP_OCCUPANCY(NAME) \
+    BPF_PERCPU_ARRAY(NAME##__occupancy, s64, 1, 0)
+
+static __always_inline void __pybpf_occupancy_add(void *counter, s64 delta) {
+    u32 zero = 0;
+    s64 *count = bpf_map_lookup_elem(counter, &zero);
+    if (count) {
+        *count += delta;
+    }
+}
+
+static __always_inline long __pybpf_map_update_counted(void *map, void *counter, const void *key, const void *val, u64 flags) {
+    long ret;
+    if (flags != BPF_EXIST) {
+        ret = bpf_map_update_elem(map, key, val, BPF_NOEXIST);
+        if (!ret) {
+            __pybpf_occupancy_add(counter, 1);
+            return 0;
+        }
+        if (ret != -EEXIST || flags == BPF_NOEXIST) {
+            return ret;
+        }
+    }
+    return bpf_map_update_elem(map, key, val, BPF_EXIST);
+}
+
+static __always_inline long __pybpf_map_delete_counted(void *map, void *counter, const void *key) {
+    long ret = bpf_map_delete_elem(map, key);
+    if (!ret) {
+        __pybpf_occupancy_add(counter, -1);
+    }
+    return ret;
+}
+
+/* Like bpf_map_update_elem(&NAME, KEY, VAL, FLAGS), counting new entries in the
+ * counter declared with BPF_MAP_OCCUPANCY(NAME) */
+#define bpf_map_update_counted(NAME, KEY, VAL, FLAGS) \
+    __pybpf_map_update_counted(&NAME, &NAME##__occupancy, KEY, VAL, FLAGS)
+
+/* Like bpf_map_delete_elem(&NAME, KEY), counting removed entries in the
+ * counter declared with BPF_MAP_OCCUPANCY(NAME) */
+#define bpf_map_delete_counted(NAME, KEY) \
+    __pybpf_map_delete_counted(&NAME, &NAME##__occupancy, KEY)
+
+/* =========================================================================
+ * Map Iterator Helpers
+ * ========================================================================= */
+
+/* Declare a bpf_map_elem iterator program NAME__iter that writes each entry of
+ * map @NAME as its @KEY followed by its @VALUE, with no padding in between.
+ * Userspace reads every entry in a single pass with map.dump(). Per-cpu maps
+ * are not supported. */
+#define BPF_MAP_ITER(NAME, KEY, VALUE) \
+    SEC("iter/bpf_map_elem") \
+    int NAME##__iter(struct bpf_iter__bpf_map_elem *ctx) \
+    { \
+        KEY *key = ctx->key; \
+        VALUE *value = ctx->value; \
+        if (key && value) { \
+            bpf_seq_write(ctx->meta->seq, key, sizeof(KEY)); \
+            bpf_seq_write(ctx->meta->seq, value, sizeof(VALUE)); \
+        } \
+        return 0; \
+    }
+
+/* =========================================================================
+ * Histogram Helpers
+ *
+ * Histograms are per-cpu arrays of u64 counts, one element per bucket, so
+ * recording a value is a single lookup and an unsynchronized increment. Read
+ * them from userspace with pybpf.histogram.Histogram, which merges the cpus.
+ * ========================================================================= */
+
+/* Return the base 2 logarithm of @v, rounded down, or 0 if @v is 0 */
+static __always_inline u32 pybpf_log2l(u64 v) {
+    u32 r, shift;
+    r = (v > 0xFFFFFFFF) << 5; v >>= r;
+    shift = (v > 0xFFFF) << 4; v >>= shift; r |= shift;
+    shift = (v > 0xFF) << 3; v >>= shift; r |= shift;
+    shift = (v > 0xF) << 2; v >>= shift; r |= shift;
+    shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+    r |= (v >> 1);
+    return r;
+}
+
+/* Return the log2 histogram bucket of @v: bucket 0 counts zeroes and bucket
+ * i > 0 counts values in [2^(i-1), 2^i) */
+static __always_inline u32 pybpf_log2_bucket(u64 v) {
+    return v ? pybpf_log2l(v) + 1 : 0;
+}
+
+/* Return the linear histogram bucket of @v, counting from @MIN in steps of
+ * @STEP, clamped to [0, @SLOTS) */
+static __always_inline u32 pybpf_linear_bucket(s64 v, s64 min, u64 step, u32 slots) {
+    if (v < min) {
+        return 0;
+    }
+    u64 bucket = (u64)(v - min) / step;
+    return bucket < slots ? bucket : slots - 1;
+}
+
+static __always_inline void __pybpf_hist_add(void *hist, u32 index, u64 count) {
+    u64 *slot = bpf_map_lookup_elem(hist, &index);
+    if (slot) {
+        *slot += count;
+    }
+}
+
+/* Declare a histogram @NAME with @SLOTS buckets. Record values with
+ * bpf_hist_log2_increment() or bpf_hist_linear_increment(). 65 slots cover
+ * every u64 in a log2 histogram. */
+#define BPF_HISTOGRAM(NAME, SLOTS) \
+    enum { NAME##__slots = (SLOTS) }; \
+    BPF_PERCPU_ARRAY(NAME, u64, SLOTS, 0)
+
+/* Declare a 2D histogram @NAME with a row of @SLOTS buckets for each key in
+ * [0, @KEYS). Record values with bpf_hist_log2_increment_keyed() or
+ * bpf_hist_linear_increment_keyed(). */
+#define BPF_HISTOGRAM_2D(NAME, KEYS, SLOTS) \
+    enum { NAME##__slots = (SLOTS), NAME##__keys = (KEYS) }; \
+    BPF_PERCPU_ARRAY(NAME, u64, (KEYS) * (SLOTS), 0)
+
+static __always_inline u32 __pybpf_hist_clamp(u32 bucket, u32 slots) {
+    return bucket < slots ? bucket : slots - 1;
+}
+
+/* Count @VALUE in the log2 bucket of histogram @NAME */
+#define bpf_hist_log2_increment(NAME, VALUE) \
+    __pybpf_hist_add(&NAME, __pybpf_hist_clamp(pybpf_log2_bucket(VALUE), NAME##__slots), 1)
+
+/* Count @VALUE in the linear bucket of histogram @NAME, whose buckets start
+ * at @MIN and are @STEP wide */
+#define bpf_hist_linear_increment(NAME, VALUE, MIN, STEP) \
+    __pybpf_hist_add(&NAME, pybpf_linear_bucket(VALUE, MIN, STEP, NAME##__slots), 1)
+
+/* Count @VALUE in the log2 bucket of row @KEY of 2D histogram @NAME. Keys
+ * outside [0, KEYS) are dropped. */
+#define bpf_hist_log2_increment_keyed(NAME, KEY, VALUE) \
+    ({ \
+        u32 __key = (KEY); \
+        if (__key < NAME##__keys) \
+            __pybpf_hist_add(&NAME, __key * NAME##__slots + __pybpf_hist_clamp(pybpf_log2_bucket(VALUE), NAME##__slots), 1); \
+    })
+
+/* Count @VALUE in the linear bucket of row @KEY of 2D histogram @NAME. Keys
+ * outside [0, KEYS) are dropped. */
+#define bpf_hist_linear_increment_keyed(NAME, KEY, VALUE, MIN, STEP) \
+    ({ \
+        u32 __key = (KEY); \
+        if (__key < NAME##__keys) \
+            __pybpf_hist_add(&NAME, __key * NAME##__slots + pybpf_linear_bucket(VALUE, MIN, STEP, NAME##__slots), 1); \
+    })
+
+/* =========================================================================
+ * Sketch Helpers
+ *
+ * Hashing here must match pybpf/sketch.py, which recomputes it in userspace.
+ * ========================================================================= */
+
+/* Hash @size bytes at @data with 64-bit FNV-1a */
+static __always_inline u64 pybpf_hash(const void *data, u32 size) {
+    const u8 *p = data;
+    u64 h = 14695981039346656037ULL;
+    for (u32 i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* The MurmurHash3 finalizer, to spread the bits of @h */
+static __always_inline u32 pybpf_fmix32(u32 h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+/* The MurmurHash3 64-bit finalizer, to spread the bits of @h */
+static __always_inline u64 pybpf_fmix64(u64 h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Number of rows, and so of hash functions, in a count-min sketch. Must match
+ * CMS_DEPTH in pybpf/sketch.py. */
+#define PYBPF_CMS_DEPTH 4
+
+/* Declare a count-min sketch @NAME of @WIDTH counters per row, counting keys of
+ * type @KEY, along with a set of at most @CANDIDATES heavy hitter candidates.
+ * Keys are admitted to the candidate set once their estimated count on one cpu
+ * reaches the threshold stored in NAME__threshold, which
+ * pybpf.sketch.TopK keeps up to date. Memory use is constant however many
+ * distinct keys are counted. */
+#define BPF_COUNT_MIN_SKETCH(NAME, KEY, WIDTH, CANDIDATES) \
+    enum { NAME##__width = (WIDTH) }; \
+    BPF_PERCPU_ARRAY(NAME, u64, PYBPF_CMS_DEPTH * (WIDTH), 0); \
+    BPF_HASH(NAME##__candidates, KEY, u8, CANDIDATES, 0); \
+    BPF_ARRAY(NAME##__threshold, u64, 1, 0)
+
+static __always_inline u64 __pybpf_cms_add(void *sketch, u32 width, void *candidates, void *threshold, const void *key, u32 size, u64 count) {
+    u64 h = pybpf_hash(key, size);
+    u32 h1 = pybpf_fmix32(h);
+    u32 h2 = pybpf_fmix32(h >> 32) | 1;
+    u64 estimate = (u64)-1;
+    u32 zero = 0;
+    u8 one = 1;
+
+    /* Row i uses the hash function h1 + i * h2 */
+    for (u32 row = 0; row < PYBPF_CMS_DEPTH; row++) {
+        u32 index = row * width + (h1 + row * h2) % width;
+        u64 *slot = bpf_map_lookup_elem(sketch, &index);
+        if (!slot) {
+            return 0;
+        }
+        *slot += count;
+        if (*slot < estimate) {
+            estimate = *slot;
+        }
+    }
+
+    u64 *min_count = bpf_map_lookup_elem(threshold, &zero);
+    if (min_count && estimate >= *min_count) {
+        bpf_map_update_elem(candidates, key, &one, BPF_NOEXIST);
+    }
+
+    return estimate;
+}
+
+/* Add @COUNT occurrences of the key pointed to by @KEY_PTR to the count-min
+ * sketch @NAME. Returns the key's estimated count on this cpu. */
+#define bpf_cms_add(NAME, KEY_PTR, COUNT) \
+    __pybpf_cms_add(&NAME, NAME##__width, &NAME##__candidates, &NAME##__threshold, KEY_PTR, sizeof(*(KEY_PTR)), COUNT)
+
+/* Declare a HyperLogLog sketch @NAME with 2^@PRECISION one byte registers
+ * per cpu, for estimating the number of distinct keys added to it with
+ * bpf_hll_add(). @PRECISION must be between 4 and 14. The standard error of
+ * the estimate is 1.04 / sqrt(2^@PRECISION), 1.6% at a precision of 12,
+ * which takes 4 KiB per cpu however many keys are added. */
+#define BPF_HYPERLOGLOG(NAME, PRECISION) \
+    enum { NAME##__precision = (PRECISION) }; \
+    struct NAME##__registers { \
+        u8 registers[1 << (PRECISION)]; \
+    }; \
+    BPF_PERCPU_ARRAY(NAME, struct NAME##__registers, 1, 0)
+
+static __always_inline void __pybpf_hll_add(void *hll, u32 precision, u64 h) {
+    u32 zero = 0;
+    u8 *registers = bpf_map_lookup_elem(hll, &zero);
+    if (!registers) {
+        return;
+    }
+    /* The top @precision bits pick a register, which keeps the highest rank,
+     * the position of the first set bit, seen in the remaining bits. The
+     * guard bit caps ranks at 65 - @precision. */
+    u32 index = (h >> (64 - precision)) & ((1 << precision) - 1);
+    u64 rest = (h << precision) | (1ULL << (precision - 1));
+    u8 rank = 64 - pybpf_log2l(rest);
+    if (registers[index] < rank) {
+        registers[index] = rank;
+    }
+}
+
+/* Add the key pointed to by @KEY_PTR to the HyperLogLog sketch @NAME */
+#define bpf_hll_add(NAME, KEY_PTR) \
+    __pybpf_hll_add(&NAME, NAME##__precision, pybpf_fmix64(pybpf_hash(KEY_PTR, sizeof(*(KEY_PTR)))))
+
+/* =========================================================================
+ * Sampling and Rate Limiting Helpers
+ *
+ * bpf_sample(), bpf_rate_limit() and bpf_budget_consume() return true if an
+ * event should be kept. Their knobs live in a NAME__config array that can be
+ * changed at runtime through pybpf/sampling.py, and knobs left at zero fall
+ * back to the defaults given in the declaration. NAME__stats counts kept and
+ * dropped events per cpu. Config structs must match pybpf/sampling.py.
+ * ========================================================================= */
+
+static __always_inline bool __pybpf_count_kept(void *stats, bool keep) {
+    u32 index = keep ? 0 : 1;
+    u64 *count = bpf_map_lookup_elem(stats, &index);
+    if (count) {
+        *count += 1;
+    }
+    return keep;
+}
+
+struct pybpf_sampler_config {
+    u64 rate;
+};
+
+/* Declare a sampler @NAME that keeps one in @RATE events by default */
+#define BPF_SAMPLER(NAME, RATE) \
+    static const u64 NAME##__default_rate = (RATE); \
+    BPF_ARRAY(NAME##__config, struct pybpf_sampler_config, 1, 0); \
+    BPF_PERCPU_ARRAY(NAME##__stats, u64, 2, 0)
+
+static __always_inline bool __pybpf_sample(void *config, void *stats, u64 default_rate) {
+    u32 zero = 0;
+    struct pybpf_sampler_config *cfg = bpf_map_lookup_elem(config, &zero);
+    u64 rate = cfg && cfg->rate ? cfg->rate : default_rate;
+    return __pybpf_count_kept(stats, rate <= 1 || bpf_get_prandom_u32() % rate == 0);
+}
+
+/* Return true for a random one in RATE events passing through sampler @NAME */
+#define bpf_sample(NAME) \
+    __pybpf_sample(&NAME##__config, &NAME##__stats, NAME##__default_rate)
+
+struct pybpf_rate_limit_config {
+    u64 interval_ns;
+    u64 burst;
+};
+
+/* Declare a rate limiter @NAME that by default lets through @RATE events per
+ * second for each key of type @KEY, in bursts of up to @BURST events. The
+ * state of each key is a single u64 in an LRU hash of @MAX_KEYS entries. */
+#define BPF_RATE_LIMITER(NAME, KEY, MAX_KEYS, RATE, BURST) \
+    static const u64 NAME##__default_interval_ns = 1000000000ULL / (RATE); \
+    static const u64 NAME##__default_burst = (BURST); \
+    BPF_LRU_HASH(NAME, KEY, u64, MAX_KEYS, 0); \
+    BPF_ARRAY(NAME##__config, struct pybpf_rate_limit_config, 1, 0); \
+    BPF_PERCPU_ARRAY(NAME##__stats, u64, 2, 0)
+
+static __always_inline bool __pybpf_rate_limit(void *tats, void *config, void *stats, const void *key, u64 default_interval, u64 default_burst) {
+    u32 zero = 0;
+    struct pybpf_rate_limit_config *cfg = bpf_map_lookup_elem(config, &zero);
+    u64 interval = cfg && cfg->interval_ns ? cfg->interval_ns : default_interval;
+    u64 burst = cfg && cfg->burst ? cfg->burst : default_burst;
+    u64 now = bpf_ktime_get_ns();
+
+    /* A token bucket in the form of the generic cell rate algorithm: a key's
+     * theoretical arrival time advances by one interval per kept event, and
+     * events may arrive up to burst - 1 intervals ahead of it. Updates from
+     * several cpus at once may race, letting a few extra events through. */
+    u64 *tat = bpf_map_lookup_elem(tats, key);
+    if (!tat) {
+        u64 next = now + interval;
+        bpf_map_update_elem(tats, key, &next, BPF_NOEXIST);
+        return __pybpf_count_kept(stats, true);
+    }
+    if (*tat > now + interval * (burst ? burst - 1 : 0)) {
+        return __pybpf_count_kept(stats, false);
+    }
+    *tat = (*tat > now ? *tat : now) + interval;
+    return __pybpf_count_kept(stats, true);
+}
+
+/* Return true if the key pointed to by @KEY_PTR is within its rate in rate
+ * limiter @NAME */
+#define bpf_rate_limit(NAME, KEY_PTR) \
+    __pybpf_rate_limit(&NAME, &NAME##__config, &NAME##__stats, KEY_PTR, NAME##__default_interval_ns, NAME##__default_burst)
+
+struct pybpf_budget_config {
+    u64 window_ns;
+    u64 limit;
+};
+
+struct pybpf_budget_state {
+    u64 window_start;
+    u64 used;
+};
+
+/* Declare a per-cpu budget @NAME that lets each cpu spend @LIMIT units every
+ * @WINDOW_NS nanoseconds by default */
+#define BPF_BUDGET(NAME, LIMIT, WINDOW_NS) \
+    static const u64 NAME##__default_limit = (LIMIT); \
+    static const u64 NAME##__default_window_ns = (WINDOW_NS); \
+    BPF_PERCPU_ARRAY(NAME, struct pybpf_budget_state, 1, 0); \
+    BPF_ARRAY(NAME##__config, struct pybpf_budget_config, 1, 0); \
+    BPF_PERCPU_ARRAY(NAME##__stats, u64, 2, 0)
+
+static __always_inline bool __pybpf_budget_consume(void *budget, void *config, void *stats, u64 cost, u64 default_limit, u64 default_window) {
+    u32 zero = 0;
+    struct pybpf_budget_config *cfg = bpf_map_lookup_elem(config, &zero);
+    u64 limit = cfg && cfg->limit ? cfg->limit : default_limit;
+    u64 window = cfg && cfg->window_ns ? cfg->window_ns : default_window;
+    u64 now = bpf_ktime_get_ns();
+
+    struct pybpf_budget_state *state = bpf_map_lookup_elem(budget, &zero);
+    if (!state) {
+        return __pybpf_count_kept(stats, false);
+    }
+    if (now - state->window_start >= window) {
+        state->window_start = now;
+        state->used = 0;
+    }
+    if (state->used + cost > limit) {
+        return __pybpf_count_kept(stats, false);
+    }
+    state->used += cost;
+    return __pybpf_count_kept(stats, true);
+}
+
+/* Return true if this cpu can spend @COST units of budget @NAME in the current
+ * window, spending them */
+#define bpf_budget_consume(NAME, COST) \
+    __pybpf_budget_consume(&NAME, &NAME##__config, &NAME##__stats, COST, NAME##__default_limit, NAME##__default_window_ns)
+
+/* =========================================================================
+ * Aggregation Helpers
+ *
+ * Aggregate values per key in the kernel instead of streaming every event to
+ * userspace. Read and reset aggregates with pybpf.aggregation.Aggregation,
+ * which merges the cpus.
+ * ========================================================================= */
+
+/* Must match the Aggregate struct in pybpf/aggregation.py */
+struct pybpf_aggregate {
+    u64 count;
+    u64 sum;
+    u64 min;
+    u64 max;
+    u64 last;
+    u64 last_ns;
+};
+
+/* Declare an aggregation @NAME of the count, sum, minimum, maximum and last
+ * value recorded for each key of type @KEY, for up to @MAX_KEYS keys. Each cpu
+ * keeps its own aggregates, so recording takes no locks or atomics. */
+#define BPF_AGGREGATION(NAME, KEY, MAX_KEYS) \
+    BPF_PERCPU_HASH(NAME, KEY, struct pybpf_aggregate, MAX_KEYS, 0)
+
+static __always_inline void __pybpf_aggregate(void *aggregation, const void *key, u64 value) {
+    struct pybpf_aggregate *agg = bpf_map_lookup_elem(aggregation, key);
+    if (!agg) {
+        struct pybpf_aggregate init = {
+            .count = 1,
+            .sum = value,
+            .min = value,
+            .max = value,
+            .last = value,
+            .last_ns = bpf_ktime_get_ns(),
+        };
+        if (!bpf_map_update_elem(aggregation, key, &init, BPF_NOEXIST)) {
+            return;
+        }
+        /* Another cpu added the key first, leaving our copy zeroed */
+        agg = bpf_map_lookup_elem(aggregation, key);
+        if (!agg) {
+            return;
+        }
+    }
+    if (!agg->count || value < agg->min) {
+        agg->min = value;
+    }
+    if (value > agg->max) {
+        agg->max = value;
+    }
+    agg->count += 1;
+    agg->sum += value;
+    agg->last = value;
+    agg->last_ns = bpf_ktime_get_ns();
+}
+
+/* Record @VALUE for the key pointed to by @KEY_PTR in aggregation @NAME */
+#define bpf_aggregate(NAME, KEY_PTR, VALUE) \
+    __pybpf_aggregate(&NAME, KEY_PTR, VALUE)
+
+/* =========================================================================
+ * USDT Helpers
+ *
+ * Define PYBPF_USDT before including this file to use these helpers. Attach
+ * the program with ProgKprobe.attach_usdt(..., spec_map=skel.maps.pybpf_usdt_specs)
+ * so that each probe site's argument spec is made available to the program.
+ * ========================================================================= */
+
+#ifdef PYBPF_USDT
+
+#ifndef PYBPF_USDT_MAX_SPECS
+#define PYBPF_USDT_MAX_SPECS 256
+#endif
+
+/* Must match USDT_MAX_ARGS in pybpf/usdt.py */
+#define PYBPF_USDT_MAX_ARGS 12
+
+/* Must match UsdtArgType in pybpf/usdt.py */
+#define PYBPF_USDT_ARG_CONST     0
+#define PYBPF_USDT_ARG_REG       1
+#define PYBPF_USDT_ARG_REG_DEREF 2
+
+struct pybpf_usdt_arg_spec {
+    /* Constant value, or offset from the register for dereferenced args */
+    __u64 val_off;
+    __u32 arg_type;
+    /* Offset of the register in struct pt_regs */
+    __s16 reg_off;
+    __u8 arg_signed;
+    /* 64 minus the argument size in bits */
+    __s8 arg_bitshift;
+};
+
+struct pybpf_usdt_spec {
+    struct pybpf_usdt_arg_spec args[PYBPF_USDT_MAX_ARGS];
+    __u32 arg_cnt;
+    /* Nonzero once the spec is stored, as a zero-argument spec is all zeros */
+    __u32 used;
+};
+
+/* Argument specs, indexed by the attach cookie of each probe site */
+BPF_ARRAY(pybpf_usdt_specs, struct pybpf_usdt_spec, PYBPF_USDT_MAX_SPECS, 0);
+
+static __always_inline struct pybpf_usdt_spec *pybpf_usdt_spec(struct pt_regs *ctx) {
+    int spec_id = bpf_get_attach_cookie(ctx);
+    return bpf_map_lookup_elem(&pybpf_usdt_specs, &spec_id);
+}
+
+/* Return the number of arguments of the USDT probe that fired, or a negative
+ * error if its spec is missing. */
+static __always_inline int pybpf_usdt_arg_cnt(struct pt_regs *ctx) {
+    struct pybpf_usdt_spec *spec = pybpf_usdt_spec(ctx);
+    if (!spec)
+        return -3; /* -ESRCH */
+    return spec->arg_cnt;
+}
+
+/* Fetch argument @arg_num of the USDT probe that fired into @res, sign or zero
+ * extended to 64 bits. Returns 0 on success or a negative error. */
+static __always_inline int pybpf_usdt_arg(struct pt_regs *ctx, __u64 arg_num, long *res) {
+    struct pybpf_usdt_spec *spec;
+    struct pybpf_usdt_arg_spec *arg;
+    unsigned long val;
+    int err;
+
+    *res = 0;
+
+    spec = pybpf_usdt_spec(ctx);
+    if (!spec)
+        return -3; /* -ESRCH */
+    if (arg_num >= PYBPF_USDT_MAX_ARGS || arg_num >= spec->arg_cnt)
+        return -2; /* -ENOENT */
+
+    arg = &spec->args[arg_num];
+    switch (arg->arg_type) {
+    case PYBPF_USDT_ARG_CONST:
+        val = arg->val_off;
+        break;
+    case PYBPF_USDT_ARG_REG:
+        err = bpf_probe_read_kernel(&val, sizeof(val), (void *)ctx + arg->reg_off);
+        if (err)
+            return err;
+        break;
+    case PYBPF_USDT_ARG_REG_DEREF:
+        err = bpf_probe_read_kernel(&val, sizeof(val), (void *)ctx + arg->reg_off);
+        if (err)
+            return err;
+        err = bpf_probe_read_user(&val, sizeof(val), (void *)val + arg->val_off);
+        if (err)
+            return err;
+        break;
+    default:
+        return -22; /* -EINVAL */
+    }
+
+    /* Truncate to the argument size, then sign or zero extend */
+    val <<= arg->arg_bitshift;
+    if (arg->arg_signed)
+        val = ((long)val) >> arg->arg_bitshift;
+    else
+        val = val >> arg->arg_bitshift;
+    *res = val;
+    return 0;
+}
+
+#endif /* ifdef PYBPF_USDT */
+
 #endif /* ifndef PYBPF_AUTO_INCLUDES_H */
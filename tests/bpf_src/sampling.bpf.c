@@ -0,0 +1,28 @@
+#include "pybpf.bpf.h"
+#include "trigger.h"
+
+/* getpgid() arguments in [TRIGGER_BASE, TRIGGER_BASE + 1024) are passed, less
+ * TRIGGER_BASE, through every filter */
+
+BPF_SAMPLER(sampler, 1);
+BPF_RATE_LIMITER(limiter, u32, 1024, 1, 5);
+BPF_BUDGET(budget, 10, 1000000000ULL);
+
+SEC("tracepoint/syscalls/sys_enter_getpgid")
+int filter_getpgid(struct trace_event_raw_sys_enter *ctx)
+{
+    s64 arg = ctx->args[0];
+    u32 key;
+
+    if (arg < TRIGGER_BASE || arg >= TRIGGER_BASE + 1024)
+        return 0;
+
+    key = arg - TRIGGER_BASE;
+    bpf_sample(sampler);
+    bpf_rate_limit(limiter, &key);
+    bpf_budget_consume(budget, 1);
+
+    return 0;
+}
+
+char _license[] SEC("license") = "GPL";
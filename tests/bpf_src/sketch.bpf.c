@@ -0,0 +1,24 @@
+#include "pybpf.bpf.h"
+#include "trigger.h"
+
+/* getpgid() arguments in [TRIGGER_BASE, TRIGGER_BASE + 1024) are counted, less
+ * TRIGGER_BASE, in the sketch */
+
+BPF_COUNT_MIN_SKETCH(flows, u32, 1024, 64);
+
+SEC("tracepoint/syscalls/sys_enter_getpgid")
+int count_getpgid(struct trace_event_raw_sys_enter *ctx)
+{
+    s64 arg = ctx->args[0];
+    u32 key;
+
+    if (arg < TRIGGER_BASE || arg >= TRIGGER_BASE + 1024)
+        return 0;
+
+    key = arg - TRIGGER_BASE;
+    bpf_cms_add(flows, &key, 1);
+
+    return 0;
+}
+
+char _license[] SEC("license") = "GPL";
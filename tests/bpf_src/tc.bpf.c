@@ -0,0 +1,14 @@
+#include "pybpf.bpf.h"
+
+BPF_ARRAY(packet_count, u64, 1, 0);
+
+SEC("classifier")
+int tc_count(struct __sk_buff *skb) {
+    int zero = 0;
+    u64 *count = bpf_map_lookup_elem(&packet_count, &zero);
+    if (count)
+        lock_xadd(count, 1);
+    return 0; /* TC_ACT_OK */
+}
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,9 @@
+#ifndef PYBPF_TEST_TRIGGER_H
+#define PYBPF_TEST_TRIGGER_H
+
+/* Tests feed values to programs hooking getpgid() by passing them as pids
+ * offset by TRIGGER_BASE, well clear of any real pid. Must match
+ * TRIGGER_BASE in test_maps.py. */
+#define TRIGGER_BASE 1000000
+
+#endif /* PYBPF_TEST_TRIGGER_H */
@@ -0,0 +1,22 @@
+#define PYBPF_USDT
+#include "pybpf.bpf.h"
+
+/* The arguments of the last pybpf_test:value probe to fire */
+BPF_ARRAY(probe_args, long, 2, 0);
+
+SEC("uprobe")
+int usdt_value(struct pt_regs *ctx)
+{
+    long val;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (pybpf_usdt_arg(ctx, i, &val))
+            return 0;
+        bpf_map_update_elem(&probe_args, &i, &val, BPF_ANY);
+    }
+
+    return 0;
+}
+
+char _license[] SEC("license") = "GPL";
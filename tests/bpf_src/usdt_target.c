@@ -0,0 +1,40 @@
+/* A userspace program with USDT probes for tests/test_progs.py. The probes are
+ * written out by hand, in the format <sys/sdt.h> generates, so that building
+ * it does not need systemtap headers. */
+
+#include <stdlib.h>
+
+#define PYBPF_TEST_PROBE2(name, arg1, arg2) \
+    __asm__ __volatile__ ( \
+        "990: nop\n" \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+        ".balign 4\n" \
+        ".4byte 992f-991f, 994f-993f, 3\n" \
+        "991: .asciz \"stapsdt\"\n" \
+        "992: .balign 4\n" \
+        "993: .8byte 990b\n" \
+        ".8byte _.stapsdt.base\n" \
+        ".8byte 0\n" \
+        ".asciz \"pybpf_test\"\n" \
+        ".asciz \"" #name "\"\n" \
+        ".asciz \"-4@%[a1] 8@%[a2]\"\n" \
+        "994: .balign 4\n" \
+        ".popsection\n" \
+        ".ifndef _.stapsdt.base\n" \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+        ".weak _.stapsdt.base\n" \
+        ".hidden _.stapsdt.base\n" \
+        "_.stapsdt.base: .space 1\n" \
+        ".size _.stapsdt.base, 1\n" \
+        ".popsection\n" \
+        ".endif\n" \
+        :: [a1] "nor" (arg1), [a2] "nor" (arg2))
+
+int main(int argc, char **argv)
+{
+    int value = argc > 1 ? atoi(argv[1]) : 0;
+
+    PYBPF_TEST_PROBE2(value, value, 7L);
+
+    return 0;
+}
@@ -31,11 +31,30 @@ from pybpf.skeleton import generate_skeleton
 from pybpf.utils import drop_privileges
 
 TESTDIR = '/tmp/pybpf'
+CACHE_DIR = '/tmp/pybpf-cache'
 
 @drop_privileges
 def make_testdir():
     os.makedirs(TESTDIR)
 
+@drop_privileges
+def make_cache_dir():
+    os.makedirs(CACHE_DIR)
+
+@pytest.fixture(scope='session', autouse=True)
+def cache_dir():
+    """
+    Keep the build cache used by Bootstrap.bootstrap() out of the user's home
+    directory for the duration of the tests.
+    """
+    shutil.rmtree(CACHE_DIR, ignore_errors=True)
+    make_cache_dir()
+    old_cache_dir = Bootstrap.CACHE_DIR
+    Bootstrap.CACHE_DIR = CACHE_DIR
+    yield CACHE_DIR
+    Bootstrap.CACHE_DIR = old_cache_dir
+    shutil.rmtree(CACHE_DIR, ignore_errors=True)
+
 @pytest.fixture
 def testdir():
     try:
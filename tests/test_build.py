@@ -0,0 +1,226 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+"""
+
+import os
+import json
+import threading
+
+import pytest
+
+from pybpf import skeleton as skeleton_module, btf as btf_module
+from pybpf.bootstrap import Bootstrap, compile_key, skeleton_key
+from pybpf.cache import BuildCache, source_deps, copy_atomic
+from pybpf.timing import LoadReport
+from pybpf.utils import project_path, drop_privileges
+
+BPF_SRC = project_path('tests/bpf_src/prog.bpf.c')
+
+@drop_privileges
+def _write_file(path, text, mode=0o644):
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, 'w') as f:
+        f.write(text)
+    os.chmod(path, mode)
+
+def _write_tool(path, version):
+    _write_file(path, f'#!/bin/sh\necho "{version}"\n', 0o755)
+
+def test_source_deps(testdir):
+    """
+    Test finding the transitive includes of a source file.
+    """
+    src = os.path.join(testdir, 'src', 'prog.bpf.c')
+    inc = os.path.join(testdir, 'include')
+    _write_file(src, '#include "local.h"\n#include <vmlinux.h>\n #  include "missing.h"\n')
+    # Quoted includes are found next to the including file first
+    _write_file(os.path.join(testdir, 'src', 'local.h'), '#if 0\n#include "other.h"\n#endif\n')
+    _write_file(os.path.join(inc, 'local.h'), '')
+    # Includes behind a false #if are still followed, and cycles end
+    _write_file(os.path.join(testdir, 'src', 'other.h'), '#include "local.h"\n')
+    _write_file(os.path.join(inc, 'vmlinux.h'), '')
+
+    deps = source_deps(src, [inc])
+    assert deps[0] == (src, os.path.realpath(src))
+    assert sorted(deps) == sorted([
+        (src, os.path.realpath(src)),
+        ('local.h', os.path.join(testdir, 'src', 'local.h')),
+        ('other.h', os.path.join(testdir, 'src', 'other.h')),
+        ('vmlinux.h', os.path.join(inc, 'vmlinux.h')),
+        ('missing.h', None),
+    ])
+    # The order is stable
+    assert source_deps(src, [inc]) == deps
+
+def test_compile_key(testdir):
+    """
+    Test that the compile key changes exactly when the build would.
+    """
+    src = os.path.join(testdir, 'prog.bpf.c')
+    header = os.path.join(testdir, 'include', 'prog.h')
+    clang = os.path.join(testdir, 'bin', 'clang')
+    llvm_strip = os.path.join(testdir, 'bin', 'llvm-strip')
+    _write_file(src, '#include <prog.h>\n')
+    _write_file(header, '#define X 1\n')
+    _write_tool(clang, 'clang version 1')
+    _write_tool(llvm_strip, 'llvm-strip version 1')
+    args = ['-O2', '-I', os.path.join(testdir, 'include')]
+
+    key = compile_key(src, clang, llvm_strip, args)
+    assert compile_key(src, clang, llvm_strip, args) == key
+
+    keys = {key}
+    # Included headers are part of the key
+    _write_file(header, '#define X 2\n')
+    keys.add(compile_key(src, clang, llvm_strip, args))
+    keys.add(compile_key(src, clang, llvm_strip, args + ['-DY']))
+    _write_tool(clang, 'clang version 2')
+    keys.add(compile_key(src, clang, llvm_strip, args))
+    _write_tool(llvm_strip, 'llvm-strip version 2')
+    keys.add(compile_key(src, clang, llvm_strip, args))
+    assert len(keys) == 5
+
+def test_build_cache(testdir):
+    """
+    Test storing, replacing and looking up build cache entries.
+    """
+    cache = BuildCache(os.path.join(testdir, 'cache'))
+    # Key parts are length-prefixed, so they cannot run into each other
+    assert BuildCache.key(b'ab', b'c') != BuildCache.key(b'a', b'bc')
+    key = BuildCache.key(b'entry')
+    assert cache.get(key, 'object.bpf.o') is None
+
+    artifact = os.path.join(testdir, 'artifact')
+    for contents in ('one', 'two'):
+        _write_file(artifact, contents)
+        cache.put(key, 'object.bpf.o', artifact)
+        cached = cache.get(key, 'object.bpf.o')
+        with open(cached) as f:
+            assert f.read() == contents
+    # Entries are replaced by renaming, so no temporary files are left behind
+    assert os.listdir(os.path.dirname(cached)) == ['object.bpf.o']
+
+    dest = os.path.join(testdir, 'dest')
+    copy_atomic(cached, dest)
+    with open(dest) as f:
+        assert f.read() == 'two'
+    assert not [f for f in os.listdir(testdir) if f.endswith('.tmp')]
+
+    cache.clear()
+    assert cache.get(key, 'object.bpf.o') is None
+
+def test_build_cache_lock(testdir):
+    """
+    Test that the lock on a cache key excludes other holders of the same key only.
+    """
+    cache = BuildCache(os.path.join(testdir, 'cache'))
+    key = BuildCache.key(b'entry')
+    order = []
+
+    def take_lock():
+        with cache.lock(key):
+            order.append('second')
+
+    with cache.lock(key):
+        thread = threading.Thread(target=take_lock)
+        thread.start()
+        thread.join(0.2)
+        assert thread.is_alive()
+        with cache.lock(BuildCache.key(b'other')):
+            pass
+        order.append('first')
+    thread.join()
+    assert order == ['first', 'second']
+
+def test_bootstrap_cache(testdir, cache_dir):
+    """
+    Test that bootstrapping an unchanged source reuses the cached object.
+    """
+    Bootstrap.bootstrap(BPF_SRC, outdir=testdir)
+    report = LoadReport()
+    Bootstrap.bootstrap(BPF_SRC, outdir=testdir, report=report)
+    assert 'cached_object' in report.durations('bootstrap')
+    assert os.listdir(cache_dir)
+
+def test_build_all(testdir, monkeypatch):
+    """
+    Test the build_all() manifest and that one failed object does not stop the others.
+    """
+    srcs = [os.path.join(testdir, d, f'{name}.bpf.c') for d, name in (('a', 'one'), ('a', 'bad'), ('b', 'two'))]
+    for src in srcs:
+        _write_file(src, '')
+
+    def generate_vmlinux(bpfdir, **kwargs):
+        vmlinux_h = os.path.join(bpfdir, 'vmlinux.h')
+        with open(vmlinux_h, 'w'):
+            pass
+        return vmlinux_h
+
+    def compile_bpf(bpf_src, outdir=None, report=None, **kwargs):
+        if 'bad' in bpf_src:
+            raise Exception('Failed to compile BPF program')
+        return bpf_src.replace('.bpf.c', '.bpf.o')
+
+    def generate_skeleton(bpf_obj_path, outdir=None, **kwargs):
+        return os.path.join(outdir, os.path.basename(bpf_obj_path) + '.py'), 'Skeleton'
+
+    monkeypatch.setattr(Bootstrap, 'generate_vmlinux', staticmethod(generate_vmlinux))
+    monkeypatch.setattr(Bootstrap, 'compile_bpf', staticmethod(compile_bpf))
+    monkeypatch.setattr(Bootstrap, 'generate_skeleton', staticmethod(generate_skeleton))
+
+    manifest = os.path.join(testdir, 'manifest.json')
+    # Duplicate sources are built once
+    result = Bootstrap.build_all(srcs + srcs[:1], outdir=testdir, jobs=2, manifest=manifest)
+
+    assert result['jobs'] == 2
+    assert [o['source'] for o in result['objects']] == srcs
+    good, bad, other = result['objects']
+    assert bad['error'] == 'Failed to compile BPF program'
+    assert 'object' not in bad
+    for entry in (good, other):
+        assert 'error' not in entry
+        assert entry['object'] == entry['source'].replace('.bpf.c', '.bpf.o')
+        assert entry['skeleton_class'] == 'Skeleton'
+        assert not entry['cached']
+        assert 'compile_bpf' in entry['steps']
+
+    with open(manifest) as f:
+        assert json.load(f) == result
+
+    # Every source directory shares the one vmlinux.h
+    assert os.path.islink(os.path.join(testdir, 'b', 'vmlinux.h'))
+    assert os.path.realpath(os.path.join(testdir, 'b', 'vmlinux.h')) == os.path.join(testdir, 'a', 'vmlinux.h')
+
+def test_skeleton_key(testdir, monkeypatch):
+    """
+    Test that the skeleton key covers the object and the skeleton and type generators.
+    """
+    obj = os.path.join(testdir, 'prog.bpf.o')
+    _write_file(obj, 'object')
+    key = skeleton_key(obj)
+    assert skeleton_key(obj, 'zlib') != key
+
+    for module in (skeleton_module, btf_module):
+        copy = os.path.join(testdir, os.path.basename(module.__file__))
+        with open(module.__file__) as f:
+            _write_file(copy, f.read() + '\n# changed\n')
+        with monkeypatch.context() as m:
+            m.setattr(module, '__file__', copy)
+            assert skeleton_key(obj) != key
+    assert skeleton_key(obj) == key
@@ -29,10 +29,30 @@ from multiprocessing import cpu_count
 import pytest
 
 from pybpf.maps import create_map
+from pybpf.histogram import Histogram, LINEAR
+from pybpf.sketch import TopK, HyperLogLog
+from pybpf.sampling import Sampler, RateLimiter, Budget
+from pybpf.aggregation import Aggregation
 from pybpf.utils import project_path, which
 
 BPF_SRC = project_path('tests/bpf_src')
 
+# Must match TRIGGER_BASE in bpf_src/trigger.h
+TRIGGER_BASE = 1000000
+
+def getpgid(pid: int):
+    try:
+        os.getpgid(pid)
+    except OSError:
+        pass
+
+def trigger(value: int, times: int = 1):
+    """
+    Feed @value to the test programs hooking getpgid() @times times.
+    """
+    for _ in range(times):
+        getpgid(TRIGGER_BASE + value)
+
 def test_ringbuf(skeleton):
     """
     Test that ringbuf maps can pass data to userspace from BPF programs.
@@ -155,6 +175,50 @@ def test_hash(skeleton):
         with pytest.raises(KeyError):
             _hash[i]
 
+def test_fast_lookup(skeleton):
+    """
+    Test the allocation-free get_int() and get_into() lookups.
+    """
+    skel = skeleton(os.path.join(BPF_SRC, 'maps.bpf.c'))
+
+    skel.maps.hash.register_key_type(ct.c_int)
+    skel.maps.hash.register_value_type(ct.c_int)
+    _hash = skel.maps.hash
+
+    for i in range(10):
+        _hash[i] = i * 2
+
+    out = ct.c_int()
+    for i in range(10):
+        assert _hash.get_int(i) == i * 2
+        assert _hash.get_into(i, out) is out
+        assert out.value == i * 2
+    assert _hash.get_int(ct.c_int(3)) == 6
+
+    with pytest.raises(KeyError):
+        _hash.get_int(666)
+    with pytest.raises(KeyError):
+        _hash.get_into(666, out)
+    with pytest.raises(ValueError):
+        _hash.get_into(1, ct.c_char())
+
+    # Per-cpu values are arrays, not scalars
+    percpu_array = skel.maps.percpu_array
+    percpu_array.register_value_type(ct.c_int)
+    with pytest.raises(TypeError):
+        percpu_array.get_int(0)
+
+    # Per-cpu lookups copy out one value for every possible CPU
+    init = percpu_array.ValueType()
+    for i in range(len(init)):
+        init[i] = i
+    percpu_array[0] = init
+    out = percpu_array.ValueType()
+    assert percpu_array.get_into(0, out) is out
+    assert list(out) == list(range(len(init)))
+    with pytest.raises(ValueError):
+        percpu_array.get_into(0, (ct.c_char * (ct.sizeof(out) - 1))())
+
 def test_percpu_hash(skeleton):
     """
     Test BPF_PERCPU_HASH.
@@ -337,7 +401,29 @@ def test_prog_array(skeleton):
     """
     Test BPF_PROG_ARRAY.
     """
-    pytest.skip('TODO')
+    XDP_DROP = 1
+    XDP_PASS = 2
+
+    skel = skeleton(os.path.join(BPF_SRC, 'prog_array.bpf.c'), autoload=False)
+    skel.open_bpf()
+    skel.load_bpf()
+
+    dispatch = skel.maps.dispatch
+    packet = (ct.c_ubyte * 64)()
+
+    # dispatch__0 should have been installed at index 0 by the skeleton
+    assert dispatch[0].value > 0
+    assert skel.progs.xdp_dispatch.invoke(packet) == XDP_DROP
+
+    # With index 0 empty, the tail call falls through
+    del dispatch[0]
+    with pytest.raises(KeyError):
+        dispatch[0]
+    assert skel.progs.xdp_dispatch.invoke(packet) == XDP_PASS
+
+    # Programs can be installed directly
+    dispatch[0] = skel.progs.dispatch__0
+    assert skel.progs.xdp_dispatch.invoke(packet) == XDP_DROP
 
 def test_perf_event_array(skeleton):
     """
@@ -475,6 +561,289 @@ def test_stack(skeleton):
     with pytest.raises(KeyError):
         stack.pop()
 
+def test_btf_types(skeleton):
+    """
+    Test that map key and value types are generated from BTF and registered
+    automatically.
+    """
+    skel = skeleton(os.path.join(BPF_SRC, 'btf_types.bpf.c'))
+
+    events = skel.maps.events
+    assert events.KeyType is ct.c_uint32
+    assert events.ValueType is skel.types.struct_event
+    assert ct.sizeof(events.ValueType) == 40
+
+    event = events.ValueType(pid=1, comm=b'pybpf', ts=2)
+    event.flag = 1
+    event.level = 5
+    event.delta = -3
+    events[7] = event
+
+    event = events[7]
+    assert (event.pid, event.comm, event.ts) == (1, b'pybpf', 2)
+    assert (event.flag, event.level, event.delta) == (1, 5, -3)
+
+    # Unions keep the tail padding that BTF gives them
+    tagged_values = skel.maps.tagged_values
+    assert ct.sizeof(skel.types.union_tagged) == 16
+    assert tagged_values.ValueType.tail.offset == 16
+    tagged_values[0] = tagged_values.ValueType(tail=7)
+    assert tagged_values[0].tail == 7
+
+    # Global variables are typed by their data section
+    rodata = [m for name, m in skel.maps.items() if name.endswith('.rodata')][0]
+    assert rodata[0].threshold == 42
+    bss = [m for name, m in skel.maps.items() if name.endswith('.bss')][0]
+    assert bss[0].counter >= 0
+
+def test_occupancy(skeleton):
+    """
+    Test exact and estimated map entry counts.
+    """
+    skel = skeleton(os.path.join(BPF_SRC, 'occupancy.bpf.c'))
+
+    counted = skel.maps.counted
+    assert counted.count() == counted.count(exact=False) == 0
+
+    # Insert 10 keys, updating half of them a second time
+    for i in range(10):
+        trigger(i)
+    for i in range(5):
+        trigger(i)
+    assert len(counted) == counted.count() == counted.count(exact=False) == 10
+    assert counted._count_keys() == 10
+
+    # Delete 3 keys, one of them twice
+    for i in range(3):
+        getpgid(-(TRIGGER_BASE + i))
+    getpgid(-TRIGGER_BASE)
+    assert len(counted) == counted.count() == counted.count(exact=False) == 7
+    assert counted.occupancy() == counted.occupancy(exact=False) == 7 / counted.capacity()
+
+    # Maps without an occupancy counter fall back to exact counts
+    assert skel.maps.counted__occupancy.count(exact=False) == 1
+
+def test_map_dump(skeleton):
+    """
+    Test reading whole maps with BPF_MAP_ITER() iterators and batch lookups.
+    """
+    skel = skeleton(os.path.join(BPF_SRC, 'map_iter.bpf.c'))
+
+    _hash = skel.maps.hash
+    assert len(_hash.dump()) == 0
+
+    for i in range(1000):
+        _hash[i] = _hash.ValueType(count=i * 2, flags=i & 7)
+
+    records = _hash.dump()
+    assert len(records) == 1000
+    assert sorted((r.key, r.value.count, r.value.flags) for r in records) == [(i, i * 2, i & 7) for i in range(1000)]
+
+    keys, values = _hash.lookup_batch()
+    assert len(keys) == len(values) == 1000
+    assert sorted((k, v.count) for k, v in zip(keys, values)) == [(i, i * 2) for i in range(1000)]
+
+    # Iterator links are created on the first dump, then reused
+    prog = skel.progs.hash__iter
+    assert not prog._link
+    assert list(prog._iter_links) == [_hash._map_fd]
+    link = prog._iter_links[_hash._map_fd]
+    _hash.dump()
+    assert prog._iter_links == {_hash._map_fd: link}
+
+    # Hot swapping and cleaning up the skeleton destroy them
+    skel.hot_swap()
+    assert not prog._iter_links
+    assert len(skel.maps.hash.dump()) == 1000
+    prog = skel.progs.hash__iter
+    assert prog._iter_links
+    skel._cleanup()
+    assert not prog._iter_links
+
+def test_histogram(skeleton):
+    """
+    Test BPF_HISTOGRAM and BPF_HISTOGRAM_2D with the Histogram reader.
+    """
+    skel = skeleton(os.path.join(BPF_SRC, 'histogram.bpf.c'))
+
+    class Count(ct.Structure):
+        _fields_ = [('count', ct.c_uint64)]
+    skel.maps.linear_hist.register_value_type(Count)
+
+    log2_hist = Histogram(skel.maps.log2_hist)
+    linear_hist = Histogram(skel.maps.linear_hist, LINEAR, min=0, step=10)
+    keyed_hist = Histogram(skel.maps.keyed_hist, slots=32)
+
+    assert log2_hist.percentile(50) is None
+    assert keyed_hist.nkeys == 4
+
+    values = [0, 1, 5, 7, 12, 100, 1000]
+    for value in values:
+        trigger(value)
+
+    buckets = log2_hist.buckets()
+    assert sum(buckets) == len(values)
+    assert buckets[0] == 1 and buckets[1] == 1 and buckets[3] == 2
+    assert log2_hist.bucket_range(3) == (4, 8)
+    assert 4 <= log2_hist.percentile(50) < 16
+    assert log2_hist.format()
+
+    # Values past the last linear bucket are clamped into it
+    assert linear_hist.buckets() == [4, 1, 0, 0, 0, 0, 0, 0, 0, 2]
+    # Reading does not replace the value type registered for the map
+    assert skel.maps.linear_hist.ValueType._type_ is Count
+    assert sum(cpu.count for cpu in skel.maps.linear_hist[0]) == 4
+
+    rows = keyed_hist.rows()
+    assert [sum(row) for row in rows] == [4, 2, 0, 1]
+    assert rows[0] == keyed_hist.buckets(0)
+
+    log2_hist.clear()
+    assert sum(log2_hist.buckets()) == 0
+
+def test_top_k(skeleton):
+    """
+    Test BPF_COUNT_MIN_SKETCH with the TopK reader.
+    """
+    skel = skeleton(os.path.join(BPF_SRC, 'sketch.bpf.c'))
+
+    top_k = TopK(skel.maps, 'flows', 3)
+    assert top_k.read() == []
+
+    counts = {1: 100, 2: 50, 3: 20}
+    for key, times in counts.items():
+        trigger(key, times)
+    for key in range(10, 60):
+        trigger(key)
+
+    top = top_k.read()
+    assert [h.key.value for h in top] == [1, 2, 3]
+    for hitter in top:
+        assert counts[hitter.key.value] <= hitter.count <= counts[hitter.key.value] + hitter.error
+    assert top_k.sketch.estimate(ct.c_uint32(1)) >= 100
+
+    # Pruning leaves only the top k candidates behind, and shares the kth
+    # count out over the possible cpus as the admission threshold
+    assert len(skel.maps.flows__candidates) == 3
+    assert skel.maps.flows__threshold[0].value == top[-1].count // top_k._ncpus
+
+    top_k.clear()
+    assert top_k.read() == []
+
+def test_hyperloglog(skeleton):
+    """
+    Test BPF_HYPERLOGLOG with the HyperLogLog estimator.
+    """
+    skel = skeleton(os.path.join(BPF_SRC, 'hll.bpf.c'))
+
+    hll = HyperLogLog(skel.maps.distinct)
+    assert hll.m == 4096
+    assert hll.estimate() == 0
+
+    # Add 1000 distinct keys, each of them twice
+    for _ in range(2):
+        for key in range(1000):
+            trigger(key)
+
+    assert 900 <= hll.estimate() <= 1100
+
+    hll.clear()
+    assert hll.estimate() == 0
+
+def test_sampling(skeleton):
+    """
+    Test BPF_SAMPLER, BPF_RATE_LIMITER and BPF_BUDGET and their runtime
+    config.
+    """
+    skel = skeleton(os.path.join(BPF_SRC, 'sampling.bpf.c'))
+
+    sampler = Sampler(skel.maps, 'sampler')
+    limiter = RateLimiter(skel.maps, 'limiter')
+    budget = Budget(skel.maps, 'budget')
+
+    # Budgets are per cpu, so stay on one
+    affinity = os.sched_getaffinity(0)
+    os.sched_setaffinity(0, {min(affinity)})
+    try:
+        # Defaults: keep everything, 5 event bursts per key, 10 per window
+        trigger(0, 20)
+        trigger(1, 20)
+        assert sampler.stats() == (40, 0)
+        assert limiter.stats() == (10, 30)
+        assert budget.stats() == (10, 30)
+
+        # Raise the limits at runtime
+        limiter.set_rate(1e6, burst=1000)
+        budget.set_limit(1000, window=60)
+        sampler.set_rate(10)
+        trigger(2, 1000)
+        kept, dropped = sampler.stats()
+        assert kept + dropped == 1040
+        assert 50 < kept - 40 < 200
+        assert limiter.stats()[0] >= 510
+        assert budget.stats()[0] > 10
+
+        # Back to the defaults
+        limiter.reset()
+        limiter.forget()
+        assert limiter.config().burst == 0
+        before = limiter.stats()
+        trigger(3, 20)
+        assert limiter.stats()[0] - before[0] == 5
+    finally:
+        os.sched_setaffinity(0, affinity)
+
+def test_aggregation(skeleton):
+    """
+    Test BPF_AGGREGATION with the Aggregation reader.
+    """
+    skel = skeleton(os.path.join(BPF_SRC, 'aggregation.bpf.c'))
+
+    aggregation = Aggregation(skel.maps.by_residue)
+    assert aggregation.read() == {}
+
+    for value in range(30):
+        trigger(value)
+    aggregates = aggregation.read()
+    assert sorted(aggregates) == [0, 1, 2]
+    for key, agg in aggregates.items():
+        expected = list(range(key, 30, 3))
+        assert agg.count == len(expected)
+        assert agg.sum == sum(expected)
+        assert (agg.min, agg.max, agg.last) == (expected[0], expected[-1], expected[-1])
+        assert agg.mean == sum(expected) / len(expected)
+
+    # Resetting returns the interval that just ended and starts a new one
+    assert aggregation.reset() == aggregates
+    assert aggregation.read() == {}
+    trigger(4)
+    assert aggregation.reset() == {1: (1, 4, 4, 4, 4)}
+
+def test_counters(skeleton):
+    """
+    Test bpf_counter_increment and bpf_counter_add on shared and per-cpu maps,
+    running the program with ProgBase.benchmark().
+    """
+    skel = skeleton(os.path.join(BPF_SRC, 'counters.bpf.c'), autoload=False)
+    skel.open_bpf()
+    skel.load_bpf()
+
+    packet = (ct.c_ubyte * 64)()
+    prog = skel.progs.count_packets
+
+    assert prog.invoke(packet) == 2 # XDP_PASS
+    assert skel.maps.shared_counts.get_int(1) == 1
+    assert sum(skel.maps.percpu_counts[1]) == 2
+    assert sum(skel.maps.percpu_total[0]) == 3
+
+    assert prog.benchmark(1000, packet) >= 0
+    assert skel.maps.shared_counts.get_int(1) == 1001
+    assert sum(skel.maps.percpu_counts[1]) == 2002
+    assert sum(skel.maps.percpu_total[0]) == 3003
+
+    with pytest.raises(ValueError):
+        prog.benchmark(0, packet)
+
 def test_sk_storage(skeleton):
     """
     Test BPF_SK_STORAGE.
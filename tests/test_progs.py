@@ -21,17 +21,46 @@
 """
 
 import os
+import errno
+import json
 import time
+import shutil
+import importlib.util
 import subprocess
 import ctypes as ct
 
 import pytest
 
+from pybpf.lib import Lib
 from pybpf.maps import create_map
-from pybpf.utils import project_path, which
+from pybpf.programs import ProgSchedCls, BPF_F_ALLOW_MULTI, BPF_F_REPLACE
+from pybpf import vmlinux
+from pybpf.skeleton import unpin_bpf_object
+from pybpf.bootstrap import Bootstrap
+from pybpf.utils import project_path, which, drop_privileges
 
 BPF_SRC = project_path('tests/bpf_src/prog.bpf.c')
 XDP_SRC = project_path('tests/bpf_src/xdp.bpf.c')
+TC_SRC = project_path('tests/bpf_src/tc.bpf.c')
+CGROUP_SRC = project_path('tests/bpf_src/cgroup.bpf.c')
+UPROBE_SRC = project_path('tests/bpf_src/uprobe.bpf.c')
+KPROBE_SRC = project_path('tests/bpf_src/kprobe.bpf.c')
+ATTACH_MULTI_SRC = project_path('tests/bpf_src/attach_multi.bpf.c')
+USDT_SRC = project_path('tests/bpf_src/usdt.bpf.c')
+USDT_TARGET_SRC = project_path('tests/bpf_src/usdt_target.c')
+FREPLACE_SRC = project_path('tests/bpf_src/freplace.bpf.c')
+FREPLACE_V2_SRC = project_path('tests/bpf_src/freplace_v2.bpf.c')
+FREPLACE_TARGET_SRC = project_path('tests/bpf_src/freplace_target.bpf.c')
+BAD_PROG_SRC = project_path('tests/bpf_src/bad_prog.bpf.c')
+MAP_ITER_SRC = project_path('tests/bpf_src/map_iter.bpf.c')
+
+CGROUP_ROOT = '/sys/fs/cgroup'
+PIN_DIR = '/sys/fs/bpf/pybpf-test'
+
+# enum xdp_action
+XDP_DROP = 1
+XDP_PASS = 2
+XDP_TX = 3
 
 def test_progs_smoke(skeleton):
     """
@@ -46,6 +75,64 @@ def test_progs_smoke(skeleton):
 
     assert len(skel.progs) == EXPECTED_PROG_COUNT
 
+def test_selective_load(skeleton):
+    """
+    Test loading and attaching only some of the programs in an object.
+    """
+    skel = skeleton(BPF_SRC, load_progs=['tracepoint_sys_enter', 'tp_btf_sys_enter'], attach_progs=['tp_btf_sys_enter'])
+
+    assert set(skel.progs) == {'tracepoint_sys_enter', 'tp_btf_sys_enter'}
+    assert not skel.progs.tracepoint_sys_enter._link
+    assert skel.progs.tp_btf_sys_enter._link
+
+    times = skel.verification_times()
+    assert set(times) == set(skel.progs)
+    assert all(t >= 0 for t in times.values())
+
+    with pytest.raises(KeyError):
+        skeleton(BPF_SRC, load_progs=['foo'])
+
+def test_load_report(skeleton, testdir):
+    """
+    Test that loading a skeleton records timings for every phase, program and map.
+    """
+    skel = skeleton(BPF_SRC)
+    report = skel.load_report
+
+    phases = report.durations('phase')
+    for phase in ('open_bpf', 'init', 'load_bpf', 'bpf_object__load', 'generate_progs', 'generate_maps', 'attach_bpf'):
+        assert phases[phase] >= 0
+    assert set(report.durations('prog')) == set(skel.progs)
+    assert set(report.durations('verify')) == set(skel.progs)
+    assert set(report.durations('map')) == set(skel.maps)
+
+    trace_file = os.path.join(testdir, 'trace.json')
+    report.write_chrome_trace(trace_file)
+    with open(trace_file, 'r') as f:
+        trace = json.load(f)
+    assert len([e for e in trace['traceEvents'] if e['ph'] == 'X']) == len(report.records)
+
+def test_verifier_stats(skeleton):
+    """
+    Test per-program verifier statistics.
+    """
+    skel = skeleton(BPF_SRC)
+
+    stats = skel.verifier_stats()
+    assert set(stats) == set(skel.progs)
+    for prog_stats in stats.values():
+        assert prog_stats['verified_insns'] > 0
+        assert prog_stats['xlated_prog_len'] > 0
+        # Programs without branches may not store any states
+        assert prog_stats['total_states'] >= 0
+
+def test_verifier_log_on_failure(skeleton):
+    """
+    Test that a verifier failure reports the failing program's log.
+    """
+    with pytest.raises(Exception, match='Verifier log for unchecked_lookup'):
+        skeleton(BAD_PROG_SRC)
+
 def test_bad_prog(skeleton):
     """
     Test that accessing a non-existent prog raises a KeyError.
@@ -89,3 +176,632 @@ def test_xdp_smoke(skeleton):
     assert skel.maps.packet_count[0].value > 0
 
     skel.progs.xdp_prog.remove_xdp('lo')
+
+def _clsact_qdiscs(ifname: str):
+    out = subprocess.run(['tc', 'qdisc', 'show', 'dev', ifname], stdout=subprocess.PIPE, check=True)
+    return [line for line in out.stdout.decode().splitlines() if 'clsact' in line]
+
+def _tc_filters(ifname: str, direction: str):
+    out = subprocess.run(['tc', 'filter', 'show', 'dev', ifname, direction], stdout=subprocess.PIPE, check=True)
+    return [line for line in out.stdout.decode().splitlines() if 'bpf' in line]
+
+def test_tc_attach(skeleton):
+    """
+    Test attaching a TC classifier to lo and detaching it again, leaving the
+    clsact qdisc to other users until it is explicitly destroyed.
+    """
+    try:
+        which('tc')
+    except FileNotFoundError:
+        pytest.skip('tc not found on system')
+    if _clsact_qdiscs('lo'):
+        pytest.skip('lo already has a clsact qdisc')
+
+    skel = skeleton(TC_SRC)
+    skel.maps.packet_count.register_value_type(ct.c_uint64)
+    prog = skel.progs.tc_count
+
+    prog.attach_tc('lo', direction='ingress')
+    prog.attach_tc('lo', direction='egress', priority=2)
+    try:
+        assert _clsact_qdiscs('lo')
+        subprocess.run('ping -c 5 localhost'.split())
+        assert skel.maps.packet_count[0].value > 0
+        # Filters that are not ours survive our detach
+        subprocess.run(['tc', 'filter', 'add', 'dev', 'lo', 'ingress', 'prio', '3', 'matchall', 'action', 'pass'], check=True)
+        prog.detach_tc('lo', direction='ingress')
+        prog.detach_tc('lo', direction='egress', priority=2)
+        assert _clsact_qdiscs('lo')
+        assert not _tc_filters('lo', 'ingress')
+        assert not _tc_filters('lo', 'egress')
+        out = subprocess.run(['tc', 'filter', 'show', 'dev', 'lo', 'ingress'], stdout=subprocess.PIPE, check=True)
+        assert 'matchall' in out.stdout.decode()
+
+        count = skel.maps.packet_count[0].value
+        subprocess.run('ping -c 1 localhost'.split())
+        assert skel.maps.packet_count[0].value == count
+
+        with pytest.raises(Exception):
+            prog.detach_tc('lo')
+    finally:
+        prog.destroy_tc_hook('lo')
+    assert not _clsact_qdiscs('lo')
+
+    # A failed attach does not leave behind a qdisc it created
+    with pytest.MonkeyPatch.context() as mp:
+        mp.setattr(Lib, 'bpf_tc_attach', lambda hook, opts: -errno.EINVAL)
+        with pytest.raises(Exception, match='Failed to attach TC program'):
+            prog.attach_tc('lo')
+    assert not _clsact_qdiscs('lo')
+    assert not prog._tc_attachments
+
+def test_uprobe_symbol(skeleton):
+    """
+    Test attaching a uprobe by symbol name.
+    """
+    skel = skeleton(UPROBE_SRC, autoload=False)
+    skel.open_bpf()
+    skel.load_bpf()
+    skel.maps.calls.register_value_type(ct.c_uint64)
+
+    prog = skel.progs.uprobe_getpid
+    prog.attach_uprobe('c', 'getpid', pid=os.getpid())
+
+    # Attaching twice should be a no-op
+    prog.attach_uprobe('c', 'getpid', pid=os.getpid())
+
+    with pytest.raises(KeyError):
+        prog.attach_uprobe('c', 'pybpf_no_such_symbol')
+
+    for _ in range(10):
+        os.getpid()
+    assert skel.maps.calls[0].value >= 10
+
+    prog.detach_uprobe('c', 'getpid', pid=os.getpid())
+    count = skel.maps.calls[0].value
+    os.getpid()
+    assert skel.maps.calls[0].value == count
+
+@drop_privileges
+def _build_usdt_target(outdir, opt):
+    target = os.path.join(outdir, f'usdt_target{opt}')
+    subprocess.run(['gcc', opt, '-o', target, USDT_TARGET_SRC], check=True)
+    return target
+
+# -O0 passes the probe's variable argument on the stack, -O2 in a register
+@pytest.mark.parametrize('opt', ['-O0', '-O2'])
+def test_usdt(skeleton, testdir, opt):
+    """
+    Test attaching to a USDT probe and reading its arguments.
+    """
+    try:
+        which('gcc')
+    except FileNotFoundError:
+        pytest.skip('gcc not found on system')
+    target = _build_usdt_target(testdir, opt)
+
+    skel = skeleton(USDT_SRC, autoload=False)
+    skel.open_bpf()
+    skel.load_bpf()
+    skel.maps.probe_args.register_value_type(ct.c_long)
+    prog = skel.progs.usdt_value
+
+    with pytest.raises(KeyError):
+        prog.attach_usdt(target, 'pybpf_test', 'no_such_probe')
+
+    prog.attach_usdt(target, 'pybpf_test', 'value', spec_map=skel.maps.pybpf_usdt_specs)
+    subprocess.run([target, '-42'], check=True)
+    assert [v.value for v in skel.maps.probe_args.values()] == [-42, 7]
+
+    prog.detach_usdt(target, 'pybpf_test', 'value')
+    subprocess.run([target, '5'], check=True)
+    assert skel.maps.probe_args[0].value == -42
+
+def test_hot_swap(skeleton):
+    """
+    Test hot swapping a BPF object, keeping map state and attachments.
+    """
+    skel = skeleton(UPROBE_SRC, autoload=False)
+    skel.open_bpf()
+    skel.load_bpf()
+    skel.maps.calls.register_value_type(ct.c_uint64)
+
+    skel.progs.uprobe_getpid.attach_uprobe('c', 'getpid', pid=os.getpid())
+    for _ in range(10):
+        os.getpid()
+    assert skel.maps.calls[0].value >= 10
+
+    old_prog = skel.progs.uprobe_getpid
+    skel.hot_swap()
+    assert skel.progs.uprobe_getpid is not old_prog
+    assert not old_prog._uprobe_links
+
+    # The map is shared with the new object, so the count carries over
+    count = skel.maps.calls[0].value
+    assert count >= 10
+    for _ in range(10):
+        os.getpid()
+    assert skel.maps.calls[0].value >= count + 10
+
+def test_hot_swap_link_update(skeleton):
+    """
+    Test that hot swapping updates cgroup links in place and falls back to
+    attach-before-detach for links that cannot be updated.
+    """
+    if not os.path.exists(os.path.join(CGROUP_ROOT, 'cgroup.controllers')):
+        pytest.skip(f'cgroup v2 is not mounted at {CGROUP_ROOT}')
+
+    # Tracing links cannot be updated, so the new programs get new links
+    skel = skeleton(BPF_SRC)
+    old_progs = {name: prog for name, prog in skel.progs.items() if prog._link}
+    assert old_progs
+    skel.hot_swap()
+    for name, old_prog in old_progs.items():
+        assert skel.progs[name]._link
+        assert not old_prog._link
+
+    skel = skeleton(CGROUP_SRC)
+    cgroup = os.path.join(CGROUP_ROOT, 'pybpf_test_hot_swap')
+    os.makedirs(cgroup, exist_ok=True)
+    try:
+        old_prog = skel.progs.cgroup_egress
+        old_prog.attach_cgroup(cgroup)
+        link = old_prog._cgroup_attachments[cgroup]
+        skel.hot_swap()
+        # The same link now runs the new program
+        assert skel.progs.cgroup_egress._cgroup_attachments[cgroup] == link
+        assert not old_prog._cgroup_attachments
+
+        # Legacy attachments are moved over with bpf_prog_attach()
+        skel.progs.cgroup_egress.detach_cgroup(cgroup)
+        skel.progs.cgroup_egress.attach_cgroup(cgroup, flags=0)
+        old_prog = skel.progs.cgroup_egress
+        skel.hot_swap()
+        prog = skel.progs.cgroup_egress
+        assert prog._cgroup_attachments == {cgroup: None}
+        assert not old_prog._cgroup_attachments
+        prog.detach_cgroup(cgroup)
+    finally:
+        os.rmdir(cgroup)
+
+def test_hot_swap_xdp(skeleton):
+    """
+    Test hot swapping an XDP program attached to lo.
+    """
+    skel = skeleton(XDP_SRC)
+    skel.maps.packet_count.register_value_type(ct.c_int)
+    old_prog = skel.progs.xdp_prog
+    old_prog.attach_xdp('lo')
+    try:
+        skel.hot_swap()
+    except Exception:
+        old_prog.remove_xdp('lo')
+        raise
+    prog = skel.progs.xdp_prog
+    assert not old_prog._xdp_ifindexes
+
+    count = skel.maps.packet_count[0].value
+    subprocess.run('ping -c 5 localhost'.split())
+    assert skel.maps.packet_count[0].value > count
+
+    prog.remove_xdp('lo')
+
+def test_hot_swap_tc(skeleton, testdir):
+    """
+    Test hot swapping TC classifiers, rolling back a failed swap, and dropping
+    a classifier in the new version.
+    """
+    try:
+        which('tc')
+    except FileNotFoundError:
+        pytest.skip('tc not found on system')
+    if _clsact_qdiscs('lo'):
+        pytest.skip('lo already has a clsact qdisc')
+
+    skel = skeleton(TC_SRC)
+    skel.maps.packet_count.register_value_type(ct.c_uint64)
+    skel.progs.tc_count.attach_tc('lo')
+
+    old_prog = skel.progs.tc_count
+    skel.hot_swap()
+    assert skel.progs.tc_count is not old_prog
+    assert not old_prog._tc_attachments
+    count = skel.maps.packet_count[0].value
+    subprocess.run('ping -c 5 localhost'.split())
+    assert skel.maps.packet_count[0].value > count
+
+    # A swap that fails partway through leaves the old version running
+    take_over = ProgSchedCls._take_over
+    calls = []
+    def failing_take_over(self, old):
+        take_over(self, old)
+        calls.append(self)
+        if len(calls) == 1:
+            raise Exception('Injected failure')
+    old_prog = skel.progs.tc_count
+    with pytest.MonkeyPatch.context() as mp:
+        mp.setattr(ProgSchedCls, '_take_over', failing_take_over)
+        with pytest.raises(Exception, match='Injected failure'):
+            skel.hot_swap()
+    assert skel.progs.tc_count is old_prog
+    assert old_prog._tc_attachments
+    count = skel.maps.packet_count[0].value
+    subprocess.run('ping -c 5 localhost'.split())
+    assert skel.maps.packet_count[0].value > count
+
+    # The classifier is not in the new version, so its filter goes away
+    try:
+        skel.hot_swap(Bootstrap.compile_bpf(CGROUP_SRC, outdir=testdir))
+        assert 'tc_count' not in skel.progs
+        assert not old_prog._tc_attachments
+        assert not _tc_filters('lo', 'ingress')
+    finally:
+        old_prog.destroy_tc_hook('lo')
+
+def test_hot_swap_freplace(skeleton, testdir):
+    """
+    Test hot swapping freplace (EXT) programs, with and without a new target.
+    """
+    packet = (ct.c_ubyte * 64)()
+    targets = []
+    for _ in range(2):
+        target = skeleton(FREPLACE_TARGET_SRC, autoload=False)
+        target.open_bpf()
+        target.load_bpf()
+        assert target.progs.xdp_entry.invoke(packet) == XDP_PASS
+        targets.append(target)
+
+    skel = skeleton(FREPLACE_SRC, autoload=False)
+    skel.open_bpf()
+    skel.set_prog_attach_target('new_verdict', targets[0].progs.xdp_entry)
+    skel.load_bpf()
+    skel.attach_bpf()
+    assert targets[0].progs.xdp_entry.invoke(packet) == XDP_DROP
+
+    # By default, the new version extends the same program
+    v2 = Bootstrap.compile_bpf(FREPLACE_V2_SRC, outdir=testdir)
+    skel.hot_swap(v2)
+    assert targets[0].progs.xdp_entry.invoke(packet) == XDP_TX
+
+    # Explicit targets move the extension
+    skel.hot_swap(v2, ext_targets={'new_verdict': targets[1].progs.xdp_entry})
+    assert targets[0].progs.xdp_entry.invoke(packet) == XDP_PASS
+    assert targets[1].progs.xdp_entry.invoke(packet) == XDP_TX
+
+def test_pin_reattach(skeleton):
+    """
+    Test pinning a skeleton and adopting the pins from a fresh skeleton.
+    """
+    if not os.path.ismount('/sys/fs/bpf'):
+        pytest.skip('No BPF filesystem mounted at /sys/fs/bpf')
+
+    skel = skeleton(BPF_SRC)
+    skel.pin_bpf(PIN_DIR)
+    try:
+        new_skel = skeleton(BPF_SRC, autoload=False)
+        new_skel.reattach_from_pins(PIN_DIR)
+        assert set(new_skel.progs) == set(skel.progs)
+        assert set(new_skel.maps) == set(skel.maps)
+        # Auto-attached programs come back with their links
+        for name, prog in skel.progs.items():
+            assert bool(new_skel.progs[name]._link) == bool(prog._link)
+    finally:
+        skel.unpin_bpf(PIN_DIR)
+
+    new_skel = skeleton(BPF_SRC, autoload=False)
+    with pytest.raises(FileNotFoundError):
+        new_skel.reattach_from_pins(PIN_DIR)
+
+def test_pin_outlives_skeleton(skeleton):
+    """
+    Test that pinned programs keep running after the skeleton that pinned
+    them is closed, and that a fresh skeleton adopts all of their links.
+    """
+    if not os.path.ismount('/sys/fs/bpf'):
+        pytest.skip('No BPF filesystem mounted at /sys/fs/bpf')
+    if not os.path.exists(os.path.join(CGROUP_ROOT, 'cgroup.controllers')):
+        pytest.skip(f'cgroup v2 is not mounted at {CGROUP_ROOT}')
+
+    pin_dirs = {src: f'{PIN_DIR}-{i}' for i, src in enumerate((ATTACH_MULTI_SRC, UPROBE_SRC, CGROUP_SRC))}
+    # A cgroup cannot mix links with legacy attachments made without BPF_F_ALLOW_MULTI
+    cgroup, legacy_cgroup = (os.path.join(CGROUP_ROOT, f'pybpf_test_pin_{i}') for i in range(2))
+    for path in (cgroup, legacy_cgroup):
+        os.makedirs(path, exist_ok=True)
+    try:
+        skels = {}
+        for src in pin_dirs:
+            skels[src] = skeleton(src, autoload=False)
+            skels[src].open_bpf()
+            skels[src].load_bpf()
+        skels[ATTACH_MULTI_SRC].progs.kprobe_multi_count.attach_multi(['*sys_getppid'])
+        skels[ATTACH_MULTI_SRC].progs.fentry_count.attach_multi(['*sys_getppid'])
+        skels[UPROBE_SRC].progs.uprobe_getpid.attach_uprobe('c', 'getpid', pid=os.getpid())
+        skels[CGROUP_SRC].progs.cgroup_egress.attach_cgroup(cgroup)
+        skels[CGROUP_SRC].progs.cgroup_egress_v2.attach_cgroup(legacy_cgroup, flags=0)
+        for src, skel in skels.items():
+            skel.pin_bpf(pin_dirs[src])
+            # Closing the skeleton destroys its links, but pinned links stay attached
+            skel._cleanup()
+        assert not skels[UPROBE_SRC].progs.uprobe_getpid._uprobe_links
+
+        adopted = {}
+        for src, pin_dir in pin_dirs.items():
+            adopted[src] = skeleton(src, autoload=False)
+            adopted[src].reattach_from_pins(pin_dir)
+
+        multi = adopted[ATTACH_MULTI_SRC]
+        multi.maps.calls.register_value_type(ct.c_uint64)
+        counts = [v.value for v in multi.maps.calls.values()]
+        os.getppid()
+        assert multi.maps.calls[0].value > counts[0]
+        assert multi.maps.calls[1].value > counts[1]
+        assert multi.progs.kprobe_multi_count._kprobe_links
+        assert multi.progs.fentry_count._clones
+
+        uprobe = adopted[UPROBE_SRC]
+        uprobe.maps.calls.register_value_type(ct.c_uint64)
+        count = uprobe.maps.calls[0].value
+        os.getpid()
+        assert uprobe.maps.calls[0].value > count
+        assert uprobe.progs.uprobe_getpid._uprobe_links
+
+        cgroup_skel = adopted[CGROUP_SRC]
+        assert cgroup_skel.progs.cgroup_egress._cgroup_attachments[cgroup]
+        assert cgroup_skel.progs.cgroup_egress_v2._cgroup_attachments == {legacy_cgroup: None}
+        # The legacy attachment is detached through the adopted program
+        cgroup_skel.progs.cgroup_egress_v2.detach_cgroup(legacy_cgroup)
+    finally:
+        for pin_dir in pin_dirs.values():
+            unpin_bpf_object(pin_dir)
+        for path in (cgroup, legacy_cgroup):
+            os.rmdir(path)
+
+def test_pin_adopted_progs(skeleton):
+    """
+    Test what adopted programs can do besides keeping their attachments:
+    dump maps, hot swap, and refuse clearly to be attached anew.
+    """
+    if not os.path.ismount('/sys/fs/bpf'):
+        pytest.skip('No BPF filesystem mounted at /sys/fs/bpf')
+
+    pin_dirs = {src: f'{PIN_DIR}-{i}' for i, src in enumerate((UPROBE_SRC, MAP_ITER_SRC))}
+    try:
+        skel = skeleton(UPROBE_SRC, autoload=False)
+        skel.open_bpf()
+        skel.load_bpf()
+        skel.progs.uprobe_getpid.attach_uprobe('c', 'getpid', pid=os.getpid())
+        skel.pin_bpf(pin_dirs[UPROBE_SRC])
+        skel._cleanup()
+
+        skel = skeleton(MAP_ITER_SRC)
+        for i in range(10):
+            skel.maps.hash[i] = skel.maps.hash.ValueType(count=i)
+        skel.pin_bpf(pin_dirs[MAP_ITER_SRC])
+        skel._cleanup()
+
+        # Iterators are linked from the adopted program's fd
+        adopted = skeleton(MAP_ITER_SRC, autoload=False)
+        adopted.reattach_from_pins(pin_dirs[MAP_ITER_SRC])
+        assert sorted(r.value.count for r in adopted.maps.hash.dump()) == list(range(10))
+
+        adopted = skeleton(UPROBE_SRC, autoload=False)
+        adopted.reattach_from_pins(pin_dirs[UPROBE_SRC])
+        adopted.maps.calls.register_value_type(ct.c_uint64)
+        prog = adopted.progs.uprobe_getpid
+        with pytest.raises(Exception, match='adopted from pins'):
+            prog.attach_uprobe('c', 'getppid', pid=os.getpid())
+        with pytest.raises(Exception, match='adopted from pins'):
+            prog.attach()
+
+        # A new version takes over the adopted uprobe
+        adopted.hot_swap()
+        assert adopted.progs.uprobe_getpid is not prog
+        assert not prog._uprobe_links
+        assert adopted.progs.uprobe_getpid._uprobe_links
+        count = adopted.maps.calls[0].value
+        os.getpid()
+        assert adopted.maps.calls[0].value > count
+    finally:
+        for pin_dir in pin_dirs.values():
+            unpin_bpf_object(pin_dir)
+
+def test_kprobe_multi(skeleton):
+    """
+    Test attaching one kprobe program to many kernel functions at once.
+    """
+    skel = skeleton(KPROBE_SRC, autoload=False)
+    skel.open_bpf()
+    skel.load_bpf()
+    skel.maps.calls.register_value_type(ct.c_uint64)
+
+    prog = skel.progs.kprobe_count
+    failures = prog.attach_multi(['*sys_getppid', '*sys_getpgrp'])
+    assert 'pybpf_no_such_function' in prog.attach_multi('pybpf_no_such_function')
+
+    os.getppid()
+    os.getpgrp()
+    assert skel.maps.calls[0].value >= 2, failures
+
+    prog.detach_multi()
+    count = skel.maps.calls[0].value
+    os.getppid()
+    assert skel.maps.calls[0].value == count
+
+def test_kprobe_multi_link(skeleton):
+    """
+    Test attaching a kprobe.multi program with one link, isolating bad functions.
+    """
+    skel = skeleton(ATTACH_MULTI_SRC, autoload=False)
+    skel.open_bpf()
+    skel.load_bpf()
+    skel.maps.calls.register_value_type(ct.c_uint64)
+
+    prog = skel.progs.kprobe_multi_count
+    # A bad symbol fails on its own rather than taking the batch down with it
+    failures = prog.attach_multi(['*sys_getppid', '*sys_getpgrp', 'pybpf_no_such_function'])
+    assert 'pybpf_no_such_function' in failures
+    attached = {func for func, _ in prog._kprobe_links}
+    assert attached and not attached & set(failures)
+
+    os.getppid()
+    os.getpgrp()
+    assert skel.maps.calls[0].value >= 2
+
+    prog.detach_multi()
+    count = skel.maps.calls[0].value
+    os.getppid()
+    assert skel.maps.calls[0].value == count
+
+def test_fentry_multi(skeleton):
+    """
+    Test attaching clones of an fentry program to many kernel functions.
+    """
+    skel = skeleton(ATTACH_MULTI_SRC, autoload=False)
+    skel.open_bpf()
+    skel.load_bpf()
+    skel.maps.calls.register_value_type(ct.c_uint64)
+
+    prog = skel.progs.fentry_count
+    failures = prog.attach_multi(['*sys_getppid', 'pybpf_no_such_function'])
+    assert isinstance(failures['pybpf_no_such_function'], KeyError)
+    assert prog._clones
+
+    os.getppid()
+    assert skel.maps.calls[1].value >= 1
+
+    prog.detach_multi()
+    assert not prog._clones
+    count = skel.maps.calls[1].value
+    os.getppid()
+    assert skel.maps.calls[1].value == count
+
+def test_cgroup_attach(skeleton):
+    """
+    Test attaching cgroup programs to many cgroups at once.
+    """
+    if not os.path.exists(os.path.join(CGROUP_ROOT, 'cgroup.controllers')):
+        pytest.skip(f'cgroup v2 is not mounted at {CGROUP_ROOT}')
+
+    skel = skeleton(CGROUP_SRC)
+    prog = skel.progs.cgroup_egress
+
+    cgroups = [os.path.join(CGROUP_ROOT, f'pybpf_test_{i}') for i in range(10)]
+    missing = os.path.join(CGROUP_ROOT, 'pybpf_test_missing')
+    for cgroup in cgroups:
+        os.makedirs(cgroup, exist_ok=True)
+
+    try:
+        open_fds = len(os.listdir('/proc/self/fd'))
+
+        # Failures should be reported per cgroup without aborting the batch
+        failures = prog.attach_cgroups(cgroups + [missing])
+        assert list(failures) == [missing]
+
+        for cgroup in cgroups:
+            prog.detach_cgroup(cgroup)
+
+        with pytest.raises(KeyError):
+            prog.detach_cgroup(cgroups[0])
+
+        # Cgroup directories are not held open once attached
+        assert len(os.listdir('/proc/self/fd')) == open_fds
+
+        # BPF_F_REPLACE swaps out a program attached by bpf_prog_attach()
+        v2 = skel.progs.cgroup_egress_v2
+        attach_type = Lib.bpf_program_expected_attach_type(prog._prog)
+        fd = os.open(cgroups[0], os.O_RDONLY | os.O_DIRECTORY)
+        try:
+            assert Lib.bpf_prog_attach(prog._prog_fd, fd, attach_type, BPF_F_ALLOW_MULTI) == 0
+            with pytest.raises(ValueError):
+                v2.attach_cgroup(cgroups[0], BPF_F_ALLOW_MULTI | BPF_F_REPLACE)
+            v2.attach_cgroup(cgroups[0], BPF_F_ALLOW_MULTI | BPF_F_REPLACE, replace=prog)
+            assert Lib.bpf_prog_detach2(prog._prog_fd, fd, attach_type) < 0
+        finally:
+            os.close(fd)
+        v2.detach_cgroup(cgroups[0])
+    finally:
+        for cgroup in cgroups:
+            os.rmdir(cgroup)
+
+@drop_privileges
+def _copy_prog_src(bpf_dir):
+    os.makedirs(bpf_dir)
+    for f in ('prog.bpf.c', 'pybpf.bpf.h'):
+        shutil.copy(project_path(f'tests/bpf_src/{f}'), bpf_dir)
+
+def test_pruned_vmlinux(testdir):
+    """
+    Test compiling and loading against a pruned, precompiled vmlinux.h.
+    """
+    bpf_dir = os.path.join(testdir, 'bpf')
+    _copy_prog_src(bpf_dir)
+
+    full = os.path.realpath(Bootstrap.generate_vmlinux(bpf_dir))
+    pruned = os.path.realpath(Bootstrap.generate_vmlinux(bpf_dir, prune=True, pch=True))
+    assert pruned != full
+    assert os.path.getsize(pruned) < os.path.getsize(full)
+    assert os.path.exists(pruned + '.pch')
+
+    # Unchanged sources should reuse the pruned header
+    mtime = os.stat(pruned).st_mtime_ns
+    Bootstrap.generate_vmlinux(bpf_dir, prune=True)
+    assert os.stat(pruned).st_mtime_ns == mtime
+
+    obj = Bootstrap.compile_bpf(os.path.join(bpf_dir, 'prog.bpf.c'), outdir=testdir, pch=True)
+    skel_file, skel_cls = Bootstrap.generate_skeleton(obj, outdir=testdir)
+    spec = importlib.util.spec_from_file_location(skel_cls, skel_file)
+    skel_mod = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(skel_mod)
+    skel = getattr(skel_mod, skel_cls)()
+    assert len(skel.progs) == 4
+
+def test_pruned_vmlinux_fallback(testdir, monkeypatch):
+    """
+    Test that the full vmlinux.h is used when the sources do not compile against the pruned one.
+    """
+    bpf_dir = os.path.join(testdir, 'bpf')
+    _copy_prog_src(bpf_dir)
+    full = os.path.realpath(Bootstrap.generate_vmlinux(bpf_dir))
+
+    # Keep no types at all, so that pruning cannot succeed
+    monkeypatch.setattr(vmlinux, 'source_names', lambda bpf_srcs, clang_args: (set(), set()))
+    monkeypatch.setattr(vmlinux, 'missing_names', lambda clang_output: set())
+    pruned = os.path.realpath(Bootstrap.generate_vmlinux(bpf_dir, prune=True))
+    assert pruned != full
+    assert os.path.getsize(pruned) > os.path.getsize(full)
+
+    Bootstrap.compile_bpf(os.path.join(bpf_dir, 'prog.bpf.c'), outdir=testdir)
+
+@drop_privileges
+def _copy_file(src, dest):
+    shutil.copy(src, dest)
+
+@drop_privileges
+def _remove_file(path):
+    os.unlink(path)
+
+@pytest.mark.parametrize('embed', ['raw', 'zlib'])
+def test_embedded_skeleton(testdir, embed):
+    """
+    Test that a skeleton with an embedded BPF object loads without the object file.
+    """
+    Bootstrap.generate_vmlinux(os.path.dirname(BPF_SRC))
+    obj = Bootstrap.compile_bpf(BPF_SRC, outdir=testdir)
+    obj_copy = os.path.join(testdir, 'prog.bpf.o')
+    _copy_file(obj, obj_copy)
+    skel_file, skel_cls = Bootstrap.generate_skeleton(obj_copy, outdir=testdir, embed=embed)
+    _remove_file(obj_copy)
+
+    spec = importlib.util.spec_from_file_location(skel_cls, skel_file)
+    skel_mod = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(skel_mod)
+    skel = getattr(skel_mod, skel_cls)()
+    assert len(skel.progs) == 4
+
+    # Hot swapping defaults to the embedded object too
+    old_progs = dict(skel.progs)
+    skel.hot_swap()
+    assert set(skel.progs) == set(old_progs)
+    for name, prog in skel.progs.items():
+        assert prog is not old_progs[name]
+        assert not old_progs[name]._link
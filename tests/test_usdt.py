@@ -0,0 +1,192 @@
+"""
+    pybpf - A BPF CO-RE (Compile Once Run Everywhere) wrapper for Python3
+    Copyright (C) 2020  William Findlay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+"""
+
+import struct
+import ctypes as ct
+from typing import NamedTuple
+
+import pytest
+
+from pybpf.usdt import parse_usdt_arg, _parse_usdt_probes, usdt_spec_id, UsdtArgType, UsdtSpec
+
+# Offsets into struct pt_regs on x86_64
+PT_REGS_RBP = 32
+PT_REGS_RDI = 112
+
+def test_parse_usdt_arg_const():
+    """
+    Test parsing constant USDT arguments.
+    """
+    spec = parse_usdt_arg('4@$5')
+    assert spec.arg_type == UsdtArgType.CONST
+    assert spec.val_off == 5
+    assert not spec.arg_signed
+    assert spec.arg_bitshift == 32
+
+    spec = parse_usdt_arg('-8@$-1')
+    assert spec.arg_type == UsdtArgType.CONST
+    assert spec.val_off == 0xffffffffffffffff
+    assert spec.arg_signed
+    assert spec.arg_bitshift == 0
+
+    assert parse_usdt_arg('2@$0x10').val_off == 16
+
+def test_parse_usdt_arg_reg():
+    """
+    Test parsing register and dereferenced register USDT arguments.
+    """
+    spec = parse_usdt_arg('-4@%edi')
+    assert spec.arg_type == UsdtArgType.REG
+    assert spec.reg_off == PT_REGS_RDI
+    assert spec.arg_signed
+    assert spec.arg_bitshift == 32
+
+    # Every width of a register maps to the same pt_regs slot
+    assert parse_usdt_arg('8@%rdi').reg_off == parse_usdt_arg('1@%dil').reg_off == PT_REGS_RDI
+    assert parse_usdt_arg('8@%r9').reg_off == parse_usdt_arg('4@%r9d').reg_off
+
+    spec = parse_usdt_arg('8@-16(%rbp)')
+    assert spec.arg_type == UsdtArgType.REG_DEREF
+    assert spec.reg_off == PT_REGS_RBP
+    assert spec.val_off == (-16) & 0xffffffffffffffff
+
+    spec = parse_usdt_arg('1@(%rbp)')
+    assert spec.arg_type == UsdtArgType.REG_DEREF
+    assert spec.val_off == 0
+    assert spec.arg_bitshift == 56
+
+@pytest.mark.parametrize('arg', ['', '4', '3@%edi', '4@%xmm0', '4@edi', '4@16(%rbp,%rax,4)'])
+def test_parse_usdt_arg_invalid(arg):
+    """
+    Test that malformed or unsupported USDT arguments are rejected.
+    """
+    with pytest.raises(ValueError):
+        parse_usdt_arg(arg)
+
+class FakeSection(NamedTuple):
+    addr: int
+
+class FakeElf:
+    """
+    Just enough of ElfFile for _parse_usdt_probes(), with one loadable
+    segment mapping virtual address 0x401000 to file offset 0x1000.
+    """
+    path = '/fake/binary'
+    is64 = True
+    endian = '<'
+
+    def __init__(self, notes, base=None):
+        self._notes = notes
+        self._base = base
+
+    def section(self, name):
+        return FakeSection(self._base) if name == '.stapsdt.base' and self._base is not None else None
+
+    def notes(self, section_name):
+        assert section_name == '.note.stapsdt'
+        return self._notes
+
+    def vaddr_to_offset(self, vaddr):
+        return vaddr - 0x400000
+
+def stapsdt_note(pc, base, semaphore, provider, name, args):
+    desc = struct.pack('<QQQ', pc, base, semaphore) + b'\0'.join([provider, name, args]) + b'\0'
+    return ('stapsdt', 3, desc)
+
+def test_parse_usdt_probes():
+    """
+    Test parsing USDT probe notes, skipping notes of other owners and types.
+    """
+    elf = FakeElf([
+        stapsdt_note(0x401234, 0x402000, 0, b'prov', b'first', b'-4@%edi 8@$7'),
+        stapsdt_note(0x401300, 0x402000, 0x404010, b'prov', b'second', b''),
+        ('GNU', 3, b'\0' * 24),
+        ('stapsdt', 1, b'\0' * 24),
+        ])
+    probes = _parse_usdt_probes(elf)
+    assert [(p.provider, p.name) for p in probes] == [('prov', 'first'), ('prov', 'second')]
+
+    first, second = probes
+    assert first.path == '/fake/binary'
+    assert first.offset == 0x1234
+    assert first.semaphore_offset == 0
+    assert first.args == '-4@%edi 8@$7'
+    assert first.spec().arg_cnt == 2
+    assert second.offset == 0x1300
+    assert second.semaphore_offset == 0x4010
+    assert second.spec().arg_cnt == 0
+
+def test_parse_usdt_probes_prelinked():
+    """
+    Test that probe addresses follow .stapsdt.base when a binary was moved.
+    """
+    elf = FakeElf([stapsdt_note(0x401234, 0x402000, 0x404010, b'prov', b'moved', b'')], base=0x403000)
+    probe, = _parse_usdt_probes(elf)
+    assert probe.offset == 0x2234
+    assert probe.semaphore_offset == 0x5010
+
+class FakeSpecMap:
+    """
+    Just enough of an Array map for usdt_spec_id().
+    """
+    ValueType = UsdtSpec
+
+    def __init__(self, map_fd, capacity=4):
+        self._map_fd = map_fd
+        self._capacity = capacity
+        self.entries = {}
+
+    def capacity(self):
+        return self._capacity
+
+    def __getitem__(self, key):
+        return self.entries.get(key, UsdtSpec())
+
+    def __setitem__(self, key, value):
+        self.entries[key] = value
+
+def test_usdt_spec_ids():
+    """
+    Test that identical specs share an id and that ids belong to their map.
+    """
+    first, second = UsdtSpec(arg_cnt=1), UsdtSpec(arg_cnt=2)
+
+    spec_map = FakeSpecMap(map_fd=3)
+    assert usdt_spec_id(spec_map, first) == 0
+    assert usdt_spec_id(spec_map, second) == 1
+    assert usdt_spec_id(spec_map, first) == 0
+    assert spec_map.entries[1].arg_cnt == 2
+
+    # A new map that reuses the fd of a closed one still gets its specs
+    spec_map = FakeSpecMap(map_fd=3)
+    assert usdt_spec_id(spec_map, second) == 0
+    assert spec_map.entries[0].arg_cnt == 2
+
+    # Specs already in a map, e.g. one adopted from pins, are kept, even
+    # a zero-argument spec whose fields are all zero
+    spec_map = FakeSpecMap(map_fd=4)
+    spec_map.entries[0] = UsdtSpec(arg_cnt=0, used=1)
+    assert usdt_spec_id(spec_map, second) == 1
+    assert usdt_spec_id(spec_map, UsdtSpec()) == 0
+    assert usdt_spec_id(spec_map, first) == 2
+
+    with pytest.raises(Exception, match='No room left'):
+        for arg_cnt in range(4, 10):
+            usdt_spec_id(spec_map, UsdtSpec(arg_cnt=arg_cnt))